@@ -1,5 +1,7 @@
 #pragma once
 
+#include <utility>
+
 namespace ugi {
 
     template <class AllocatorType>
@@ -14,12 +16,43 @@ namespace ugi {
         void* alloc( size_t size ) {
             return _allocator.alloc(size);
         }
+        void* allocAligned( size_t size, size_t align ) {
+            return _allocator.allocAligned(size, align);
+        }
+        void* realloc( void* ptr, size_t size ) {
+            return _allocator.realloc(ptr, size);
+        }
+        bool tryExpand( void* ptr, size_t size ) {
+            return _allocator.tryExpand(ptr, size);
+        }
         void free( void* ptr ) {
             _allocator.free(ptr);
         }
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            return _allocator.allocBatch(size, count, out);
+        }
+        void freeBatch( void** ptrs, size_t count ) {
+            _allocator.freeBatch(ptrs, count);
+        }
         bool contains( void* ptr ) {
             return _allocator.contains(ptr);
         }
+        // only instantiated when called, allocators without stats still work
+        template< class T = AllocatorType >
+        auto getStats() -> decltype(std::declval<T&>().getStats()) {
+            return _allocator.getStats();
+        }
+        template< class T = AllocatorType >
+        auto verifyStep( size_t budget ) -> decltype(std::declval<T&>().verifyStep(budget)) {
+            return _allocator.verifyStep(budget);
+        }
+        template< class T = AllocatorType >
+        auto trim() -> decltype(std::declval<T&>().trim()) {
+            return _allocator.trim();
+        }
+        AllocatorType& allocator() {
+            return _allocator;
+        }
         void dump() {
             _allocator.dump();
         }
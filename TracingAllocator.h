@@ -0,0 +1,101 @@
+#pragma once
+
+#include <utility>
+
+#include "tlsf/TLSFTrace.h"
+
+namespace ugi {
+
+    /*
+    ** MemoryAllocator that records every call into a TLSFTraceWriter while
+    ** one is attached. A separate wrapper, so MemoryAllocator itself keeps
+    ** plain forwarding and nothing of the trace.
+    */
+    template <class AllocatorType>
+    class TracingAllocator {
+    private:
+        AllocatorType       _allocator;
+        TLSFTraceWriter*    _trace = nullptr;     // records every call when set
+    public:
+        template< class ...ARGS >
+        bool initialize( ARGS&& ...args ) {
+            return _allocator.initialize( std::forward<ARGS>(args)... );
+        }
+        // the writer must stay open until recording is switched off with nullptr
+        void setTraceWriter( TLSFTraceWriter* trace ) {
+            _trace = trace;
+        }
+        void* alloc( size_t size ) {
+            void* ptr = _allocator.alloc(size);
+            if(_trace && ptr) {
+                _trace->record(TLSFTraceEventType::Alloc, ptr, size);
+            }
+            return ptr;
+        }
+        void* allocAligned( size_t size, size_t align ) {
+            void* ptr = _allocator.allocAligned(size, align);
+            if(_trace && ptr) {
+                _trace->record(TLSFTraceEventType::AllocAligned, ptr, size, align);
+            }
+            return ptr;
+        }
+        void* realloc( void* ptr, size_t size ) {
+            void* newPtr = _allocator.realloc(ptr, size);
+            if(_trace && (newPtr || !size)) {
+                _trace->record(TLSFTraceEventType::Realloc, newPtr, size, (uint64_t)(uintptr_t)ptr);
+            }
+            return newPtr;
+        }
+        bool tryExpand( void* ptr, size_t size ) {
+            bool expanded = _allocator.tryExpand(ptr, size);
+            if(_trace && expanded) {
+                _trace->record(TLSFTraceEventType::Expand, ptr, size);
+            }
+            return expanded;
+        }
+        void free( void* ptr ) {
+            if(_trace) {
+                _trace->record(TLSFTraceEventType::Free, ptr, 0);
+            }
+            _allocator.free(ptr);
+        }
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            size_t allocated = _allocator.allocBatch(size, count, out);
+            for( size_t i = 0; _trace && i < allocated; ++i ) {
+                _trace->record(TLSFTraceEventType::Alloc, out[i], size);
+            }
+            return allocated;
+        }
+        void freeBatch( void** ptrs, size_t count ) {
+            for( size_t i = 0; _trace && i < count; ++i ) {
+                if(ptrs[i]) {
+                    _trace->record(TLSFTraceEventType::Free, ptrs[i], 0);
+                }
+            }
+            _allocator.freeBatch(ptrs, count);
+        }
+        bool contains( void* ptr ) {
+            return _allocator.contains(ptr);
+        }
+        // only instantiated when called, allocators without stats still work
+        template< class T = AllocatorType >
+        auto getStats() -> decltype(std::declval<T&>().getStats()) {
+            return _allocator.getStats();
+        }
+        template< class T = AllocatorType >
+        auto verifyStep( size_t budget ) -> decltype(std::declval<T&>().verifyStep(budget)) {
+            return _allocator.verifyStep(budget);
+        }
+        template< class T = AllocatorType >
+        auto trim() -> decltype(std::declval<T&>().trim()) {
+            return _allocator.trim();
+        }
+        AllocatorType& allocator() {
+            return _allocator;
+        }
+        void dump() {
+            _allocator.dump();
+        }
+    };
+
+}
\ No newline at end of file
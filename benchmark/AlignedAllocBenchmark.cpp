@@ -0,0 +1,119 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Fragmentation under mixed alignments.
+**
+** A fixed pool is filled with random sizes at random alignments ( 16 B .. 4 KB )
+** until the heap refuses, then a random half is freed and the heap is refilled,
+** for several cycles. Utilization is requested bytes / pool capacity at the
+** moment the heap refuses. allocAligned gives the alignment gaps back to the
+** heap, so utilization has to stay flat over the cycles and well above the
+** "pad every request by align" approach printed next to it.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 64ULL * 1024 * 1024;
+    constexpr size_t Cycles = 8;
+
+    struct Allocation {
+        void*       ptr;
+        size_t      size;
+    };
+
+    struct Request {
+        size_t      size;
+        size_t      align;
+    };
+
+    Request randomRequest( std::default_random_engine& randEngine ) {
+        std::uniform_int_distribution<uint32_t> sizeRange(16, 8192);
+        std::uniform_int_distribution<uint32_t> alignShift(4, 12);
+        return Request{ sizeRange(randEngine), (size_t)1 << alignShift(randEngine) };
+    }
+
+    // returns the number of misaligned pointers, prints utilization per cycle
+    template< class AllocFunc, class FreeFunc >
+    size_t runCycles( const char* name, AllocFunc allocFunc, FreeFunc freeFunc ) {
+        std::default_random_engine randEngine(7);
+        std::vector<Allocation> live;
+        size_t liveBytes = 0;
+        size_t misaligned = 0;
+        printf("%-16s", name);
+        for( size_t cycle = 0; cycle < Cycles; ++cycle ) {
+            for(;;) {
+                Request request = randomRequest(randEngine);
+                void* ptr = allocFunc(request.size, request.align);
+                if(!ptr) {
+                    break;
+                }
+                if((uintptr_t)ptr & (request.align - 1)) {
+                    ++misaligned;
+                }
+                live.push_back(Allocation{ ptr, request.size });
+                liveBytes += request.size;
+            }
+            printf(" %6.1f%%", 100.0 * liveBytes / PoolSize);
+            std::shuffle(live.begin(), live.end(), randEngine);
+            size_t keep = live.size() / 2;
+            for( size_t i = keep; i < live.size(); ++i ) {
+                freeFunc(live[i].ptr);
+                liveBytes -= live[i].size;
+            }
+            live.resize(keep);
+        }
+        printf("\n");
+        for( auto& allocation : live ) {
+            freeFunc(allocation.ptr);
+        }
+        return misaligned;
+    }
+
+}
+
+int main() {
+    printf("utilization when the heap refuses, per cycle\n");
+    size_t misaligned = 0;
+    {
+        ugi::TLSF tlsf;
+        tlsf.initialize(ugi::TLSFPool::createPool(PoolSize));
+        misaligned += runCycles("allocAligned",
+            [&]( size_t size, size_t align ) { return tlsf.allocAligned(size, align); },
+            [&]( void* ptr ) { tlsf.free(ptr); });
+    }
+    {
+        // pad by align and remember the original pointer in front of the aligned one
+        ugi::TLSF tlsf;
+        tlsf.initialize(ugi::TLSFPool::createPool(PoolSize));
+        misaligned += runCycles("padded alloc",
+            [&]( size_t size, size_t align ) -> void* {
+                uint8_t* raw = (uint8_t*)tlsf.alloc(size + align + sizeof(void*));
+                if(!raw) {
+                    return nullptr;
+                }
+                uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+                ((void**)aligned)[-1] = raw;
+                return (void*)aligned;
+            },
+            [&]( void* ptr ) { tlsf.free(((void**)ptr)[-1]); });
+    }
+    if(misaligned) {
+        printf("%zu misaligned allocations!\n", misaligned);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** allocBatch / freeBatch against a loop of single calls.
+**
+** A request handler allocates `count` same-sized buffers, then releases them
+** in a random order. The heap carries some background allocations, so the
+** free lists are not empty. Throughput is in million blocks per second,
+** counting both the alloc and the free of every block.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 64ULL * 1024 * 1024;
+    constexpr size_t BlocksPerRun = 1 << 21;
+    constexpr size_t BackgroundCount = 20000;
+
+    template< class RunFunc >
+    double measure( size_t count, RunFunc runFunc ) {
+        ugi::TLSF tlsf;
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        tlsf.initialize(pool);
+        std::default_random_engine randEngine(1);
+        std::vector<void*> background;
+        for( size_t i = 0; i < BackgroundCount; ++i ) {
+            background.push_back(tlsf.alloc(16 + randEngine() % 2048));
+        }
+        for( size_t i = 0; i < BackgroundCount; i += 2 ) {
+            tlsf.free(background[i]);
+        }
+        std::vector<void*> ptrs(count);
+        std::vector<std::vector<size_t>> orders(16, std::vector<size_t>(count));
+        for( auto& order : orders ) {
+            for( size_t i = 0; i < count; ++i ) {
+                order[i] = i;
+            }
+            std::shuffle(order.begin(), order.end(), randEngine);
+        }
+        size_t rounds = BlocksPerRun / count;
+        auto start = std::chrono::steady_clock::now();
+        for( size_t round = 0; round < rounds; ++round ) {
+            runFunc(tlsf, ptrs, orders[round & 15]);
+        }
+        auto end = std::chrono::steady_clock::now();
+        for( size_t i = 1; i < BackgroundCount; i += 2 ) {
+            tlsf.free(background[i]);
+        }
+        ugi::TLSFPool::destroyPool(pool);
+        double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+        return rounds * count / seconds / 1e6;
+    }
+
+}
+
+int main() {
+    const size_t blockSizes[] = { 64, 256, 1024 };
+    const size_t counts[] = { 8, 32, 128 };
+    printf("%8s %8s %14s %14s\n", "size", "count", "single Mblk/s", "batch Mblk/s");
+    for( size_t blockSize : blockSizes ) {
+        for( size_t count : counts ) {
+            double single = measure(count, [blockSize]( ugi::TLSF& tlsf, std::vector<void*>& ptrs, const std::vector<size_t>& order ) {
+                for( size_t i = 0; i < ptrs.size(); ++i ) {
+                    ptrs[i] = tlsf.alloc(blockSize);
+                }
+                for( size_t index : order ) {
+                    tlsf.free(ptrs[index]);
+                }
+            });
+            std::vector<void*> shuffled(count);
+            double batch = measure(count, [blockSize, &shuffled]( ugi::TLSF& tlsf, std::vector<void*>& ptrs, const std::vector<size_t>& order ) {
+                tlsf.allocBatch(blockSize, ptrs.size(), ptrs.data());
+                for( size_t i = 0; i < order.size(); ++i ) {
+                    shuffled[i] = ptrs[order[i]];
+                }
+                tlsf.freeBatch(shuffled.data(), shuffled.size());
+            });
+            printf("%8zu %8zu %14.2f %14.2f\n", blockSize, count, single, batch);
+        }
+    }
+    return 0;
+}
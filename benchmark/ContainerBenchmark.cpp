@@ -0,0 +1,193 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Standard containers on TLSF, C++17 ( std::pmr ), see benchmark/CMakeLists.txt.
+**
+** Allocators :
+**   std::allocator                      the global heap
+**   TLSFStlAllocator                    stateful allocator over a TLSF heap
+**   pmr + TLSFMemoryResource            polymorphic_allocator over a TLSF heap
+**   pmr + new_delete_resource           the same virtual calls over the global heap
+**
+** Workloads :
+**   vectors         `VectorCount` vectors grown by push_back to random lengths, then destroyed
+**   unordered_map   `MapSize` keys, every op erases a random key and inserts a new one
+**   map             the same churn on std::map
+**
+** Time is per element pushed, or per erase + insert pair.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "TLSF.hpp"
+#include "TLSFStlAllocator.h"
+#include "TLSFMemoryResource.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 512ULL * 1024 * 1024;
+    constexpr size_t VectorCount = 4096;
+    constexpr size_t VectorRounds = 16;
+    constexpr size_t MaxVectorLength = 2048;
+    constexpr size_t MapSize = 1 << 16;
+    constexpr size_t MapOperations = 1 << 20;
+
+    struct StdPolicy {
+        template< class T >
+        using Allocator = std::allocator<T>;
+        template< class T >
+        Allocator<T> make() {
+            return Allocator<T>();
+        }
+    };
+
+    struct TLSFPolicy {
+        ugi::TLSF&      tlsf;
+        template< class T >
+        using Allocator = ugi::TLSFStlAllocator<T>;
+        template< class T >
+        Allocator<T> make() {
+            return Allocator<T>(tlsf);
+        }
+    };
+
+    struct PmrPolicy {
+        std::pmr::memory_resource*  resource;
+        template< class T >
+        using Allocator = std::pmr::polymorphic_allocator<T>;
+        template< class T >
+        Allocator<T> make() {
+            return Allocator<T>(resource);
+        }
+    };
+
+    // ns per element pushed
+    template< class Policy >
+    double vectorWorkload( Policy& policy ) {
+        typedef std::vector<uint32_t, typename Policy::template Allocator<uint32_t>> Vector;
+        std::default_random_engine randEngine(41);
+        std::uniform_int_distribution<size_t> lengthRange(1, MaxVectorLength);
+        std::vector<size_t> lengths(VectorCount * VectorRounds);
+        size_t elements = 0;
+        for( auto& length : lengths ) {
+            length = lengthRange(randEngine);
+            elements += length;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for( size_t round = 0; round < VectorRounds; ++round ) {
+            std::vector<Vector> vectors;
+            vectors.reserve(VectorCount);
+            for( size_t i = 0; i < VectorCount; ++i ) {
+                vectors.emplace_back(policy.template make<uint32_t>());
+                Vector& vector = vectors.back();
+                for( size_t j = 0, length = lengths[round * VectorCount + i]; j < length; ++j ) {
+                    vector.push_back((uint32_t)j);
+                }
+            }
+        }
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / elements;
+    }
+
+    // ns per erase + insert
+    template< class Map >
+    double churn( Map& map ) {
+        std::default_random_engine randEngine(43);
+        std::vector<uint64_t> keys(MapSize);
+        for( size_t i = 0; i < MapSize; ++i ) {
+            keys[i] = randEngine();
+            map.emplace(keys[i], i);
+        }
+        std::vector<uint32_t> slots(MapOperations);
+        std::vector<uint64_t> newKeys(MapOperations);
+        for( size_t i = 0; i < MapOperations; ++i ) {
+            slots[i] = (uint32_t)(randEngine() % MapSize);
+            newKeys[i] = randEngine();
+        }
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < MapOperations; ++i ) {
+            uint64_t& key = keys[slots[i]];
+            map.erase(key);
+            key = newKeys[i];
+            map.emplace(key, i);
+        }
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / MapOperations;
+    }
+
+    template< class Policy >
+    double unorderedMapWorkload( Policy& policy ) {
+        typedef typename Policy::template Allocator<std::pair<const uint64_t, uint64_t>> Allocator;
+        std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, Allocator> map(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), policy.template make<std::pair<const uint64_t, uint64_t>>());
+        return churn(map);
+    }
+
+    template< class Policy >
+    double mapWorkload( Policy& policy ) {
+        typedef typename Policy::template Allocator<std::pair<const uint64_t, uint64_t>> Allocator;
+        std::map<uint64_t, uint64_t, std::less<uint64_t>, Allocator> map(std::less<uint64_t>(), policy.template make<std::pair<const uint64_t, uint64_t>>());
+        return churn(map);
+    }
+
+    // a fresh heap for every measurement
+    template< class Func >
+    void printRow( const char* name, Func func ) {
+        printf("%-30s", name);
+        {
+            StdPolicy policy;
+            printf(" %10.1f", func(policy));
+        }
+        {
+            ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+            {
+                ugi::TLSF tlsf;
+                tlsf.initialize(pool);
+                TLSFPolicy policy{ tlsf };
+                printf(" %10.1f", func(policy));
+            }
+            ugi::TLSFPool::destroyPool(pool);
+        }
+        {
+            ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+            {
+                ugi::TLSF tlsf;
+                tlsf.initialize(pool);
+                ugi::TLSFMemoryResource<> resource(tlsf);
+                PmrPolicy policy{ &resource };
+                printf(" %10.1f", func(policy));
+            }
+            ugi::TLSFPool::destroyPool(pool);
+        }
+        {
+            PmrPolicy policy{ std::pmr::new_delete_resource() };
+            printf(" %10.1f", func(policy));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+}
+
+int main() {
+    printf("%-30s %10s %10s %10s %10s\n", "ns / op", "std", "TLSF stl", "TLSF pmr", "new pmr");
+    printRow("vectors ( per push_back )", []( auto& policy ) {
+        return vectorWorkload(policy);
+    });
+    printRow("unordered_map churn", []( auto& policy ) {
+        return unorderedMapWorkload(policy);
+    });
+    printRow("map churn", []( auto& policy ) {
+        return mapWorkload(policy);
+    });
+    return 0;
+}
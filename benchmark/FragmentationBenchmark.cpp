@@ -0,0 +1,94 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Allocation latency vs. heap fragmentation.
+**
+** For every stage the heap is punched with `holes` isolated free blocks
+** ( allocate 2*holes random small blocks, free every other one ), then
+** we time batches of allocations of a fixed request size. Requests that
+** can not be served by the holes have to search the bitmaps for a larger
+** block, so a linear level scan shows up here as latency growing with the
+** distance between the request level and the big remaining block.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 256ULL * 1024 * 1024;
+    constexpr size_t BatchSize = 256;
+    constexpr size_t BatchCount = 400;
+
+    double measureAllocLatency( ugi::TLSF& tlsf, size_t requestSize ) {
+        std::vector<void*> batch(BatchSize);
+        uint64_t totalNanoseconds = 0;
+        size_t totalAllocations = 0;
+        for( size_t round = 0; round < BatchCount; ++round ) {
+            auto start = std::chrono::steady_clock::now();
+            for( size_t i = 0; i < BatchSize; ++i ) {
+                batch[i] = tlsf.alloc(requestSize);
+            }
+            auto end = std::chrono::steady_clock::now();
+            totalNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            for( size_t i = 0; i < BatchSize; ++i ) {
+                if(batch[i]) {
+                    tlsf.free(batch[i]);
+                    ++totalAllocations;
+                }
+            }
+        }
+        return totalAllocations ? (double)totalNanoseconds / totalAllocations : 0.0;
+    }
+
+}
+
+int main() {
+    const size_t holeCounts[] = { 0, 1024, 4096, 16384, 65536 };
+    const size_t requestSizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+
+    printf("%10s", "holes");
+    for( size_t requestSize : requestSizes ) {
+        printf(" %12zuB", requestSize);
+    }
+    printf("   (ns per alloc)\n");
+
+    for( size_t holes : holeCounts ) {
+        ugi::TLSF tlsf;
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        tlsf.initialize(pool);
+
+        std::default_random_engine randEngine(holes);
+        std::uniform_int_distribution<uint32_t> randRange(16, 2048);
+        std::vector<void*> pinned;
+        pinned.reserve(holes * 2);
+        for( size_t i = 0; i < holes * 2; ++i ) {
+            void* ptr = tlsf.alloc(randRange(randEngine));
+            if(!ptr) {
+                break;
+            }
+            pinned.push_back(ptr);
+        }
+        for( size_t i = 0; i < pinned.size(); i += 2 ) {
+            tlsf.free(pinned[i]);
+        }
+
+        printf("%10zu", holes);
+        for( size_t requestSize : requestSizes ) {
+            printf(" %13.1f", measureAllocLatency(tlsf, requestSize));
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Pools and blocks beyond 4 GB.
+**
+** A 6 GB pool is reserved without backing ( only touched pages get memory )
+** and handed to TLSF64. Blocks are allocated so that one of them straddles
+** the 4 GB offset, both ends of every block are written and read back, then
+** everything is freed and the pool has to merge back into one big block.
+** The default 31-bit TLSF has to refuse the same pool instead of truncating it.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 6ULL << 30;
+    constexpr size_t FourGB = 4ULL << 30;
+
+    void* reserveMemory( size_t size ) {
+#if defined(_WIN32)
+        return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+    }
+
+    void releaseMemory( void* ptr, size_t size ) {
+#if defined(_WIN32)
+        (void)size;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, size);
+#endif
+    }
+
+    bool touch( void* ptr, size_t size, uint8_t pattern ) {
+        volatile uint8_t* bytes = (volatile uint8_t*)ptr;
+        bytes[0] = pattern;
+        bytes[size - 1] = pattern;
+        return bytes[0] == pattern && bytes[size - 1] == pattern;
+    }
+
+}
+
+int main() {
+    void* memory = reserveMemory(PoolSize);
+    if(!memory) {
+        printf("could not reserve %zu bytes, skipped\n", PoolSize);
+        return 0;
+    }
+    int failures = 0;
+    {
+        ugi::TLSF tlsf;
+        if(tlsf.initialize(ugi::TLSFPool(memory, PoolSize))) {
+            printf("TLSF accepted a %zu byte pool\n", PoolSize);
+            ++failures;
+        }
+    }
+    {
+        ugi::TLSF64 tlsf;
+        if(!tlsf.initialize(ugi::TLSFPool(memory, PoolSize))) {
+            printf("TLSF64 refused a %zu byte pool\n", PoolSize);
+            releaseMemory(memory, PoolSize);
+            return 1;
+        }
+        const size_t sizes[] = { 3ULL << 30, 2ULL << 30, 256ULL << 20, 4096, 48 };
+        void* blocks[sizeof(sizes) / sizeof(sizes[0])] = {};
+        bool crossed = false;
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i ) {
+            blocks[i] = tlsf.alloc(sizes[i]);
+            if(!blocks[i] || !touch(blocks[i], sizes[i], (uint8_t)(i + 1))) {
+                printf("alloc of %zu bytes failed\n", sizes[i]);
+                ++failures;
+                continue;
+            }
+            size_t begin = (uint8_t*)blocks[i] - (uint8_t*)memory;
+            size_t end = begin + sizes[i];
+            crossed |= begin < FourGB && end > FourGB;
+            printf("%12zu bytes at offset %12zu .. %12zu, block size %zu\n", sizes[i], begin, end, tlsf.queryAllocationSize(blocks[i]));
+        }
+        if(!crossed) {
+            printf("no block crossed the 4 GB offset\n");
+            ++failures;
+        }
+        for( void* block : blocks ) {
+            if(block) {
+                tlsf.free(block);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        void* whole = tlsf.alloc(PoolSize - PoolSize / 8);     // only fits if every block merged back
+        if(!whole) {
+            printf("pool did not merge back into one block\n");
+            ++failures;
+        }
+        else {
+            tlsf.free(whole);
+        }
+        printf("%lld us\n", (long long)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        tlsf.dump();
+    }
+    releaseMemory(memory, PoolSize);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Plain malloc / free workloads for A/B runs of the drop-in allocator :
+**
+**   tlsf_bench_malloc
+**   LD_PRELOAD=libtlsfmalloc.so tlsf_bench_malloc
+**
+** churn     `LiveBlocks` random blocks, every op frees one and mallocs a new
+**           one, every 64th op is timed on its own for the percentiles
+** spike     `SpikeBytes` of small blocks allocated and freed again, resident
+**           set before, at the peak and after
+** threads   the churn on `ThreadCount` threads at once
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+namespace {
+
+    constexpr size_t LiveBlocks = 1 << 14;
+    constexpr size_t ChurnOperations = 1 << 22;
+    constexpr size_t SampleInterval = 64;
+    constexpr size_t SpikeBytes = 512ULL * 1024 * 1024;
+    constexpr size_t ThreadCount = 4;
+    constexpr size_t ThreadOperations = 1 << 20;
+
+    size_t residentBytes() {
+        FILE* file = fopen("/proc/self/statm", "r");
+        unsigned long long pages = 0;
+        unsigned long long resident = 0;
+        if(file) {
+            if(fscanf(file, "%llu %llu", &pages, &resident) != 2) {
+                resident = 0;
+            }
+            fclose(file);
+        }
+        return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    // sizes between 16 bytes and 4 KB, small ones more likely
+    size_t randomSize( std::default_random_engine& randEngine ) {
+        std::uniform_int_distribution<uint32_t> shiftRange(4, 12);
+        uint32_t shift = shiftRange(randEngine);
+        return ((size_t)1 << shift) + randEngine() % ((size_t)1 << shift);
+    }
+
+    double elapsedNanoseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // ns per op, the per-op samples go to `samples` when it is not null
+    double churn( size_t operations, uint32_t seed, std::vector<double>* samples ) {
+        std::default_random_engine randEngine(seed);
+        std::vector<void*> live(LiveBlocks);
+        for( auto& ptr : live ) {
+            ptr = malloc(randomSize(randEngine));
+        }
+        std::vector<uint32_t> slots(operations);
+        std::vector<uint32_t> sizes(operations);
+        for( size_t i = 0; i < operations; ++i ) {
+            slots[i] = (uint32_t)(randEngine() % LiveBlocks);
+            sizes[i] = (uint32_t)randomSize(randEngine);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < operations; ++i ) {
+            void*& ptr = live[slots[i]];
+            if(samples && i % SampleInterval == 0) {
+                auto opStart = std::chrono::steady_clock::now();
+                free(ptr);
+                ptr = malloc(sizes[i]);
+                samples->push_back(elapsedNanoseconds(opStart));
+            } else {
+                free(ptr);
+                ptr = malloc(sizes[i]);
+            }
+        }
+        double nanoseconds = elapsedNanoseconds(start);
+        for( void* ptr : live ) {
+            free(ptr);
+        }
+        return nanoseconds / operations;
+    }
+
+}
+
+int main() {
+    Dl_info info = {};
+    dladdr((void*)&malloc, &info);
+    printf("malloc from %s\n\n", info.dli_fname ? info.dli_fname : "?");
+
+    std::vector<double> samples;
+    samples.reserve(ChurnOperations / SampleInterval + 1);
+    double average = churn(ChurnOperations, 47, &samples);
+    std::sort(samples.begin(), samples.end());
+    printf("churn     %8.1f ns / free + malloc, sampled p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f ns\n", average,
+        samples[samples.size() / 2], samples[samples.size() * 99 / 100], samples[samples.size() * 999 / 1000], samples.back());
+
+    size_t before = residentBytes();
+    {
+        std::default_random_engine randEngine(53);
+        std::vector<void*> blocks;
+        size_t total = 0;
+        while(total < SpikeBytes) {
+            size_t size = randomSize(randEngine);
+            char* ptr = (char*)malloc(size);
+            ptr[0] = ptr[size - 1] = 1;
+            blocks.push_back(ptr);
+            total += size;
+        }
+        size_t peak = residentBytes();
+        for( void* ptr : blocks ) {
+            free(ptr);
+        }
+        blocks = std::vector<void*>();
+        size_t after = residentBytes();
+        printf("spike     RSS %7.1f MB before, %7.1f MB at the peak, %7.1f MB after\n",
+            before / 1048576.0, peak / 1048576.0, after / 1048576.0);
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<double> threadAverages(ThreadCount);
+    for( size_t i = 0; i < ThreadCount; ++i ) {
+        threads.emplace_back([&, i]() {
+            threadAverages[i] = churn(ThreadOperations, 59 + (uint32_t)i, nullptr);
+        });
+    }
+    for( auto& thread : threads ) {
+        thread.join();
+    }
+    double sum = 0.0;
+    for( double threadAverage : threadAverages ) {
+        sum += threadAverage;
+    }
+    printf("threads   %8.1f ns / free + malloc, average of %zu threads ( %u hardware threads )\n",
+        sum / ThreadCount, ThreadCount, std::thread::hardware_concurrency());
+    return 0;
+}
@@ -0,0 +1,264 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Restarting a cache on a file-backed heap, tlsf_bench_persistent [heap file]
+**
+** The cache is a chained hash table of `EntryCount` entries with 16 - 256
+** byte values, every pointer in it a TLSFRelativePtr :
+**   build       open a new heap file and fill the cache, what a restart costs without it
+**   close       msync everything and mark the file clean
+**   reopen      open the closed file again, header checks and TLSFBasic::reattach
+**   crash       a child process opens the file, frees and allocates, and exits without
+**               close(), the next open() verifies the whole heap
+**   lookup      every key once after the reopen, page faults from the page cache included
+** Then free + alloc churn on a plain TLSF and on TLSFRelative, the price of
+** relative links. The heap file is removed at the end.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TLSF.hpp"
+#include "TLSFPersistentHeap.h"
+
+namespace {
+
+    constexpr size_t HeapCapacity = 1ULL << 30;
+    constexpr size_t EntryCount = 1 << 20;
+    constexpr size_t BucketCount = 1 << 20;
+    constexpr size_t CrashOperations = 1 << 16;
+    constexpr size_t ChurnBlocks = 1 << 14;
+    constexpr size_t ChurnOperations = 1 << 22;
+    constexpr size_t ChurnPoolSize = 256ULL * 1024 * 1024;
+
+    typedef ugi::TLSFPersistentHeap<> PersistentHeap;
+
+    struct Entry {
+        ugi::TLSFRelativePtr<Entry>     next;
+        uint64_t                        key;
+        uint32_t                        valueSize;
+        uint8_t                         value[1];
+    };
+
+    struct Cache {
+        ugi::TLSFRelativePtr<ugi::TLSFRelativePtr<Entry>>   buckets;
+        uint64_t                                            count;
+    };
+
+    inline uint64_t keyOf( size_t index ) {
+        return (uint64_t)index * 0x9E3779B97F4A7C15ULL;
+    }
+
+    inline size_t bucketOf( uint64_t key ) {
+        return (size_t)(key >> 44) & (BucketCount - 1);
+    }
+
+    double elapsedMilliseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    }
+
+    bool insert( ugi::TLSFRelative& heap, Cache* cache, uint64_t key, uint32_t valueSize ) {
+        Entry* entry = (Entry*)heap.alloc(sizeof(Entry) + valueSize);
+        if(!entry) {
+            return false;
+        }
+        new (&entry->next) ugi::TLSFRelativePtr<Entry>();
+        entry->key = key;
+        entry->valueSize = valueSize;
+        memset(entry->value, (int)(key & 0xff), valueSize);
+        ugi::TLSFRelativePtr<Entry>& bucket = cache->buckets.get()[bucketOf(key)];
+        entry->next = bucket;
+        bucket = entry;
+        ++cache->count;
+        return true;
+    }
+
+    Entry* find( Cache* cache, uint64_t key ) {
+        for( Entry* entry = cache->buckets.get()[bucketOf(key)]; entry; entry = entry->next ) {
+            if(entry->key == key) {
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    bool erase( ugi::TLSFRelative& heap, Cache* cache, uint64_t key ) {
+        ugi::TLSFRelativePtr<Entry>* link = &cache->buckets.get()[bucketOf(key)];
+        for( Entry* entry = *link; entry; link = &entry->next, entry = *link ) {
+            if(entry->key == key) {
+                *link = entry->next;
+                heap.free(entry);
+                --cache->count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Cache* build( PersistentHeap& file ) {
+        ugi::TLSFRelative& heap = file.heap();
+        Cache* cache = (Cache*)heap.alloc(sizeof(Cache));
+        ugi::TLSFRelativePtr<Entry>* buckets = (ugi::TLSFRelativePtr<Entry>*)heap.alloc(sizeof(ugi::TLSFRelativePtr<Entry>) * BucketCount);
+        if(!cache || !buckets) {
+            return nullptr;
+        }
+        for( size_t i = 0; i < BucketCount; ++i ) {
+            new (&buckets[i]) ugi::TLSFRelativePtr<Entry>();
+        }
+        new (&cache->buckets) ugi::TLSFRelativePtr<ugi::TLSFRelativePtr<Entry>>(buckets);
+        cache->count = 0;
+        std::default_random_engine randEngine(71);
+        std::uniform_int_distribution<uint32_t> valueRange(16, 256);
+        for( size_t i = 0; i < EntryCount; ++i ) {
+            if(!insert(heap, cache, keyOf(i), valueRange(randEngine))) {
+                return nullptr;
+            }
+        }
+        file.setRoot(cache);
+        return cache;
+    }
+
+    // every key once, returns the entries found with intact values
+    size_t lookupAll( Cache* cache ) {
+        size_t found = 0;
+        for( size_t i = 0; i < EntryCount; ++i ) {
+            Entry* entry = find(cache, keyOf(i));
+            if(entry && entry->value[entry->valueSize - 1] == (uint8_t)(entry->key & 0xff)) {
+                ++found;
+            }
+        }
+        return found;
+    }
+
+    // replaces entries and exits without close(), like a crash would
+    void crashingChild( const char* path ) {
+        PersistentHeap file;
+        if(file.open(path, HeapCapacity) != ugi::TLSFPersistentState::Reattached) {
+            _exit(1);
+        }
+        Cache* cache = (Cache*)file.root();
+        std::default_random_engine randEngine(73);
+        std::uniform_int_distribution<uint32_t> valueRange(16, 256);
+        for( size_t i = 0; i < CrashOperations; ++i ) {
+            uint64_t key = keyOf(randEngine() % EntryCount);
+            if(erase(file.heap(), cache, key)) {
+                insert(file.heap(), cache, key, valueRange(randEngine));
+            }
+        }
+        file.sync();
+        _exit(0);
+    }
+
+    template< class HeapType >
+    double churn() {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(ChurnPoolSize);
+        double nanoseconds = 0.0;
+        {
+            HeapType tlsf;
+            tlsf.initialize(pool);
+            std::default_random_engine randEngine(79);
+            std::uniform_int_distribution<size_t> sizeRange(16, 1024);
+            std::vector<void*> live(ChurnBlocks);
+            for( auto& ptr : live ) {
+                ptr = tlsf.alloc(sizeRange(randEngine));
+            }
+            std::vector<uint32_t> slots(ChurnOperations);
+            std::vector<uint32_t> sizes(ChurnOperations);
+            for( size_t i = 0; i < ChurnOperations; ++i ) {
+                slots[i] = (uint32_t)(randEngine() % ChurnBlocks);
+                sizes[i] = (uint32_t)sizeRange(randEngine);
+            }
+            auto start = std::chrono::steady_clock::now();
+            for( size_t i = 0; i < ChurnOperations; ++i ) {
+                void*& ptr = live[slots[i]];
+                tlsf.free(ptr);
+                ptr = tlsf.alloc(sizes[i]);
+            }
+            nanoseconds = elapsedMilliseconds(start) * 1e6 / ChurnOperations;
+            for( void* ptr : live ) {
+                tlsf.free(ptr);
+            }
+        }
+        ugi::TLSFPool::destroyPool(pool);
+        return nanoseconds;
+    }
+
+    const char* stateName( ugi::TLSFPersistentState state ) {
+        switch(state) {
+            case ugi::TLSFPersistentState::Closed: return "closed";
+            case ugi::TLSFPersistentState::Failed: return "failed";
+            case ugi::TLSFPersistentState::Created: return "created";
+            case ugi::TLSFPersistentState::Reattached: return "reattached";
+            case ugi::TLSFPersistentState::Recovered: return "recovered";
+        }
+        return "?";
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    const char* path = argc > 1 ? argv[1] : "tlsf_bench_persistent.heap";
+    unlink(path);
+    printf("%zu entries in a %zu MB heap file %s\n\n", EntryCount, HeapCapacity >> 20, path);
+
+    PersistentHeap file;
+    auto start = std::chrono::steady_clock::now();
+    ugi::TLSFPersistentState state = file.open(path, HeapCapacity);
+    Cache* cache = state == ugi::TLSFPersistentState::Created ? build(file) : nullptr;
+    if(!cache) {
+        printf("build failed : %s\n", file.error() ? file.error() : "out of memory");
+        return 1;
+    }
+    printf("build     %10.1f ms  %s, %llu entries\n", elapsedMilliseconds(start), stateName(state), (unsigned long long)cache->count);
+
+    start = std::chrono::steady_clock::now();
+    file.close();
+    printf("close     %10.1f ms\n", elapsedMilliseconds(start));
+
+    start = std::chrono::steady_clock::now();
+    state = file.open(path, HeapCapacity);
+    printf("reopen    %10.3f ms  %s\n", elapsedMilliseconds(start), stateName(state));
+    cache = (Cache*)file.root();
+    if(!cache) {
+        printf("reopen failed : %s\n", file.error());
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    size_t found = lookupAll(cache);
+    printf("lookup    %10.1f ms  %zu / %zu entries found\n", elapsedMilliseconds(start), found, EntryCount);
+    file.close();
+
+    pid_t child = fork();
+    if(child == 0) {
+        crashingChild(path);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    start = std::chrono::steady_clock::now();
+    state = file.open(path, HeapCapacity);
+    double recoverMilliseconds = elapsedMilliseconds(start);
+    cache = (Cache*)file.root();
+    found = cache ? lookupAll(cache) : 0;
+    printf("crash     %10.1f ms  %s after the child exited with %d, %zu / %zu entries found\n", recoverMilliseconds,
+        stateName(state), WIFEXITED(status) ? WEXITSTATUS(status) : -1, found, EntryCount);
+    file.close();
+    unlink(path);
+
+    printf("\nfree + alloc churn, ns / op\n");
+    printf("TLSF          %8.1f\n", churn<ugi::TLSF>());
+    printf("TLSFRelative  %8.1f\n", churn<ugi::TLSFRelative>());
+    return 0;
+}
@@ -0,0 +1,232 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Pool backends on a large working set, tlsf_bench_pool_backends [pool MB]
+**
+** For every TLSFPoolFlags combination one pool is created and filled with
+** `BlockSize` TLSF blocks, every page of them written once :
+**   create        createPool, includes prefaulting for TLSFPoolPopulate / Locked
+**   first touch   the fill, ns per 4 KB page, this is where page faults land otherwise
+**   random read   dependent 8 byte reads at random offsets of the pool, ns per read
+**   dTLB misses   per random read, from perf_event_open when the kernel allows it
+**   huge          AnonHugePages gained by the pool
+** The flags that were actually granted are printed, missing ones fell back.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <vector>
+
+#include "TLSF.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    constexpr size_t DefaultPoolMegabytes = 1024;
+    constexpr size_t BlockSize = 64 * 1024;
+    constexpr size_t TouchStride = 4096;
+    constexpr size_t RandomReads = 1 << 22;
+
+    volatile uint64_t readSink;
+
+    double elapsedNanoseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // AnonHugePages of the whole process in bytes, 0 when unknown
+    size_t anonHugePages() {
+        size_t kilobytes = 0;
+#if defined(__linux__)
+        FILE* file = fopen("/proc/self/smaps_rollup", "r");
+        if(!file) {
+            return 0;
+        }
+        char line[256];
+        while(fgets(line, sizeof(line), file)) {
+            unsigned long long value = 0;
+            if(sscanf(line, "AnonHugePages: %llu kB", &value) == 1) {
+                kilobytes = (size_t)value;
+            }
+        }
+        fclose(file);
+#endif
+        return kilobytes * 1024;
+    }
+
+    // data TLB read misses of this thread, `valid` is false when the counter is not available
+    class TLBMissCounter {
+    private:
+        int     _fd;
+    public:
+        TLBMissCounter()
+            : _fd(-1)
+        {
+#if defined(__linux__)
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+        ~TLBMissCounter() {
+#if defined(__linux__)
+            if(_fd >= 0) {
+                close(_fd);
+            }
+#endif
+        }
+        bool valid() const {
+            return _fd >= 0;
+        }
+        void start() {
+#if defined(__linux__)
+            if(_fd >= 0) {
+                ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+        uint64_t stop() {
+            uint64_t count = 0;
+#if defined(__linux__)
+            if(_fd >= 0) {
+                ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+                if(read(_fd, &count, sizeof(count)) != sizeof(count)) {
+                    count = 0;
+                }
+            }
+#endif
+            return count;
+        }
+    };
+
+    void flagNames( uint32_t flags, char* out, size_t size ) {
+        static const struct {
+            uint32_t        flag;
+            const char*     name;
+        } names[] = {
+            { ugi::TLSFPoolMapped, "mmap" },
+            { ugi::TLSFPoolHugePages, "thp" },
+            { ugi::TLSFPoolHugetlb, "hugetlb" },
+            { ugi::TLSFPoolPopulate, "populate" },
+            { ugi::TLSFPoolLocked, "lock" },
+        };
+        snprintf(out, size, "%s", flags ? "" : "new[]");
+        for( const auto& name : names ) {
+            if(flags & name.flag) {
+                size_t length = strlen(out);
+                snprintf(out + length, size - length, "%s%s", length ? "+" : "", name.name);
+            }
+        }
+    }
+
+    void runBackend( uint32_t flags, size_t capacity, TLBMissCounter& counter ) {
+        char requested[64];
+        char granted[64];
+        flagNames(flags, requested, sizeof(requested));
+        size_t hugeBefore = anonHugePages();
+
+        auto start = std::chrono::steady_clock::now();
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(capacity, flags);
+        double createMilliseconds = elapsedNanoseconds(start) / 1e6;
+        if(!pool.ptr()) {
+            printf("%-26s createPool failed\n", requested);
+            return;
+        }
+        flagNames(pool.flags(), granted, sizeof(granted));
+        {
+            ugi::TLSF64 tlsf; // pools of 2 GB and more
+            tlsf.initialize(pool);
+            std::vector<uint8_t*> blocks;
+            blocks.reserve(capacity / BlockSize);
+            size_t pages = 0;
+            start = std::chrono::steady_clock::now();
+            for(;;) {
+                uint8_t* block = (uint8_t*)tlsf.alloc(BlockSize);
+                if(!block) {
+                    break;
+                }
+                for( size_t offset = 0; offset < BlockSize; offset += TouchStride ) {
+                    block[offset] = 1;
+                }
+                pages += BlockSize / TouchStride;
+                blocks.push_back(block);
+            }
+            double touchNanoseconds = elapsedNanoseconds(start) / pages;
+            size_t hugeGained = anonHugePages() - hugeBefore;
+
+            // every read depends on the one before, so the TLB miss is not hidden by parallel loads
+            const uint64_t* words = (const uint64_t*)pool.ptr();
+            size_t wordCount = pool.capacity() / sizeof(uint64_t);
+            uint64_t x = 88172645463325252ULL;
+            counter.start();
+            start = std::chrono::steady_clock::now();
+            for( size_t i = 0; i < RandomReads; ++i ) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                x += words[x % wordCount] & 1;
+            }
+            double readNanoseconds = elapsedNanoseconds(start) / RandomReads;
+            uint64_t misses = counter.stop();
+            readSink = x;
+
+            char missText[32];
+            if(counter.valid()) {
+                snprintf(missText, sizeof(missText), "%.3f", (double)misses / RandomReads);
+            } else {
+                snprintf(missText, sizeof(missText), "n/a");
+            }
+            printf("%-26s %-26s %10.1f %12.1f %12.1f %10s %8.0f MB\n", requested, granted, createMilliseconds,
+                touchNanoseconds, readNanoseconds, missText, hugeGained / 1048576.0);
+            for( uint8_t* block : blocks ) {
+                tlsf.free(block);
+            }
+        }
+        ugi::TLSFPool::destroyPool(pool);
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    size_t megabytes = argc > 1 ? (size_t)strtoull(argv[1], nullptr, 10) : DefaultPoolMegabytes;
+    size_t capacity = megabytes * 1024 * 1024;
+    TLBMissCounter counter;
+    printf("%zu MB pool, %zu KB blocks\n\n", megabytes, BlockSize / 1024);
+    printf("%-26s %-26s %10s %12s %12s %10s %11s\n", "requested", "granted", "create ms", "touch ns/pg", "read ns", "dTLB/read", "huge");
+    const uint32_t backends[] = {
+        ugi::TLSFPoolHeapMemory,
+        ugi::TLSFPoolMapped,
+        ugi::TLSFPoolMapped | ugi::TLSFPoolPopulate,
+        ugi::TLSFPoolHugePages,
+        ugi::TLSFPoolHugePages | ugi::TLSFPoolPopulate,
+        ugi::TLSFPoolHugetlb,
+        ugi::TLSFPoolHugetlb | ugi::TLSFPoolPopulate,
+        ugi::TLSFPoolMapped | ugi::TLSFPoolPopulate | ugi::TLSFPoolLocked,
+    };
+    for( uint32_t flags : backends ) {
+        runBackend(flags, capacity, counter);
+        fflush(stdout);
+    }
+    return 0;
+}
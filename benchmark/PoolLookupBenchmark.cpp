@@ -0,0 +1,68 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** free() cost vs. number of attached pools.
+**
+** The heap is built from `poolCount` equally sized pools and filled with
+** fixed size blocks, then every block is freed in a pre-shuffled order.
+** free() has to find the owning pool before it can merge neighbours, so
+** this is where the pool lookup shows up.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t TotalSize = 64ULL * 1024 * 1024;
+    constexpr size_t BlockSize = 240;
+    constexpr size_t Rounds = 8;
+
+    double measureFreeLatency( size_t poolCount ) {
+        ugi::TLSF tlsf;
+        for( size_t i = 0; i < poolCount; ++i ) {
+            tlsf.initialize(ugi::TLSFPool::createPool(TotalSize / poolCount));
+        }
+        std::default_random_engine randEngine((unsigned)poolCount);
+        std::vector<void*> pointers;
+        uint64_t totalNanoseconds = 0;
+        size_t totalFrees = 0;
+        for( size_t round = 0; round < Rounds; ++round ) {
+            pointers.clear();
+            while( void* ptr = tlsf.alloc(BlockSize) ) {
+                pointers.push_back(ptr);
+            }
+            std::shuffle(pointers.begin(), pointers.end(), randEngine);
+            auto start = std::chrono::steady_clock::now();
+            for( void* ptr : pointers ) {
+                tlsf.free(ptr);
+            }
+            auto end = std::chrono::steady_clock::now();
+            totalNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            totalFrees += pointers.size();
+        }
+        return totalFrees ? (double)totalNanoseconds / totalFrees : 0.0;
+    }
+
+}
+
+int main() {
+    const size_t poolCounts[] = { 1, 64, 1024 };
+    printf("%10s %14s\n", "pools", "ns per free");
+    for( size_t poolCount : poolCounts ) {
+        printf("%10zu %14.1f\n", poolCount, measureFreeLatency(poolCount));
+    }
+    return 0;
+}
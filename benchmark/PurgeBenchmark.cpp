@@ -0,0 +1,136 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Returning free memory to the system, TLSFBasic::setPurgePolicy and trim().
+**
+** Every row is a fresh heap on mmap'd pools :
+**   spike    `SpikeBytes` of small blocks, all freed again except one in
+**            `Survivors`, which keeps the pools from being retired
+**   steady   small block churn with a `HotBlockSize` block allocated, written
+**            and freed every `HotInterval` ops, the block a too eager purge
+**            hands back and faults in again and again
+** RSS is the whole process after each phase, ns / op is the steady phase.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t SpikeBytes = 512ULL * 1024 * 1024;
+    constexpr size_t Survivors = 256;
+    constexpr size_t SteadyBlocks = 4096;
+    constexpr size_t SteadyOperations = 1 << 20;
+    constexpr size_t HotBlockSize = 1024 * 1024;
+    constexpr size_t HotInterval = 64;
+    constexpr size_t PurgeThreshold = 64 * 1024;
+
+    size_t residentBytes() {
+        FILE* file = fopen("/proc/self/statm", "r");
+        unsigned long long pages = 0;
+        unsigned long long resident = 0;
+        if(file) {
+            if(fscanf(file, "%llu %llu", &pages, &resident) != 2) {
+                resident = 0;
+            }
+            fclose(file);
+        }
+        return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    double megabytes( size_t bytes, size_t baseline = 0 ) {
+        return ((double)bytes - (double)baseline) / 1048576.0;
+    }
+
+    void runPolicy( const char* name, size_t threshold, uint64_t decay, bool trimAfterSpike ) {
+        size_t baseline = residentBytes();
+        ugi::TLSFGeometricPoolProvider provider(64 * 1024 * 1024, 2, 1ULL << 30, ugi::TLSFPoolMapped);
+        {
+            ugi::TLSF tlsf;
+            tlsf.setPoolProvider(&provider, 1);
+            tlsf.setPurgePolicy(threshold, decay);
+            std::default_random_engine randEngine(61);
+            std::uniform_int_distribution<size_t> sizeRange(16, 4096);
+
+            std::vector<void*> blocks;
+            std::vector<void*> survivors;
+            for( size_t total = 0, i = 1; total < SpikeBytes; ++i ) {
+                size_t size = sizeRange(randEngine);
+                void* ptr = tlsf.alloc(size);
+                memset(ptr, 1, size);
+                (i % Survivors ? blocks : survivors).push_back(ptr);
+                total += size;
+            }
+            size_t peak = residentBytes();
+            std::shuffle(blocks.begin(), blocks.end(), randEngine);
+            for( void* ptr : blocks ) {
+                tlsf.free(ptr);
+            }
+            double trimMicroseconds = 0.0;
+            if(trimAfterSpike) {
+                auto start = std::chrono::steady_clock::now();
+                tlsf.trim();
+                trimMicroseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+            }
+            size_t afterSpike = residentBytes();
+
+            std::vector<void*> live(SteadyBlocks);
+            for( auto& ptr : live ) {
+                ptr = tlsf.alloc(sizeRange(randEngine));
+            }
+            auto start = std::chrono::steady_clock::now();
+            for( size_t i = 0; i < SteadyOperations; ++i ) {
+                void*& ptr = live[randEngine() % SteadyBlocks];
+                tlsf.free(ptr);
+                ptr = tlsf.alloc(sizeRange(randEngine));
+                if(i % HotInterval == 0) {
+                    void* hot = tlsf.alloc(HotBlockSize);
+                    memset(hot, 2, HotBlockSize);
+                    tlsf.free(hot);
+                }
+            }
+            double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / SteadyOperations;
+            size_t afterSteady = residentBytes();
+            ugi::TLSF::Stats stats = tlsf.getStats();
+
+            printf("%-22s %9.1f %11.1f %11.1f %10.1f %11.1f %11.1f %10llu\n", name, megabytes(peak, baseline), megabytes(afterSpike, baseline),
+                trimMicroseconds / 1000.0, megabytes(afterSteady, baseline), nanoseconds, megabytes(stats.purgedBytes), (unsigned long long)stats.purgeCalls);
+            fflush(stdout);
+
+            for( void* ptr : live ) {
+                tlsf.free(ptr);
+            }
+            for( void* ptr : survivors ) {
+                tlsf.free(ptr);
+            }
+        }
+    }
+
+}
+
+int main() {
+    printf("RSS in MB above the start of the row, threshold %zu KB\n\n", PurgeThreshold / 1024);
+    printf("%-22s %9s %11s %11s %10s %11s %11s %10s\n", "policy", "peak", "after spike", "trim ms", "steady", "ns / op", "purged MB", "madvise");
+    runPolicy("no purge", 0, 0, false);
+    runPolicy("no purge + trim()", 0, 0, true);
+    runPolicy("decay 0", PurgeThreshold, 0, false);
+    runPolicy("decay 64", PurgeThreshold, 64, false);
+    runPolicy("decay 1024", PurgeThreshold, 1024, false);
+    runPolicy("decay 65536", PurgeThreshold, 65536, false);
+    return 0;
+}
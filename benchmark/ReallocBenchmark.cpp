@@ -0,0 +1,144 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Growing buffers.
+**
+** `BufferCount` buffers grow by 1.5x, one step at a time in random order,
+** from 64 B to 4 MB. Between steps a few small blocks are allocated and some
+** freed, so the neighbours of a buffer are sometimes free and sometimes not.
+** realloc is compared to alloc + memcpy + free and to tryExpand with an
+** alloc + memcpy + free fallback, counting how many steps moved the data.
+** The second table is the large copy routine against plain memcpy.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 512ULL * 1024 * 1024;
+    constexpr size_t BufferCount = 32;
+    constexpr size_t MinBufferSize = 64;
+    constexpr size_t MaxBufferSize = 4 * 1024 * 1024;
+
+    struct Buffer {
+        void*       ptr;
+        size_t      size;
+    };
+
+    enum class GrowMode {
+        Realloc,
+        AllocCopy,
+        TryExpand,
+    };
+
+    void growBuffers( const char* name, GrowMode mode ) {
+        ugi::TLSF tlsf;
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        tlsf.initialize(pool);
+        std::default_random_engine randEngine(3);
+        std::vector<Buffer> buffers;
+        std::vector<void*> smallBlocks;
+        for( size_t i = 0; i < BufferCount; ++i ) {
+            buffers.push_back(Buffer{ tlsf.alloc(MinBufferSize), MinBufferSize });
+            memset(buffers.back().ptr, (int)i, MinBufferSize);
+        }
+        size_t steps = 0;
+        size_t moves = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(;;) {
+            std::vector<size_t> growing;
+            for( size_t i = 0; i < BufferCount; ++i ) {
+                if(buffers[i].size < MaxBufferSize) {
+                    growing.push_back(i);
+                }
+            }
+            if(growing.empty()) {
+                break;
+            }
+            Buffer& buffer = buffers[growing[randEngine() % growing.size()]];
+            size_t newSize = buffer.size + buffer.size / 2;
+            void* newPtr = nullptr;
+            switch(mode) {
+            case GrowMode::Realloc:
+                newPtr = tlsf.realloc(buffer.ptr, newSize);
+                break;
+            case GrowMode::TryExpand:
+                if(tlsf.tryExpand(buffer.ptr, newSize)) {
+                    newPtr = buffer.ptr;
+                    break;
+                }
+                // fall through
+            case GrowMode::AllocCopy:
+                newPtr = tlsf.alloc(newSize);
+                memcpy(newPtr, buffer.ptr, buffer.size);
+                tlsf.free(buffer.ptr);
+                break;
+            }
+            moves += newPtr != buffer.ptr ? 1 : 0;
+            ++steps;
+            buffer.ptr = newPtr;
+            buffer.size = newSize;
+            for( int i = 0; i < 4; ++i ) {
+                smallBlocks.push_back(tlsf.alloc(16 + randEngine() % 512));
+            }
+            for( int i = 0; i < 3 && !smallBlocks.empty(); ++i ) {
+                size_t index = randEngine() % smallBlocks.size();
+                tlsf.free(smallBlocks[index]);
+                smallBlocks[index] = smallBlocks.back();
+                smallBlocks.pop_back();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        printf("%-12s %8zu %8zu %10.1f\n", name, steps, moves, (double)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0);
+        for( auto& buffer : buffers ) {
+            tlsf.free(buffer.ptr);
+        }
+        for( void* ptr : smallBlocks ) {
+            tlsf.free(ptr);
+        }
+        ugi::TLSFPool::destroyPool(pool);
+    }
+
+    template< class CopyFunc >
+    double measureCopy( size_t size, CopyFunc copyFunc ) {
+        std::vector<uint8_t> source(size, 1);
+        std::vector<uint8_t> target(size + 64);
+        size_t rounds = (256ULL * 1024 * 1024) / size;
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < rounds; ++i ) {
+            copyFunc(target.data() + (i & 7) * 8, source.data(), size);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+        return (double)size * rounds / seconds / (1024.0 * 1024.0 * 1024.0);
+    }
+
+}
+
+int main() {
+    printf("%-12s %8s %8s %10s\n", "grow by", "steps", "moves", "ms");
+    growBuffers("realloc", GrowMode::Realloc);
+    growBuffers("tryExpand", GrowMode::TryExpand);
+    growBuffers("alloc+copy", GrowMode::AllocCopy);
+    printf("\n%12s %14s %14s\n", "copy size", "memcpy GB/s", "tlsf GB/s");
+    const size_t sizes[] = { 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+    for( size_t size : sizes ) {
+        double plain = measureCopy(size, []( void* dst, const void* src, size_t n ) { memcpy(dst, src, n); });
+        double tlsf = measureCopy(size, []( void* dst, const void* src, size_t n ) { ugi::tlsf_copy_memory(dst, src, n); });
+        printf("%12zu %14.2f %14.2f\n", size, plain, tlsf);
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Per-request scratch memory, tlsf_bench_region
+**
+** Every request allocates `ObjectsPerRequest` objects of 16 - 256 B and a
+** `LargeSize` buffer now and then. Every `StepObjects` objects a nested step
+** allocates `StepTemporaries` temporaries and drops them at its end :
+**   alloc / free     every object through TLSF::alloc / TLSF::free
+**   region scopes    TLSFRegion, a TLSFRegionScope for the request and one per step
+**   heap reset()     TLSF::alloc into a heap of its own, TLSF::reset() at the end
+**                    of the request, the steps still free their temporaries
+** Then TLSF::reset() against freeing `ResetBlocks` blocks one by one in a heap
+** of `ResetPools` pools. Every row ends with a heap verification.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+#include "TLSFRegion.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 64 * 1024 * 1024;
+    constexpr size_t RequestCount = 1 << 14;
+    constexpr size_t ObjectsPerRequest = 512;
+    constexpr size_t StepObjects = 64;
+    constexpr size_t StepTemporaries = 32;
+    constexpr size_t LargeInterval = 128;
+    constexpr size_t LargeSize = 32 * 1024;
+    constexpr size_t ResetPools = 8;
+    constexpr size_t ResetBlocks = 1 << 20;
+
+    struct Workload {
+        std::vector<uint16_t>   sizes;          // one per object, the large ones marked by LargeInterval
+        std::vector<uint16_t>   temporaries;
+    };
+
+    double elapsedNanoseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    Workload makeWorkload() {
+        std::default_random_engine randEngine(89);
+        std::uniform_int_distribution<uint16_t> sizeRange(16, 256);
+        Workload workload;
+        workload.sizes.resize(ObjectsPerRequest * RequestCount);
+        workload.temporaries.resize(ObjectsPerRequest / StepObjects * StepTemporaries * RequestCount);
+        for( auto& size : workload.sizes ) {
+            size = sizeRange(randEngine);
+        }
+        for( auto& size : workload.temporaries ) {
+            size = sizeRange(randEngine);
+        }
+        return workload;
+    }
+
+    inline size_t objectSize( const Workload& workload, size_t request, size_t object ) {
+        return object % LargeInterval == LargeInterval - 1 ? LargeSize : workload.sizes[request * ObjectsPerRequest + object];
+    }
+
+    inline size_t temporarySize( const Workload& workload, size_t request, size_t step, size_t index ) {
+        return workload.temporaries[(request * (ObjectsPerRequest / StepObjects) + step) * StepTemporaries + index];
+    }
+
+    // the request touches what it allocates, like a real one would
+    inline void* touch( void* ptr ) {
+        *(volatile uint8_t*)ptr = 1;
+        return ptr;
+    }
+
+    bool verify( ugi::TLSF& tlsf, ugi::TLSFPool& pool ) {
+        return tlsf.verifyPool(pool).ok() && tlsf.verifyFreeLists().ok() && tlsf.getStats().bytesInUse == 0;
+    }
+
+    void printRow( const char* name, double nanoseconds, bool clean ) {
+        size_t allocations = RequestCount * (ObjectsPerRequest + ObjectsPerRequest / StepObjects * StepTemporaries);
+        printf("%-16s %12.0f %12.1f   %s\n", name, nanoseconds / RequestCount, nanoseconds / allocations, clean ? "ok" : "FAILED");
+        fflush(stdout);
+    }
+
+    void runAllocFree( const Workload& workload ) {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        ugi::TLSF tlsf;
+        tlsf.initialize(pool);
+        std::vector<void*> objects(ObjectsPerRequest);
+        void* temporaries[StepTemporaries];
+        auto start = std::chrono::steady_clock::now();
+        for( size_t request = 0; request < RequestCount; ++request ) {
+            for( size_t object = 0; object < ObjectsPerRequest; ++object ) {
+                objects[object] = touch(tlsf.alloc(objectSize(workload, request, object)));
+                if(object % StepObjects == StepObjects - 1) {
+                    size_t step = object / StepObjects;
+                    for( size_t i = 0; i < StepTemporaries; ++i ) {
+                        temporaries[i] = touch(tlsf.alloc(temporarySize(workload, request, step, i)));
+                    }
+                    for( size_t i = 0; i < StepTemporaries; ++i ) {
+                        tlsf.free(temporaries[i]);
+                    }
+                }
+            }
+            for( void* ptr : objects ) {
+                tlsf.free(ptr);
+            }
+        }
+        double nanoseconds = elapsedNanoseconds(start);
+        printRow("alloc / free", nanoseconds, verify(tlsf, pool));
+        ugi::TLSFPool::destroyPool(pool);
+    }
+
+    void runRegion( const Workload& workload ) {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        ugi::TLSF tlsf;
+        tlsf.initialize(pool);
+        bool clean = false;
+        {
+            ugi::TLSFRegion<> region(tlsf);
+            auto start = std::chrono::steady_clock::now();
+            for( size_t request = 0; request < RequestCount; ++request ) {
+                ugi::TLSFRegionScope<> requestScope(region);
+                for( size_t object = 0; object < ObjectsPerRequest; ++object ) {
+                    touch(region.alloc(objectSize(workload, request, object)));
+                    if(object % StepObjects == StepObjects - 1) {
+                        ugi::TLSFRegionScope<> stepScope(region);
+                        size_t step = object / StepObjects;
+                        for( size_t i = 0; i < StepTemporaries; ++i ) {
+                            touch(region.alloc(temporarySize(workload, request, step, i)));
+                        }
+                    }
+                }
+            }
+            double nanoseconds = elapsedNanoseconds(start);
+            clean = region.chunkCount() == 1; // the spare chunk
+            region.release();
+            printRow("region scopes", nanoseconds, clean && verify(tlsf, pool));
+        }
+        ugi::TLSFPool::destroyPool(pool);
+    }
+
+    void runHeapReset( const Workload& workload ) {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        ugi::TLSF tlsf;
+        tlsf.initialize(pool);
+        void* temporaries[StepTemporaries];
+        auto start = std::chrono::steady_clock::now();
+        for( size_t request = 0; request < RequestCount; ++request ) {
+            for( size_t object = 0; object < ObjectsPerRequest; ++object ) {
+                touch(tlsf.alloc(objectSize(workload, request, object)));
+                if(object % StepObjects == StepObjects - 1) {
+                    size_t step = object / StepObjects;
+                    for( size_t i = 0; i < StepTemporaries; ++i ) {
+                        temporaries[i] = touch(tlsf.alloc(temporarySize(workload, request, step, i)));
+                    }
+                    for( size_t i = 0; i < StepTemporaries; ++i ) {
+                        tlsf.free(temporaries[i]);
+                    }
+                }
+            }
+            tlsf.reset();
+        }
+        double nanoseconds = elapsedNanoseconds(start);
+        printRow("heap reset()", nanoseconds, verify(tlsf, pool));
+        ugi::TLSFPool::destroyPool(pool);
+    }
+
+    // fills a heap of ResetPools pools with small blocks and empties it again
+    void runResetCost( bool reset ) {
+        std::vector<ugi::TLSFPool> pools;
+        ugi::TLSF tlsf;
+        for( size_t i = 0; i < ResetPools; ++i ) {
+            pools.push_back(ugi::TLSFPool::createPool(PoolSize));
+            tlsf.initialize(pools.back());
+        }
+        std::default_random_engine randEngine(97);
+        std::uniform_int_distribution<size_t> sizeRange(16, 256);
+        std::vector<void*> blocks(ResetBlocks);
+        for( auto& ptr : blocks ) {
+            ptr = tlsf.alloc(sizeRange(randEngine));
+        }
+        std::shuffle(blocks.begin(), blocks.end(), randEngine);
+        auto start = std::chrono::steady_clock::now();
+        if(reset) {
+            tlsf.reset();
+        } else {
+            for( void* ptr : blocks ) {
+                tlsf.free(ptr);
+            }
+        }
+        double milliseconds = elapsedNanoseconds(start) / 1e6;
+        bool clean = tlsf.verifyFreeLists().ok() && tlsf.getStats().bytesInUse == 0 && tlsf.getStats().freeBlocks == ResetPools;
+        for( auto& pool : pools ) {
+            clean = clean && tlsf.verifyPool(pool).ok();
+        }
+        printf("%-16s %12.3f   %s\n", reset ? "reset()" : "free each", milliseconds, clean ? "ok" : "FAILED");
+        fflush(stdout);
+        for( auto& pool : pools ) {
+            ugi::TLSFPool::destroyPool(pool);
+        }
+    }
+
+}
+
+int main() {
+    Workload workload = makeWorkload();
+    printf("%zu requests of %zu objects, %zu temporaries every %zu objects, a %zu KB buffer every %zu\n\n", RequestCount, ObjectsPerRequest,
+        StepTemporaries, StepObjects, LargeSize / 1024, LargeInterval);
+    printf("%-16s %12s %12s\n", "scratch", "ns / request", "ns / alloc");
+    runAllocFree(workload);
+    runRegion(workload);
+    runHeapReset(workload);
+    printf("\n%zu blocks in %zu pools of %zu MB\n", ResetBlocks, ResetPools, PoolSize >> 20);
+    printf("%-16s %12s\n", "release", "ms");
+    runResetCost(false);
+    runResetCost(true);
+    return 0;
+}
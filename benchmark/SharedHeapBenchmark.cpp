@@ -0,0 +1,269 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Processes exchanging buffers through a TLSFSharedHeap, tlsf_bench_shared_heap
+**
+** For 1, 2, 4 and 8 worker processes one segment is created and every worker
+** attaches to it on its own, so each maps it at a different address. Worker i
+** allocates `BuffersPerWorker` buffers of 256 B - 64 KB, stamps them, and
+** passes their handles to worker i + 1 through a ring in the segment; it
+** checks and frees whatever worker i - 1 sent it :
+**   ms            wall time of the whole exchange
+**   pairs / s     alloc + free pairs of all workers
+**   ns / pair     time spent inside alloc and free, per pair, lock waits included
+**   bump MB       what an allocator without reuse would have consumed
+**   peak MB       peak bytes in use in the shared heap
+** Every row ends with a full heap verification, the heap must be empty again.
+** Last, a worker dies holding the heap lock and the next call recovers it.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "TLSFSharedHeap.h"
+
+namespace {
+
+    constexpr size_t SegmentSize = 256ULL * 1024 * 1024;
+    constexpr size_t MaxWorkers = 8;
+    constexpr size_t RingSize = 256;
+    constexpr size_t BuffersPerWorker = 1 << 17;
+    constexpr size_t MinBufferSize = 256;
+    constexpr size_t MaxBufferSize = 64 * 1024;
+    constexpr size_t StampStride = 1024;
+
+    typedef ugi::TLSFSharedHeap<> SharedHeap;
+
+    // single producer, single consumer
+    struct Ring {
+        std::atomic<uint64_t>           head;
+        std::atomic<uint64_t>           tail;
+        ugi::TLSFSharedHandle           slots[RingSize];
+        bool push( ugi::TLSFSharedHandle handle ) {
+            uint64_t position = tail.load(std::memory_order_relaxed);
+            if(position - head.load(std::memory_order_acquire) == RingSize) {
+                return false;
+            }
+            slots[position % RingSize] = handle;
+            tail.store(position + 1, std::memory_order_release);
+            return true;
+        }
+        bool pop( ugi::TLSFSharedHandle& handle ) {
+            uint64_t position = head.load(std::memory_order_relaxed);
+            if(position == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            handle = slots[position % RingSize];
+            head.store(position + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    struct Exchange {
+        Ring                            rings[MaxWorkers];      // ring i is read by worker i
+        std::atomic<uint64_t>           nanosecondsInHeap;
+        std::atomic<uint64_t>           bytesSent;
+        std::atomic<uint32_t>           failedWorkers;
+    };
+
+    struct BufferHeader {
+        uint64_t        size;
+        uint64_t        stamp;
+    };
+
+    inline uint64_t stampOf( size_t worker, size_t index ) {
+        return ((uint64_t)worker << 32 | index) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    double elapsedMilliseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    }
+
+    void stamp( uint8_t* buffer, size_t size, uint64_t value ) {
+        BufferHeader* header = (BufferHeader*)buffer;
+        header->size = size;
+        header->stamp = value;
+        for( size_t offset = StampStride; offset + sizeof(uint64_t) <= size; offset += StampStride ) {
+            *(uint64_t*)(buffer + offset) = value + offset;
+        }
+    }
+
+    bool check( const uint8_t* buffer ) {
+        const BufferHeader* header = (const BufferHeader*)buffer;
+        for( size_t offset = StampStride; offset + sizeof(uint64_t) <= header->size; offset += StampStride ) {
+            if(*(const uint64_t*)(buffer + offset) != header->stamp + offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int worker( const char* name, size_t index, size_t workerCount ) {
+        SharedHeap heap;
+        if(!heap.attach(name)) {
+            return 1;
+        }
+        Exchange* exchange = (Exchange*)heap.fromHandle(heap.root());
+        Ring& inbox = exchange->rings[index];
+        Ring& outbox = exchange->rings[(index + 1) % workerCount];
+        std::default_random_engine randEngine((uint32_t)index + 83);
+        std::uniform_int_distribution<size_t> sizeRange(MinBufferSize, MaxBufferSize);
+        uint64_t nanoseconds = 0;
+        uint64_t bytesSent = 0;
+        size_t sent = 0;
+        size_t received = 0;
+        bool intact = true;
+        uint8_t* pending = nullptr;
+        while(sent < BuffersPerWorker || received < BuffersPerWorker) {
+            if(sent < BuffersPerWorker) {
+                if(!pending) {
+                    size_t size = sizeRange(randEngine);
+                    auto start = std::chrono::steady_clock::now();
+                    pending = (uint8_t*)heap.alloc(size);
+                    nanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                    if(pending) {
+                        stamp(pending, size, stampOf(index, sent));
+                        bytesSent += size;
+                    }
+                }
+                if(pending && outbox.push(heap.toHandle(pending))) {
+                    pending = nullptr;
+                    ++sent;
+                }
+            }
+            ugi::TLSFSharedHandle handle;
+            while(inbox.pop(handle)) {
+                uint8_t* buffer = (uint8_t*)heap.fromHandle(handle);
+                intact = intact && check(buffer);
+                auto start = std::chrono::steady_clock::now();
+                heap.free(buffer);
+                nanoseconds += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                ++received;
+            }
+            if(pending || (sent == BuffersPerWorker && received < BuffersPerWorker)) {
+                sched_yield(); // the outbox is full or the heap is out of memory, let the others drain it
+            }
+        }
+        exchange->nanosecondsInHeap.fetch_add(nanoseconds);
+        exchange->bytesSent.fetch_add(bytesSent);
+        if(!intact) {
+            exchange->failedWorkers.fetch_add(1);
+        }
+        return 0;
+    }
+
+    bool runExchange( const char* name, size_t workerCount ) {
+        SharedHeap heap;
+        if(!heap.create(name, SegmentSize)) {
+            printf("create failed : %s\n", heap.error());
+            return false;
+        }
+        Exchange* exchange = (Exchange*)heap.alloc(sizeof(Exchange));
+        memset((void*)exchange, 0, sizeof(Exchange));
+        heap.setRoot(heap.toHandle(exchange));
+        size_t usedBefore = 0;
+        heap.locked([&]( ugi::TLSFRelative& tlsf ) {
+            usedBefore = tlsf.getStats().bytesInUse;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t workers[MaxWorkers];
+        for( size_t i = 0; i < workerCount; ++i ) {
+            workers[i] = fork();
+            if(workers[i] == 0) {
+                _exit(worker(name, i, workerCount));
+            }
+        }
+        int failedProcesses = 0;
+        for( size_t i = 0; i < workerCount; ++i ) {
+            int status = 0;
+            waitpid(workers[i], &status, 0);
+            failedProcesses += !WIFEXITED(status) || WEXITSTATUS(status);
+        }
+        double milliseconds = elapsedMilliseconds(start);
+
+        ugi::TLSFRelative::Stats stats;
+        ugi::TLSFVerifyResult pool = {};
+        ugi::TLSFVerifyResult freeLists = {};
+        heap.locked([&]( ugi::TLSFRelative& tlsf ) {
+            stats = tlsf.getStats();
+            tlsf.walkPools([&]( const ugi::TLSFPool& each ) {
+                pool = tlsf.verifyPool(each);
+            });
+            freeLists = tlsf.verifyFreeLists();
+        });
+        double pairs = (double)BuffersPerWorker * workerCount;
+        bool clean = !failedProcesses && !exchange->failedWorkers.load() && pool.ok() && freeLists.ok() && stats.bytesInUse == usedBefore;
+        printf("%7zu %10.1f %12.0f %10.1f %10.1f %9.1f   %s\n", workerCount, milliseconds, pairs / milliseconds * 1000.0,
+            (double)exchange->nanosecondsInHeap.load() / pairs, exchange->bytesSent.load() / 1048576.0,
+            (stats.peakBytesInUse - usedBefore) / 1048576.0, clean ? "ok" : "FAILED");
+        fflush(stdout);
+        heap.free(exchange);
+        heap.detach();
+        SharedHeap::unlink(name);
+        return clean;
+    }
+
+    // a worker dies holding the lock with blocks allocated, the next caller verifies and goes on
+    bool runOwnerDeath( const char* name ) {
+        SharedHeap heap;
+        if(!heap.create(name, SegmentSize)) {
+            printf("create failed : %s\n", heap.error());
+            return false;
+        }
+        pid_t child = fork();
+        if(child == 0) {
+            SharedHeap attached;
+            if(!attached.attach(name)) {
+                _exit(1);
+            }
+            for( int i = 0; i < 1000; ++i ) {
+                attached.alloc(4096);
+            }
+            attached.locked([]( ugi::TLSFRelative& ) {
+                _exit(0);
+            });
+            _exit(1);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        auto start = std::chrono::steady_clock::now();
+        void* ptr = heap.alloc(4096);
+        double milliseconds = elapsedMilliseconds(start);
+        printf("owner death : next alloc %s after %.2f ms, %llu recoveries, heap %s\n", ptr ? "succeeded" : "failed", milliseconds,
+            (unsigned long long)heap.recoveries(), heap.broken() ? "broken" : "consistent");
+        bool recovered = ptr && !heap.broken();
+        heap.free(ptr);
+        heap.detach();
+        SharedHeap::unlink(name);
+        return recovered;
+    }
+
+}
+
+int main() {
+    char name[64];
+    snprintf(name, sizeof(name), "/tlsf_bench_shared_%d", (int)getpid());
+    printf("%zu buffers of %zu B - %zu KB per worker, %zu MB segment\n\n", BuffersPerWorker, MinBufferSize, MaxBufferSize / 1024, SegmentSize >> 20);
+    printf("%7s %10s %12s %10s %10s %9s\n", "workers", "ms", "pairs / s", "ns / pair", "bump MB", "peak MB");
+    bool succeeded = true;
+    for( size_t workerCount = 1; workerCount <= MaxWorkers; workerCount *= 2 ) {
+        succeeded = runExchange(name, workerCount) && succeeded;
+    }
+    printf("\n");
+    succeeded = runOwnerDeath(name) && succeeded;
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Heap walk and snapshot writing.
+**
+** A heap is filled with random sizes and a random half is freed, then a
+** snapshot is written. After a churn that favours small requests a second
+** snapshot is written, so the pair shows fragmentation creeping in :
+**
+**   tlsf_bench_snapshot [ prefix ]   writes <prefix>_before.snap and <prefix>_after.snap
+**   tlsf_snapshot diff <prefix>_before.snap <prefix>_after.snap
+**
+** Prints the time of a bare walkBlocks, of a snapshot and of dump(), and
+** checks with getStats() that writing did not allocate from the heap.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+#include "TLSFSnapshot.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 32ULL * 1024 * 1024;
+    constexpr size_t PoolCount = 2;
+    constexpr size_t ChurnOperations = 1 << 20;
+
+    double elapsedMicroseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    }
+
+    bool writeSnapshot( ugi::TLSF& tlsf, const std::string& path ) {
+        FILE* file = fopen(path.c_str(), "wb");
+        if(!file) {
+            printf("cannot create %s\n", path.c_str());
+            return false;
+        }
+        ugi::TLSF::Stats beforeStats = tlsf.getStats();
+        auto start = std::chrono::steady_clock::now();
+        bool succeeded = ugi::tlsf_write_snapshot(tlsf, file);
+        double microseconds = elapsedMicroseconds(start);
+        succeeded = fclose(file) == 0 && succeeded;
+        ugi::TLSF::Stats afterStats = tlsf.getStats();
+        if(afterStats.usedBlocks != beforeStats.usedBlocks || afterStats.splitCount != beforeStats.splitCount) {
+            printf("writing the snapshot changed the heap!\n");
+            succeeded = false;
+        }
+        printf("snapshot       : %10.1f us  %s\n", microseconds, path.c_str());
+        return succeeded;
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    std::string prefix = argc > 1 ? argv[1] : "tlsf_heap";
+    ugi::TLSF tlsf;
+    for( size_t i = 0; i < PoolCount; ++i ) {
+        tlsf.initialize(ugi::TLSFPool::createPool(PoolSize));
+    }
+    std::default_random_engine randEngine(23);
+    std::uniform_int_distribution<size_t> sizeRange(16, 16 * 1024);
+    std::vector<void*> live;
+    for(;;) {
+        void* ptr = tlsf.alloc(sizeRange(randEngine));
+        if(!ptr) {
+            break;
+        }
+        live.push_back(ptr);
+    }
+    std::shuffle(live.begin(), live.end(), randEngine);
+    for( size_t i = live.size() / 2; i < live.size(); ++i ) {
+        tlsf.free(live[i]);
+    }
+    live.resize(live.size() / 2);
+
+    size_t blocks = 0;
+    auto start = std::chrono::steady_clock::now();
+    tlsf.walkBlocks([&]( const ugi::TLSFBlockInfo& ) {
+        ++blocks;
+    });
+    printf("walkBlocks     : %10.1f us  %zu blocks\n", elapsedMicroseconds(start), blocks);
+    start = std::chrono::steady_clock::now();
+    tlsf.dump();
+    printf("dump           : %10.1f us\n", elapsedMicroseconds(start));
+    bool succeeded = writeSnapshot(tlsf, prefix + "_before.snap");
+
+    // small requests take the big holes apart
+    std::uniform_int_distribution<size_t> smallRange(16, 512);
+    for( size_t i = 0; i < ChurnOperations; ++i ) {
+        size_t slot = randEngine() % live.size();
+        tlsf.free(live[slot]);
+        live[slot] = tlsf.alloc(i & 1 ? smallRange(randEngine) : sizeRange(randEngine));
+        if(!live[slot]) {
+            live[slot] = tlsf.alloc(16);
+        }
+    }
+    succeeded = writeSnapshot(tlsf, prefix + "_after.snap") && succeeded;
+    for( void* ptr : live ) {
+        tlsf.free(ptr);
+    }
+    return succeeded ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Cost of the statistics counters.
+**
+** Built twice, as tlsf_bench_stats ( TLSF_ENABLE_STATS 1 ) and as
+** tlsf_bench_stats_off ( TLSF_ENABLE_STATS 0 ). Both run the same random
+** alloc/free churn on a half full heap and print ns per alloc/free pair.
+** Then getStats() is compared with dump(), which walks every block.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 64ULL * 1024 * 1024;
+    constexpr size_t LiveCount = 100000;
+    constexpr size_t ChurnOperations = 1 << 23;
+    constexpr size_t QueryRounds = 1000;
+
+    void printStats( const ugi::TLSF::Stats& stats ) {
+        size_t usedBins = 0;
+        for( size_t firstLevel = 0; firstLevel < ugi::TLSF::FLC; ++firstLevel ) {
+            for( size_t secondLevel = 0; secondLevel < ugi::TLSF::SLC; ++secondLevel ) {
+                usedBins += stats.freeBlocksPerBin[firstLevel][secondLevel] ? 1 : 0;
+            }
+        }
+        printf("bytes in use   : %zu ( peak %zu of %zu )\n", stats.bytesInUse, stats.peakBytesInUse, stats.poolBytes);
+        printf("blocks         : %zu used, %zu free in %zu bins, %zu free bytes\n", stats.usedBlocks, stats.freeBlocks, usedBins, stats.freeBytes);
+        printf("largest free   : %zu\n", stats.largestFreeBlock);
+        printf("split / merge  : %llu / %llu\n", (unsigned long long)stats.splitCount, (unsigned long long)stats.mergeCount);
+        printf("failed allocs  : %llu\n", (unsigned long long)stats.failedAllocations);
+    }
+
+}
+
+int main() {
+    printf("TLSF_ENABLE_STATS %d\n", TLSF_ENABLE_STATS);
+    ugi::TLSF tlsf;
+    tlsf.initialize(ugi::TLSFPool::createPool(PoolSize));
+    std::default_random_engine randEngine(17);
+    std::uniform_int_distribution<size_t> sizeRange(16, 1024);
+    std::uniform_int_distribution<size_t> slotRange(0, LiveCount - 1);
+    std::vector<void*> live(LiveCount);
+    for( auto& ptr : live ) {
+        ptr = tlsf.alloc(sizeRange(randEngine));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for( size_t i = 0; i < ChurnOperations; ++i ) {
+        size_t slot = slotRange(randEngine);
+        tlsf.free(live[slot]);
+        live[slot] = tlsf.alloc(sizeRange(randEngine));
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("churn          : %.1f ns / pair\n", (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / ChurnOperations);
+
+    start = std::chrono::steady_clock::now();
+    size_t checksum = 0;
+    for( size_t i = 0; i < QueryRounds; ++i ) {
+        checksum += tlsf.getStats().largestFreeBlock;
+    }
+    end = std::chrono::steady_clock::now();
+    printf("getStats       : %.1f ns ( %zu )\n", (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / QueryRounds, checksum / QueryRounds);
+    printStats(tlsf.getStats());
+
+    start = std::chrono::steady_clock::now();
+    tlsf.dump();
+    end = std::chrono::steady_clock::now();
+    printf("dump           : %.2f us\n", (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1000.0);
+    for( void* ptr : live ) {
+        tlsf.free(ptr);
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Standard allocator workloads, TLSF against system malloc
+** ( and the reference TLSF 3.1 when tlsf-github/ is checked out ).
+**
+**   size classes : fixed 64 B, uniform 16 B .. 4 KB, power-law 16 B .. 64 KB
+**                  ( log-uniform, so small blocks dominate the count )
+**   free orders  : LIFO, FIFO and random, `BatchSize` blocks per round
+**   realloc      : `ReallocBuffers` buffers resized to random power-law sizes
+**   churn        : `ChurnLive` live blocks, every op frees one at random and
+**                  allocates a new one, the steady state of a long running service
+**
+** Sizes and free orders are generated before the clock starts and the loop is
+** timed as a whole, so only the allocator calls and one byte written per
+** block are measured. An op is one alloc, free or realloc call.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.h"
+
+#if TLSF_BENCH_HAVE_TLSF31
+#include "tlsf-github/tlsf.h"
+#endif
+
+namespace {
+
+    constexpr size_t PoolSize = 1ULL << 30;
+    constexpr size_t BatchSize = 4096;
+    constexpr size_t TotalAllocations = 1 << 21;
+    constexpr size_t OrderCount = 16;
+    constexpr size_t ReallocBuffers = 4096;
+    constexpr size_t ReallocOperations = 1 << 20;
+    constexpr size_t ChurnLive = 32768;
+    constexpr size_t ChurnOperations = 1 << 21;
+
+    struct MallocHeap {
+        static const char* name() {
+            return "malloc";
+        }
+        void* alloc( size_t size ) {
+            return std::malloc(size);
+        }
+        void free( void* ptr ) {
+            std::free(ptr);
+        }
+        void* realloc( void* ptr, size_t size ) {
+            return std::realloc(ptr, size);
+        }
+    };
+
+    template< class HeapType >
+    struct TLSFHeap {
+        HeapType        heap;
+        ugi::TLSFPool   pool;
+        TLSFHeap()
+            : pool(ugi::TLSFPool::createPool(PoolSize))
+        {
+            heap.initialize(pool);
+        }
+        ~TLSFHeap() {
+            ugi::TLSFPool::destroyPool(pool);
+        }
+        void* alloc( size_t size ) {
+            return heap.alloc(size);
+        }
+        void free( void* ptr ) {
+            heap.free(ptr);
+        }
+        void* realloc( void* ptr, size_t size ) {
+            return heap.realloc(ptr, size);
+        }
+    };
+
+    struct DefaultTLSFHeap : TLSFHeap<ugi::TLSF> {
+        static const char* name() {
+            return "TLSF";
+        }
+    };
+
+    struct CompactTLSFHeap : TLSFHeap<ugi::TLSFCompact> {
+        static const char* name() {
+            return "TLSFCompact";
+        }
+    };
+
+#if TLSF_BENCH_HAVE_TLSF31
+    struct ReferenceTLSFHeap {
+        void*           memory;
+        tlsf_t          tlsf;
+        ReferenceTLSFHeap()
+            : memory(std::malloc(PoolSize))
+            , tlsf(tlsf_create_with_pool(memory, PoolSize))
+        {}
+        ~ReferenceTLSFHeap() {
+            tlsf_destroy(tlsf);
+            std::free(memory);
+        }
+        static const char* name() {
+            return "TLSF 3.1";
+        }
+        void* alloc( size_t size ) {
+            return tlsf_malloc(tlsf, size);
+        }
+        void free( void* ptr ) {
+            tlsf_free(tlsf, ptr);
+        }
+        void* realloc( void* ptr, size_t size ) {
+            return tlsf_realloc(tlsf, ptr, size);
+        }
+    };
+#endif
+
+    enum class FreeOrder {
+        LIFO,
+        FIFO,
+        Random,
+    };
+
+    enum class WorkloadType {
+        Batch,
+        Realloc,
+        Churn,
+    };
+
+    struct Workload {
+        const char*             name;
+        WorkloadType            type;
+        FreeOrder               order;
+        std::vector<uint32_t>   sizes;          // one per alloc or realloc call
+        std::vector<uint32_t>   slots;          // realloc / churn : which live block the op works on
+        std::vector<std::vector<uint32_t>> orders;
+    };
+
+    typedef uint32_t (*SizeFunc)( std::default_random_engine& randEngine );
+
+    uint32_t fixedSize( std::default_random_engine& ) {
+        return 64;
+    }
+
+    uint32_t uniformSize( std::default_random_engine& randEngine ) {
+        return std::uniform_int_distribution<uint32_t>(16, 4096)(randEngine);
+    }
+
+    uint32_t powerLawSize( std::default_random_engine& randEngine ) {
+        double exponent = std::uniform_real_distribution<double>(std::log(16.0), std::log(65536.0))(randEngine);
+        return (uint32_t)std::exp(exponent);
+    }
+
+    Workload makeBatchWorkload( const char* name, SizeFunc sizeFunc, FreeOrder order ) {
+        Workload workload;
+        workload.name = name;
+        workload.type = WorkloadType::Batch;
+        workload.order = order;
+        std::default_random_engine randEngine(31);
+        workload.sizes.resize(TotalAllocations);
+        for( auto& size : workload.sizes ) {
+            size = sizeFunc(randEngine);
+        }
+        workload.orders.resize(OrderCount, std::vector<uint32_t>(BatchSize));
+        for( auto& freeOrder : workload.orders ) {
+            for( size_t i = 0; i < BatchSize; ++i ) {
+                freeOrder[i] = (uint32_t)(order == FreeOrder::LIFO ? BatchSize - 1 - i : i);
+            }
+            if(order == FreeOrder::Random) {
+                std::shuffle(freeOrder.begin(), freeOrder.end(), randEngine);
+            }
+        }
+        return workload;
+    }
+
+    Workload makeSlotWorkload( const char* name, WorkloadType type, size_t liveCount, size_t operations ) {
+        Workload workload;
+        workload.name = name;
+        workload.type = type;
+        workload.order = FreeOrder::Random;
+        std::default_random_engine randEngine(37);
+        std::uniform_int_distribution<uint32_t> slotRange(0, (uint32_t)liveCount - 1);
+        workload.sizes.resize(liveCount + operations);
+        workload.slots.resize(operations);
+        for( auto& size : workload.sizes ) {
+            size = powerLawSize(randEngine);
+        }
+        for( auto& slot : workload.slots ) {
+            slot = slotRange(randEngine);
+        }
+        return workload;
+    }
+
+    inline void* allocTouched( void* ptr ) {
+        if(ptr) {
+            *(volatile uint8_t*)ptr = 1;
+        }
+        return ptr;
+    }
+
+    // slot workloads : the first sizes fill the live set before the clock starts
+    template< class Heap >
+    void fillLiveSet( Heap& heap, const Workload& workload, std::vector<void*>& ptrs ) {
+        size_t liveCount = workload.sizes.size() - workload.slots.size();
+        ptrs.resize(liveCount);
+        for( size_t i = 0; i < liveCount; ++i ) {
+            ptrs[i] = allocTouched(heap.alloc(workload.sizes[i]));
+        }
+    }
+
+    // returns the op count, ptrs is the live set that is left for the caller to free
+    template< class Heap >
+    size_t runWorkload( Heap& heap, const Workload& workload, std::vector<void*>& ptrs ) {
+        if(workload.type == WorkloadType::Batch) {
+            ptrs.resize(BatchSize);
+            size_t rounds = workload.sizes.size() / BatchSize;
+            for( size_t round = 0; round < rounds; ++round ) {
+                const uint32_t* sizes = &workload.sizes[round * BatchSize];
+                for( size_t i = 0; i < BatchSize; ++i ) {
+                    ptrs[i] = allocTouched(heap.alloc(sizes[i]));
+                }
+                for( uint32_t index : workload.orders[round % OrderCount] ) {
+                    heap.free(ptrs[index]);
+                }
+            }
+            ptrs.clear();
+            return rounds * BatchSize * 2;
+        }
+        const uint32_t* sizes = &workload.sizes[ptrs.size()];
+        for( size_t i = 0; i < workload.slots.size(); ++i ) {
+            void*& ptr = ptrs[workload.slots[i]];
+            if(workload.type == WorkloadType::Realloc) {
+                ptr = allocTouched(heap.realloc(ptr, sizes[i]));
+            }
+            else {
+                heap.free(ptr);
+                ptr = allocTouched(heap.alloc(sizes[i]));
+            }
+        }
+        return workload.slots.size() * (workload.type == WorkloadType::Realloc ? 1 : 2);
+    }
+
+    // ns per op
+    template< class Heap >
+    double measure( const Workload& workload ) {
+        Heap* heap = new Heap();
+        std::vector<void*> ptrs;
+        if(workload.type == WorkloadType::Batch) {
+            runWorkload(*heap, workload, ptrs);     // warm up, so fresh pool pages are not counted
+        }
+        else {
+            fillLiveSet(*heap, workload, ptrs);
+        }
+        auto start = std::chrono::steady_clock::now();
+        size_t operations = runWorkload(*heap, workload, ptrs);
+        double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        for( void* ptr : ptrs ) {
+            heap->free(ptr);
+        }
+        delete heap;
+        return nanoseconds / operations;
+    }
+
+    template< class Heap >
+    void printResult( const Workload& workload ) {
+        double nanoseconds = measure<Heap>(workload);
+        printf(" %8.1f %8.1f |", nanoseconds, 1000.0 / nanoseconds);
+    }
+
+    template< class Heap >
+    void printHeader() {
+        printf(" %17s |", Heap::name());
+    }
+
+}
+
+int main() {
+    std::vector<Workload> workloads;
+    workloads.push_back(makeBatchWorkload("fixed LIFO", fixedSize, FreeOrder::LIFO));
+    workloads.push_back(makeBatchWorkload("fixed FIFO", fixedSize, FreeOrder::FIFO));
+    workloads.push_back(makeBatchWorkload("fixed random", fixedSize, FreeOrder::Random));
+    workloads.push_back(makeBatchWorkload("uniform LIFO", uniformSize, FreeOrder::LIFO));
+    workloads.push_back(makeBatchWorkload("uniform FIFO", uniformSize, FreeOrder::FIFO));
+    workloads.push_back(makeBatchWorkload("uniform random", uniformSize, FreeOrder::Random));
+    workloads.push_back(makeBatchWorkload("power-law LIFO", powerLawSize, FreeOrder::LIFO));
+    workloads.push_back(makeBatchWorkload("power-law FIFO", powerLawSize, FreeOrder::FIFO));
+    workloads.push_back(makeBatchWorkload("power-law random", powerLawSize, FreeOrder::Random));
+    workloads.push_back(makeSlotWorkload("realloc", WorkloadType::Realloc, ReallocBuffers, ReallocOperations));
+    workloads.push_back(makeSlotWorkload("churn", WorkloadType::Churn, ChurnLive, ChurnOperations));
+
+    printf("%-18s |", "ns/op  Mops/s");
+    printHeader<MallocHeap>();
+    printHeader<DefaultTLSFHeap>();
+    printHeader<CompactTLSFHeap>();
+#if TLSF_BENCH_HAVE_TLSF31
+    printHeader<ReferenceTLSFHeap>();
+#endif
+    printf("\n");
+    for( const Workload& workload : workloads ) {
+        printf("%-18s |", workload.name);
+        printResult<MallocHeap>(workload);
+        printResult<DefaultTLSFHeap>(workload);
+        printResult<CompactTLSFHeap>(workload);
+#if TLSF_BENCH_HAVE_TLSF31
+        printResult<ReferenceTLSFHeap>(workload);
+#endif
+        printf("\n");
+        fflush(stdout);
+    }
+#if !TLSF_BENCH_HAVE_TLSF31
+    printf("TLSF 3.1 not compared, check it out into tlsf-github/ ( tlsf.c, tlsf.h ) and re-run cmake\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,368 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Multi-threaded scalability, 1 .. N threads on one MemoryAllocator.
+**
+**   tlsf_bench_threads [ max threads ] [ ms per run ]
+**
+** Backends : a mutex around TLSF ( the baseline every concurrent mode is
+** measured against ), TLSFThreadCache<TLSF>, TLSFMultiHeap<TLSF> and malloc.
+**
+** Patterns :
+**   private    every thread churns its own live set, alloc and free on the same thread
+**   handoff    producer / consumer, every thread hands the blocks it allocates to the
+**              next thread through a bounded queue and frees what it is handed
+**   shared     one live set for all threads, every op swaps a new block into a random
+**              slot and frees whatever was there, mostly blocks of other threads
+**
+** A run lasts a fixed time, an op is one alloc or one free. For every thread
+** count the tables show the throughput, the speedup over the same backend on
+** one thread, and the fairness : fewest ops of a thread / most ops of a thread.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TLSF.hpp"
+#include "TLSFThreadCache.h"
+#include "TLSFMultiHeap.h"
+#include "../MemoryAllocator.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 1ULL << 30;
+    constexpr size_t PrivateLiveCount = 1024;           // per thread
+    constexpr size_t SharedLiveCount = 16384;
+    constexpr size_t HandoffQueueSize = 256;            // per thread, a power of two
+    constexpr size_t HandoffBurst = 16;
+    constexpr size_t MinSize = 16;
+    constexpr size_t MaxSize = 2048;
+
+    // the baseline, one lock around the whole heap
+    template< class HeapType >
+    class LockedHeap {
+    private:
+        HeapType        _heap;
+        std::mutex      _mutex;
+    public:
+        bool initialize( ugi::TLSFPool pool ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.initialize(pool);
+        }
+        void* alloc( size_t size ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.alloc(size);
+        }
+        void free( void* ptr ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _heap.free(ptr);
+        }
+    };
+
+    class MallocHeap {
+    public:
+        void* alloc( size_t size ) {
+            return std::malloc(size);
+        }
+        void free( void* ptr ) {
+            std::free(ptr);
+        }
+    };
+
+    enum class Pattern {
+        Private,
+        Handoff,
+        Shared,
+    };
+
+    const char* patternName( Pattern pattern ) {
+        switch(pattern) {
+        case Pattern::Private: return "private";
+        case Pattern::Handoff: return "handoff";
+        default: return "shared";
+        }
+    }
+
+    // xorshift, cheap enough not to show up next to the allocator
+    struct Random {
+        uint32_t        state;
+        explicit Random( uint32_t seed )
+            : state(seed * 2654435761u + 1)
+        {}
+        inline uint32_t next() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+        inline size_t size() {
+            return MinSize + next() % (MaxSize - MinSize + 1);
+        }
+    };
+
+    // single producer, single consumer
+    class HandoffQueue {
+    private:
+        void*                   _slots[HandoffQueueSize];
+        alignas(64) std::atomic<size_t> _head;      // next slot to read
+        alignas(64) std::atomic<size_t> _tail;      // next slot to write
+    public:
+        HandoffQueue()
+            : _slots{}
+            , _head(0)
+            , _tail(0)
+        {}
+        bool push( void* ptr ) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if(tail - _head.load(std::memory_order_acquire) == HandoffQueueSize) {
+                return false;
+            }
+            _slots[tail & (HandoffQueueSize - 1)] = ptr;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        void* pop() {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if(head == _tail.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            void* ptr = _slots[head & (HandoffQueueSize - 1)];
+            _head.store(head + 1, std::memory_order_release);
+            return ptr;
+        }
+    };
+
+    struct alignas(64) ThreadResult {
+        uint64_t        operations;
+    };
+
+    struct RunResult {
+        double          mops;           // million ops per second, all threads
+        double          fairness;
+    };
+
+    template< class Allocator >
+    void runPrivate( Allocator& allocator, size_t thread, const std::atomic<bool>& stop, ThreadResult& result ) {
+        Random random((uint32_t)thread + 1);
+        std::vector<void*> live(PrivateLiveCount);
+        for( auto& ptr : live ) {
+            ptr = allocator.alloc(random.size());
+        }
+        uint64_t operations = 0;
+        while(!stop.load(std::memory_order_relaxed)) {
+            for( size_t i = 0; i < 64; ++i ) {
+                void*& ptr = live[random.next() % PrivateLiveCount];
+                allocator.free(ptr);
+                ptr = allocator.alloc(random.size());
+            }
+            operations += 128;
+        }
+        for( void* ptr : live ) {
+            allocator.free(ptr);
+        }
+        result.operations = operations;
+    }
+
+    template< class Allocator >
+    void runHandoff( Allocator& allocator, size_t thread, const std::atomic<bool>& stop, HandoffQueue& inbound, HandoffQueue& outbound, ThreadResult& result ) {
+        Random random((uint32_t)thread + 1);
+        uint64_t operations = 0;
+        while(!stop.load(std::memory_order_relaxed)) {
+            for( size_t i = 0; i < HandoffBurst; ++i ) {
+                void* ptr = inbound.pop();
+                if(!ptr) {
+                    break;
+                }
+                allocator.free(ptr);
+                ++operations;
+            }
+            for( size_t i = 0; i < HandoffBurst; ++i ) {
+                void* ptr = allocator.alloc(random.size());
+                ++operations;
+                if(!outbound.push(ptr)) {
+                    // the consumer is behind, keep the op count honest and move on
+                    allocator.free(ptr);
+                    ++operations;
+                    break;
+                }
+            }
+        }
+        result.operations = operations;
+    }
+
+    template< class Allocator >
+    void runShared( Allocator& allocator, size_t thread, const std::atomic<bool>& stop, std::vector<std::atomic<void*>>& live, ThreadResult& result ) {
+        Random random((uint32_t)thread + 1);
+        uint64_t operations = 0;
+        while(!stop.load(std::memory_order_relaxed)) {
+            for( size_t i = 0; i < 64; ++i ) {
+                void* ptr = allocator.alloc(random.size());
+                void* old = live[random.next() % live.size()].exchange(ptr, std::memory_order_acq_rel);
+                allocator.free(old);
+            }
+            operations += 128;
+        }
+        result.operations = operations;
+    }
+
+    template< class Allocator >
+    RunResult run( Allocator& allocator, Pattern pattern, size_t threadCount, std::chrono::milliseconds duration ) {
+        std::atomic<bool> stop(false);
+        std::vector<ThreadResult> results(threadCount);
+        std::vector<HandoffQueue> queues(pattern == Pattern::Handoff ? threadCount : 0);
+        std::vector<std::atomic<void*>> live(pattern == Pattern::Shared ? SharedLiveCount : 0);
+        Random random(99);
+        for( auto& slot : live ) {
+            slot.store(allocator.alloc(random.size()));
+        }
+        std::vector<std::thread> threads;
+        for( size_t i = 0; i < threadCount; ++i ) {
+            threads.emplace_back([&, i]() {
+                switch(pattern) {
+                case Pattern::Private:
+                    runPrivate(allocator, i, stop, results[i]);
+                    break;
+                case Pattern::Handoff:
+                    runHandoff(allocator, i, stop, queues[(i + threadCount - 1) % threadCount], queues[i], results[i]);
+                    break;
+                case Pattern::Shared:
+                    runShared(allocator, i, stop, live, results[i]);
+                    break;
+                }
+            });
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        for( auto& thread : threads ) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for( auto& queue : queues ) {
+            while(void* ptr = queue.pop()) {
+                allocator.free(ptr);
+            }
+        }
+        for( auto& slot : live ) {
+            allocator.free(slot.load());
+        }
+        uint64_t total = 0;
+        uint64_t fewest = results[0].operations;
+        uint64_t most = results[0].operations;
+        for( const ThreadResult& result : results ) {
+            total += result.operations;
+            fewest = result.operations < fewest ? result.operations : fewest;
+            most = result.operations > most ? result.operations : most;
+        }
+        RunResult result;
+        result.mops = total / seconds / 1e6;
+        result.fairness = most ? (double)fewest / most : 1.0;
+        return result;
+    }
+
+    // backends that grow their own pools
+    struct NoPool {
+        template< class Allocator >
+        ugi::TLSFPool operator()( Allocator& ) const {
+            return ugi::TLSFPool();
+        }
+    };
+
+    struct Row {
+        const char*             name;
+        std::vector<RunResult>  results;        // one per thread count
+    };
+
+    // a fresh allocator per run, so one run's leftovers do not help or hurt the next
+    template< class AllocatorType, class SetupFunc >
+    Row measure( const char* name, Pattern pattern, const std::vector<size_t>& threadCounts, std::chrono::milliseconds duration, SetupFunc setup ) {
+        Row row;
+        row.name = name;
+        for( size_t threadCount : threadCounts ) {
+            ugi::MemoryAllocator<AllocatorType>* allocator = new ugi::MemoryAllocator<AllocatorType>();
+            ugi::TLSFPool pool = setup(*allocator);
+            row.results.push_back(run(*allocator, pattern, threadCount, duration));
+            delete allocator;
+            if(pool.capacity()) {
+                ugi::TLSFPool::destroyPool(pool);
+            }
+        }
+        return row;
+    }
+
+    template< class PrintFunc >
+    void printTable( const char* title, const std::vector<size_t>& threadCounts, const std::vector<Row>& rows, PrintFunc print ) {
+        printf("  %-22s", title);
+        for( size_t threadCount : threadCounts ) {
+            printf(" %8zu", threadCount);
+        }
+        printf("\n");
+        for( const Row& row : rows ) {
+            printf("  %-22s", row.name);
+            for( size_t i = 0; i < row.results.size(); ++i ) {
+                printf(" %8.2f", print(row, i));
+            }
+            printf("\n");
+        }
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    size_t hardwareThreads = std::thread::hardware_concurrency();
+    size_t maxThreads = argc > 1 ? (size_t)atoi(argv[1]) : (hardwareThreads > 4 ? hardwareThreads : 4);
+    std::chrono::milliseconds duration(argc > 2 ? atoi(argv[2]) : 200);
+    std::vector<size_t> threadCounts;
+    for( size_t threadCount = 1; threadCount < maxThreads; threadCount *= 2 ) {
+        threadCounts.push_back(threadCount);
+    }
+    threadCounts.push_back(maxThreads);
+    printf("%zu hardware threads, %lld ms per run, an op is one alloc or one free\n", hardwareThreads, (long long)duration.count());
+
+    auto tlsfPool = []( ugi::MemoryAllocator<LockedHeap<ugi::TLSF>>& allocator ) {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        allocator.initialize(pool);
+        return pool;
+    };
+    auto threadCachePool = []( ugi::MemoryAllocator<ugi::TLSFThreadCache<ugi::TLSF>>& allocator ) {
+        ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+        allocator.initialize(pool);
+        return pool;
+    };
+    NoPool noPool;
+    const Pattern patterns[] = { Pattern::Private, Pattern::Handoff, Pattern::Shared };
+    for( Pattern pattern : patterns ) {
+        std::vector<Row> rows;
+        rows.push_back(measure<LockedHeap<ugi::TLSF>>("mutex + TLSF", pattern, threadCounts, duration, tlsfPool));
+        rows.push_back(measure<ugi::TLSFThreadCache<ugi::TLSF>>("TLSFThreadCache", pattern, threadCounts, duration, threadCachePool));
+        rows.push_back(measure<ugi::TLSFMultiHeap<ugi::TLSF>>("TLSFMultiHeap", pattern, threadCounts, duration, noPool));
+        rows.push_back(measure<MallocHeap>("malloc", pattern, threadCounts, duration, noPool));
+        printf("\n%s\n", patternName(pattern));
+        printTable("Mops/s    threads :", threadCounts, rows, []( const Row& row, size_t i ) {
+            return row.results[i].mops;
+        });
+        printTable("speedup", threadCounts, rows, []( const Row& row, size_t i ) {
+            return row.results[i].mops / row.results[0].mops;
+        });
+        printTable("vs mutex + TLSF", threadCounts, rows, [&rows]( const Row& row, size_t i ) {
+            return row.results[i].mops / rows[0].results[i].mops;
+        });
+        printTable("fairness", threadCounts, rows, []( const Row& row, size_t i ) {
+            return row.results[i].fairness;
+        });
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Cost of trace recording, and a trace to replay.
+**
+** The same random churn runs through MemoryAllocator<TLSF>, TracingAllocator<TLSF>
+** without a writer and TracingAllocator<TLSF> with a TLSFTraceWriter attached,
+** the difference to MemoryAllocator is the recording cost per op.
+** The writer's helper thread copies the events into the file, its time is
+** left out of the cpu column ( the churning thread's own cpu time ), on a
+** single core machine it still shows in the wall column.
+** Then `ThreadCount` threads churn on a shared TracingAllocator<TLSFThreadCache<TLSF>>
+** while it records, which leaves a trace to try :
+**
+**   tlsf_bench_trace [ path ]         writes <path> ( default tlsf_churn.trace )
+**   tlsf_trace_replay <path>
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+#include "TLSF.hpp"
+#include "TLSFThreadCache.h"
+#include "../MemoryAllocator.h"
+#include "../TracingAllocator.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 256ULL * 1024 * 1024;
+    constexpr size_t LiveCount = 16384;
+    constexpr size_t ChurnOperations = 1 << 21;
+    constexpr size_t Rounds = 3;
+    constexpr size_t ThreadCount = 4;
+    constexpr size_t ThreadOperations = 1 << 18;
+
+    struct Timing {
+        double          wall;           // ns per op ( one free or one alloc )
+        double          cpu;            // of the calling thread
+    };
+
+    double threadCpuNanoseconds() {
+#if defined(_WIN32)
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+#endif
+    }
+
+    template< class Allocator >
+    Timing churn( Allocator& allocator, size_t liveCount, size_t operations, unsigned seed ) {
+        std::default_random_engine randEngine(seed);
+        std::uniform_int_distribution<size_t> sizeRange(16, 2048);
+        std::uniform_int_distribution<size_t> slotRange(0, liveCount - 1);
+        std::vector<void*> live(liveCount);
+        std::vector<uint32_t> sizes(operations);
+        std::vector<uint32_t> slots(operations);
+        for( size_t i = 0; i < operations; ++i ) {
+            sizes[i] = (uint32_t)sizeRange(randEngine);
+            slots[i] = (uint32_t)slotRange(randEngine);
+        }
+        for( auto& ptr : live ) {
+            ptr = allocator.alloc(sizeRange(randEngine));
+        }
+        auto start = std::chrono::steady_clock::now();
+        double cpuStart = threadCpuNanoseconds();
+        for( size_t i = 0; i < operations; ++i ) {
+            void*& ptr = live[slots[i]];
+            if(i & 7) {
+                allocator.free(ptr);
+                ptr = allocator.alloc(sizes[i]);
+            }
+            else {
+                ptr = allocator.realloc(ptr, sizes[i]);
+            }
+        }
+        double cpuNanoseconds = threadCpuNanoseconds() - cpuStart;
+        double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        for( void* ptr : live ) {
+            allocator.free(ptr);
+        }
+        Timing timing;
+        timing.wall = nanoseconds / (operations / 8 * 15);
+        timing.cpu = cpuNanoseconds / (operations / 8 * 15);
+        return timing;
+    }
+
+    template< class Allocator >
+    void attach( Allocator&, ugi::TLSFTraceWriter* ) {
+    }
+
+    template< class AllocatorType >
+    void attach( ugi::TracingAllocator<AllocatorType>& allocator, ugi::TLSFTraceWriter* trace ) {
+        allocator.setTraceWriter(trace);
+    }
+
+    // best of `Rounds`
+    template< class Allocator >
+    Timing measure( ugi::TLSFTraceWriter* trace ) {
+        Timing best = { 0.0, 0.0 };
+        for( size_t round = 0; round < Rounds; ++round ) {
+            ugi::TLSFPool pool = ugi::TLSFPool::createPool(PoolSize);
+            Timing timing;
+            {
+                Allocator allocator;
+                allocator.initialize(pool);
+                attach(allocator, trace);
+                timing = churn(allocator, LiveCount, ChurnOperations, 5);
+            }
+            ugi::TLSFPool::destroyPool(pool);
+            best.wall = !round || timing.wall < best.wall ? timing.wall : best.wall;
+            best.cpu = !round || timing.cpu < best.cpu ? timing.cpu : best.cpu;
+        }
+        return best;
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    std::string path = argc > 1 ? argv[1] : "tlsf_churn.trace";
+    {
+        ugi::TLSFTraceWriter trace;
+        if(!trace.open(path.c_str(), Rounds * ChurnOperations * 2)) {
+            printf("cannot create %s\n", path.c_str());
+            return 1;
+        }
+        Timing plain = measure<ugi::MemoryAllocator<ugi::TLSF>>(nullptr);
+        Timing detached = measure<ugi::TracingAllocator<ugi::TLSF>>(nullptr);
+        Timing recorded = measure<ugi::TracingAllocator<ugi::TLSF>>(&trace);
+        printf("%-14s : %8s %8s   ns / op\n", "", "wall", "cpu");
+        printf("%-14s : %8.1f %8.1f\n", "not recorded", plain.wall, plain.cpu);
+        printf("%-14s : %8.1f %8.1f\n", "no writer", detached.wall, detached.cpu);
+        printf("%-14s : %8.1f %8.1f\n", "recorded", recorded.wall, recorded.cpu);
+        printf("%-14s : %+8.1f %+8.1f\n", "overhead", recorded.wall - plain.wall, recorded.cpu - plain.cpu);
+    }
+    ugi::TLSFTraceWriter trace;
+    trace.open(path.c_str());
+    ugi::TracingAllocator<ugi::TLSFThreadCache<ugi::TLSF>> allocator;
+    allocator.initialize(ugi::TLSFPool::createPool(PoolSize));
+    allocator.setTraceWriter(&trace);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for( size_t i = 0; i < ThreadCount; ++i ) {
+        threads.emplace_back([&allocator, i]() {
+            churn(allocator, LiveCount / ThreadCount, ThreadOperations, (unsigned)(100 + i));
+        });
+    }
+    for( auto& thread : threads ) {
+        thread.join();
+    }
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    allocator.setTraceWriter(nullptr);
+    trace.close();
+    printf("%zu threads    : %.1f ms recorded into %s\n", ThreadCount, milliseconds, path.c_str());
+    return 0;
+}
@@ -0,0 +1,112 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Compile-time variants of TLSFBasic side by side.
+**
+**   default  : TLSFBasic<5, 16, 31>, 32 segments per first level
+**   fine     : TLSFBasic<6, 16, 31>, 64 segments and 64-bit second level bitmaps
+**   embedded : TLSFBasic<4, 16, 20>, 16 segments, pools below 1 MB
+**   compact  : TLSFCompact, one word block headers, 8 byte granularity
+**
+** For each one : size of the control block, internal fragmentation
+** ( rounded level size / requested size for random requests ), utilization
+** when a fixed pool refuses, and ns per alloc/free pair of a random churn.
+** The last column is how many 24 byte objects fit into the pool, where the
+** block header overhead dominates.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+
+namespace {
+
+    constexpr size_t PoolSize = 768 * 1024;
+    constexpr size_t MaxRequest = 8 * 1024;
+    constexpr size_t ChurnOperations = 1 << 20;
+
+    template< class HeapType >
+    void measure( const char* name ) {
+        HeapType* heap = new HeapType();
+        // internal fragmentation of the alloc mapping
+        std::default_random_engine randEngine(11);
+        std::uniform_int_distribution<size_t> sizeRange(1, MaxRequest);
+        double requested = 0.0;
+        double rounded = 0.0;
+        for( size_t i = 0; i < 100000; ++i ) {
+            size_t size = sizeRange(randEngine);
+            requested += (double)size;
+            rounded += (double)heap->queryAlignedLevelSize(size);
+        }
+        // fill until refused
+        heap->initialize(ugi::TLSFPool::createPool(PoolSize));
+        std::vector<void*> live;
+        size_t liveBytes = 0;
+        for(;;) {
+            size_t size = sizeRange(randEngine);
+            void* ptr = heap->alloc(size);
+            if(!ptr) {
+                break;
+            }
+            live.push_back(ptr);
+            liveBytes += size;
+        }
+        double utilization = 100.0 * liveBytes / PoolSize;
+        size_t smallObjects = 0;
+        {
+            HeapType smallHeap;
+            smallHeap.initialize(ugi::TLSFPool::createPool(PoolSize));
+            while( smallHeap.alloc(24) ) {
+                ++smallObjects;
+            }
+        }
+        // random churn on a half full heap
+        std::shuffle(live.begin(), live.end(), randEngine);
+        for( size_t i = live.size() / 2; i < live.size(); ++i ) {
+            heap->free(live[i]);
+        }
+        live.resize(live.size() / 2);
+        std::uniform_int_distribution<size_t> slotRange(0, live.size() - 1);
+        size_t pairs = 0;
+        auto start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < ChurnOperations; ++i ) {
+            size_t slot = slotRange(randEngine);
+            heap->free(live[slot]);
+            live[slot] = heap->alloc(sizeRange(randEngine));
+            if(!live[slot]) {
+                live[slot] = heap->alloc(16);
+            }
+            ++pairs;
+        }
+        auto end = std::chrono::steady_clock::now();
+        double nanoseconds = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        for( void* ptr : live ) {
+            heap->free(ptr);
+        }
+        printf("%-10s %6zu %4zu %4zu %12zu %9.2f%% %11.1f%% %10.1f %10zu\n", name, HeapType::SLC, HeapType::FLC,
+            sizeof(typename HeapType::SecondLevelBitmap) * 8, sizeof(HeapType),
+            100.0 * (rounded - requested) / requested, utilization, nanoseconds / pairs, smallObjects);
+        delete heap;
+    }
+
+}
+
+int main() {
+    printf("%-10s %6s %4s %4s %12s %10s %12s %10s %10s\n", "variant", "SLC", "FLC", "bits", "control ( B )", "internal", "utilization", "ns / pair", "24 B objs");
+    measure<ugi::TLSFBasic<5, 16, 31>>("default");
+    measure<ugi::TLSFBasic<6, 16, 31>>("fine");
+    measure<ugi::TLSFBasic<4, 16, 20>>("embedded");
+    measure<ugi::TLSFCompact>("compact");
+    return 0;
+}
@@ -0,0 +1,103 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Heap verification cost.
+**
+** `PoolCount` pools are filled with random blocks and half of them freed.
+** Then the whole heap is verified at once, on one thread and with one
+** thread per pool, and incrementally : a churn step between every
+** verifyStep( budget ) call, which shows the pause of one slice and how many
+** slices a full pass over the live heap takes.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "TLSF.hpp"
+#include "TLSFVerify.h"
+
+namespace {
+
+    constexpr size_t PoolSize = 64ULL * 1024 * 1024;
+    constexpr size_t PoolCount = 8;
+    constexpr size_t SliceCalls = 1 << 16;
+
+    double elapsedMicroseconds( std::chrono::steady_clock::time_point start ) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    }
+
+}
+
+int main() {
+    ugi::TLSF tlsf;
+    std::vector<ugi::TLSFPool> pools;
+    for( size_t i = 0; i < PoolCount; ++i ) {
+        pools.push_back(ugi::TLSFPool::createPool(PoolSize));
+        tlsf.initialize(pools.back());
+    }
+    std::default_random_engine randEngine(29);
+    std::uniform_int_distribution<size_t> sizeRange(16, 4096);
+    std::vector<void*> live;
+    for(;;) {
+        void* ptr = tlsf.alloc(sizeRange(randEngine));
+        if(!ptr) {
+            break;
+        }
+        live.push_back(ptr);
+    }
+    std::shuffle(live.begin(), live.end(), randEngine);
+    for( size_t i = live.size() / 2; i < live.size(); ++i ) {
+        tlsf.free(live[i]);
+    }
+    live.resize(live.size() / 2);
+
+    size_t threadCounts[] = { 1, PoolCount };
+    for( size_t threadCount : threadCounts ) {
+        auto start = std::chrono::steady_clock::now();
+        ugi::TLSFVerifyResult result = ugi::tlsf_verify_heap(tlsf, threadCount);
+        double microseconds = elapsedMicroseconds(start);
+        printf("full, %zu thread%s : %10.1f us, %zu blocks / nodes / bins, %s\n", threadCount, threadCount > 1 ? "s" : " ",
+            microseconds, result.checked, result.ok() ? "ok" : result.error);
+    }
+    printf("( %u hardware threads )\n\n", std::thread::hardware_concurrency());
+
+    printf("%8s %12s %12s %14s %8s\n", "budget", "avg us", "max us", "slices / pass", "errors");
+    size_t budgets[] = { 64, 256, 1024, 4096 };
+    for( size_t budget : budgets ) {
+        double total = 0.0;
+        double longest = 0.0;
+        size_t passes = 0;
+        size_t errors = 0;
+        for( size_t call = 0; call < SliceCalls; ++call ) {
+            size_t slot = randEngine() % live.size();
+            tlsf.free(live[slot]);
+            live[slot] = tlsf.alloc(sizeRange(randEngine));
+            auto start = std::chrono::steady_clock::now();
+            ugi::TLSFVerifyResult result = tlsf.verifyStep(budget);
+            double microseconds = elapsedMicroseconds(start);
+            total += microseconds;
+            longest = microseconds > longest ? microseconds : longest;
+            passes += result.passCompleted ? 1 : 0;
+            errors += result.ok() ? 0 : 1;
+        }
+        printf("%8zu %12.2f %12.2f %14.0f %8zu\n", budget, total / SliceCalls, longest, passes ? (double)SliceCalls / passes : 0.0, errors);
+    }
+    for( void* ptr : live ) {
+        tlsf.free(ptr);
+    }
+    for( auto& pool : pools ) {
+        ugi::TLSFPool::destroyPool(pool);
+    }
+    return 0;
+}
@@ -21,8 +21,13 @@ if( ANDROID )
     find_library( log log )
     find_library( android android )
 elseif( CMAKE_HOST_SYSTEM_NAME STREQUAL "Linux")
-    set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -std=c++11 -fdeclspec -g -Wall -pthread")
-    set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -g -fdeclspec -pthread")
+    set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -std=c++11 -g -Wall -pthread")
+    set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -g -pthread")
+    if( CMAKE_CXX_COMPILER_ID STREQUAL "Clang" )
+        # -fdeclspec is clang only, gcc refuses it
+        set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -fdeclspec")
+        set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -fdeclspec")
+    endif()
 elseif( APPLE )
     if( IOS )
         set( TARGET_ARCH iOS )                 # iOS platform
@@ -12,13 +12,22 @@
 #include <cassert>
 #include <cstdio>
 #include <cmath>
+#include <new>
 #include <utility>
+#include <algorithm>
+#include <type_traits>
 
 #include "fls.h"
 #include "TLSFUtility.h"
 
 #define TLSF_DEBUG_ASSERT 0
 
+// 统计计数器，定义成 0 的话计数器和维护它们的代码都不会编译进来
+// ( 所有包含 TLSF.hpp 的翻译单元要一致，TLSF.cpp 里有显式实例化 )
+#ifndef TLSF_ENABLE_STATS
+#define TLSF_ENABLE_STATS 1
+#endif
+
 namespace ugi {
 	// 本来是写了这么个函数求first level，但是还是用平台特定指令会更快，c/c++又不提供
 	// 只能从操作系统层面去拿API了（汇编指令）
@@ -31,15 +40,80 @@ namespace ugi {
         return i;
     }
 
-    class TLSF {
+    constexpr uint32_t tlsf_log2( size_t num ) {
+        return num > 1 ? 1 + tlsf_log2(num >> 1) : 0;
+    }
+
+    // smallest unsigned word holding `Bits` bits, 32 or 64
+    template< size_t Bits >
+    struct TLSFBitmapWord {
+        static_assert(Bits <= 64, "bitmaps are at most 64 bits wide");
+        typedef typename std::conditional<(Bits <= 32), uint32_t, uint64_t>::type type;
+    };
+
+    inline int tlsf_bitmap_ffs( uint32_t word ) {
+        return tlsf_ffs(word);
+    }
+
+    inline int tlsf_bitmap_ffs( uint64_t word ) {
+        return tlsf_ffs64(word);
+    }
+
+    inline int tlsf_bitmap_fls( uint32_t word ) {
+        return tlsf_fls(word);
+    }
+
+    inline int tlsf_bitmap_fls( uint64_t word ) {
+        return tlsf_fls64(word);
+    }
+
+    /*
+    ** SLIBits     : second level index bit count, SLC = 1 << SLIBits segments per first level
+    **               ( 6 gives 64 segments and a 64-bit second level bitmap )
+    ** MinBlock    : minimium allocation size and first level granularity, a power of two >= HeaderType::Alignment
+    **               ( pointers are always HeaderType::Alignment aligned )
+    ** MaxPoolLog2 : pools must be smaller than 2^MaxPoolLog2 bytes, decides the first level count
+    **               ( above 31 the first level bitmap becomes 64 bits wide, see TLSF64 )
+    ** HeaderType  : block header layout, AllocHeader ( 16 bytes ) or CompactAllocHeader ( one word )
+    ** Everything below is derived at compile time, no per-instance level math.
+    */
+    template< size_t SLIBits = 5, size_t MinBlock = 16, size_t MaxPoolLog2 = 31, class HeaderType = AllocHeader >
+    class TLSFBasic {
     public:
-        constexpr static size_t MinimiumAllocationSize = 16;                                // 
-        constexpr static size_t FLC = sizeof(uint32_t) * 8 - 1;
-        constexpr static size_t SLI = 5;                                                    // second level index
-        constexpr static size_t SLC = 1 << SLI;                                             // 每一级分多少个区间
+        typedef HeaderType AllocHeader;
+        constexpr static size_t MinimiumAllocationSize = MinBlock;                          // minimium allocation size
+        constexpr static size_t SLI = SLIBits;                                              // second level index
+        constexpr static size_t SLC = (size_t)1 << SLI;                                     // 每一级分多少个区间
         constexpr static size_t FLM = MinimiumAllocationSize<<SLI;                          // first level max
-        uint32_t BasePowLevel = tlsf_fls_sizet(FLM);
-        //
+        constexpr static uint32_t BasePowLevel = tlsf_log2(FLM);
+        constexpr static size_t FLC = MaxPoolLog2 - BasePowLevel + 1;                       // first level count
+        constexpr static size_t MaxPoolCapacity = (size_t)1 << MaxPoolLog2;
+        // 最小的块，空闲的时候要放得下块头要求的东西（链表指针，footer），按 MinBlock 取整
+        constexpr static size_t MinimumBlockSize = (AllocHeader::MinimumFreeSize + MinBlock - 1) & ~(MinBlock - 1);
+        typedef typename TLSFBitmapWord<FLC>::type FirstLevelBitmap;
+        typedef typename TLSFBitmapWord<SLC>::type SecondLevelBitmap;
+
+        static_assert(MinBlock >= AllocHeader::Alignment && !(MinBlock & (MinBlock - 1)), "MinBlock must be a power of two, at least AllocHeader::Alignment");
+        static_assert(MaxPoolLog2 > BasePowLevel, "pools must be able to hold more than one first level");
+        static_assert(MaxPoolLog2 <= AllocHeader::SizeBits, "AllocHeader::size is too narrow for MaxPoolLog2");
+
+        // getStats() 的结果，都是增量维护的，不用遍历堆。
+        // TLSF_ENABLE_STATS 为 0 的时候只有 largestFreeBlock（它是从 bitmap 直接算的）和 purge 的两个计数有值
+        struct Stats {
+            size_t      poolBytes;              // pool 里可以放块的字节数（包括块头）
+            size_t      bytesInUse;             // 已分配块的大小之和，不含块头
+            size_t      peakBytesInUse;
+            size_t      usedBlocks;
+            size_t      freeBlocks;
+            size_t      freeBytes;              // 空闲块的大小之和，不含块头
+            size_t      largestFreeBlock;       // 下限：最高的非空 bin 能放的最小块，最多比真实值小一个 segment
+            uint64_t    splitCount;             // 一个块切成两个的次数
+            uint64_t    mergeCount;             // 两个相邻的块合成一个的次数
+            uint64_t    failedAllocations;      // alloc / allocAligned / realloc 返回空，allocBatch 没分配够
+            size_t      purgedBytes;            // 交给 madvise 还给系统的字节数，trim() 会把还过的页再交一次
+            uint64_t    purgeCalls;             // madvise 的次数
+            TLSFArray< TLSFArray<uint32_t, SLC>, FLC> freeBlocksPerBin;   // 每个 [first level][second level] 链表的长度
+        };
     private:
         struct BitmapLevel{
             union {
@@ -59,19 +133,98 @@ namespace ugi {
                 : firstLevel(f), secondLevel(s)
             {}
         };
+        // verifyStep 的进度，先按地址走完每个 pool 的物理块链，再走每个 bin 的空闲链表
+        struct VerifyCursor {
+            const void*     poolBase;       // 正在检查的 pool，nullptr 表示还没开始
+            AllocHeader*    block;          // 下一个要检查的物理块，nullptr 表示这个 pool 查完了
+            bool            inFreeLists;
+            size_t          bin;            // firstLevel * SLC + secondLevel
+            AllocHeader*    node;           // bin 里下一个要检查的节点，nullptr 表示这个 bin 查完了
+        };
+        // 等着还给系统的空闲大块，按变成空闲的先后排队
+        struct PurgeCandidate {
+            AllocHeader*    block;          // 已经被分配或者合并掉了就是 nullptr
+            uint64_t        freeSince;      // 插入空闲链表时的 _purgeClock
+        };
+        // 空闲块里可能被写过（还没还给系统）的地址范围，begin == end 表示干净
+        struct PurgeRange {
+            uintptr_t       begin;
+            uintptr_t       end;
+            void extend( const PurgeRange& other ) {
+                if(other.begin >= other.end) {
+                    return;
+                }
+                if(begin >= end) {
+                    *this = other;
+                } else {
+                    begin = std::min(begin, other.begin);
+                    end = std::max(end, other.end);
+                }
+            }
+        };
+        // 空闲大块在链表指针后面记的东西，这几个字所在的页不还给系统
+        struct PurgeStamp {
+            uint64_t        sequence;       // 在 _purgeQueue 里的序号
+            PurgeRange      dirty;
+        };
+        constexpr static size_t PurgeQueueSize = 128;
     private:
-        uint32_t                                            _firstLevelBitmap;      // 4GB * 16 = 64 GB Maximium
-        TLSFArray<uint32_t, 31>                             _secondLevelBitmap;     //
-        TLSFArray< TLSFArray<AllocHeader*, SLC>, 31>        _allocationLinkTable;   //
-        TLSFVector<TLSFPool>                                _memoryPools;
+        FirstLevelBitmap                                    _firstLevelBitmap;      //
+        TLSFArray<SecondLevelBitmap, FLC>                   _secondLevelBitmap;     //
+        TLSFArray< TLSFArray<typename AllocHeader::Link, SLC>, FLC> _allocationLinkTable; //
+        TLSFPoolRegistry                                    _memoryPools;
+        TLSFPoolProvider*                                   _poolProvider;          // growth mode if not null
+        size_t                                              _retainedFreePools;     // unused provider pools kept before retiring
+        VerifyCursor                                        _verifyCursor;          // 合并块、摘链表节点、回收 pool 的时候会跟着修正
+        size_t                                              _purgeThreshold;        // 不小于这个大小的空闲块才还给系统，0 表示不还
+        uint64_t                                            _purgeDecay;            // 空闲链表插入这么多次以后块还没被用掉才还
+        TLSFPurgeAdvice                                     _purgeAdvice;
+        uint64_t                                            _purgeClock;            // 空闲链表插入的次数
+        uint64_t                                            _purgeHead;             // 队列里最早的候选的序号
+        uint64_t                                            _purgeTail;             // 下一个候选的序号，块里记着自己的序号
+        PurgeRange                                          _purgeCarry;            // 最近一个摘下的空闲块的脏范围，交给它切剩下或者合并成的块
+        TLSFArray<PurgeCandidate, PurgeQueueSize>           _purgeQueue;
+        size_t                                              _purgedBytes;
+        uint64_t                                            _purgeCalls;
+#if TLSF_ENABLE_STATS
+        Stats                                               _stats;                 // bytesInUse / largestFreeBlock 在 getStats() 里算
+#endif
     public:
-        TLSF()
+        TLSFBasic()
             : _firstLevelBitmap(0)
             , _secondLevelBitmap{}
             , _allocationLinkTable{}
-            , _memoryPools{4}
+            , _memoryPools()
+            , _poolProvider(nullptr)
+            , _retainedFreePools(0)
+            , _verifyCursor{}
+            , _purgeThreshold(0)
+            , _purgeDecay(0)
+            , _purgeAdvice(TLSFPurgeAdvice::DontNeed)
+            , _purgeClock(0)
+            , _purgeHead(0)
+            , _purgeTail(0)
+            , _purgeCarry{}
+            , _purgeQueue{}
+            , _purgedBytes(0)
+            , _purgeCalls(0)
+#if TLSF_ENABLE_STATS
+            , _stats{}
+#endif
         {}
 
+        ~TLSFBasic() {
+            if(!_poolProvider) {
+                return;
+            }
+            for( const auto& pool : _memoryPools ) {
+                if(pool.retirable()) {
+                    TLSFPool retired(pool);
+                    _poolProvider->releasePool(retired);
+                }
+            }
+        }
+
         // 每一级可以分配一定范围的大小，所以里面所有的块
         BitmapLevel queryBitmapLevelForAlloc(size_t size) {
             BitmapLevel level;
@@ -102,7 +255,7 @@ namespace ugi {
             }
         }
 
-        BitmapLevel queryBitmapLevelForInsert(size_t size) {
+        BitmapLevel queryBitmapLevelForInsert(size_t size) const {
             BitmapLevel level;
             if (size <= FLM) {
                 level.firstLevel = 0;
@@ -146,10 +299,10 @@ namespace ugi {
 
         //  看这个级别是不是有空闲块
         inline bool queryFreeStatus( BitmapLevel level ) {
-            if( !_firstLevelBitmap & (1<<level.firstLevel) ) {
+            if( !(_firstLevelBitmap & ((FirstLevelBitmap)1<<level.firstLevel)) ) {
                 return false;
             }
-            uint32_t rst = _secondLevelBitmap[level.firstLevel] & (1<<level.secondLevel);
+            SecondLevelBitmap rst = _secondLevelBitmap[level.firstLevel] & ((SecondLevelBitmap)1<<level.secondLevel);
             if(rst != 0) {
                 return true;
             }
@@ -157,7 +310,16 @@ namespace ugi {
         }
         // 
         AllocHeader* queryFreeAllocation( size_t size ) {
+            if( size >= MaxPoolCapacity ) {
+                return nullptr; // 比任何 pool 都大，也避免下面取整的时候溢出
+            }
+            if( size < MinimumBlockSize ) {
+                size = MinimumBlockSize;
+            }
             BitmapLevel level = queryBitmapLevelForAlloc(size);
+            if( level.firstLevel >= FLC ) {
+                return nullptr; // 超出了最大的 first level，哪个 pool 都放不下
+            }
             if(queryFreeStatus(level)) { // 恰好有空间块可以分配
                 auto allocation = queryAllocationWithFreeLevel(level);
                 return allocation;
@@ -178,21 +340,94 @@ namespace ugi {
             }
         }
 
+        // 找一个至少 size 大的空闲块，从链表里取下来，不分割
+        inline AllocHeader* takeFreeBlock( size_t size ) {
+            if( size >= MaxPoolCapacity ) {
+                return nullptr;
+            }
+            BitmapLevel level = findLevelForSplit(queryBitmapLevelForAlloc(size));
+            if(!level.valid()) {
+                return nullptr;
+            }
+            return queryAllocationWithFreeLevel(level);
+        }
+
+        // 最高的非空 level 里的第一个块，不小于 minimumSize 的话取下来
+        inline AllocHeader* takeLargestFreeBlock( size_t minimumSize ) {
+            if(!_firstLevelBitmap) {
+                return nullptr;
+            }
+            BitmapLevel level;
+            level.firstLevel = (uint16_t)tlsf_bitmap_fls(_firstLevelBitmap);
+            level.secondLevel = (uint16_t)tlsf_bitmap_fls(_secondLevelBitmap[level.firstLevel]);
+            if(_allocationLinkTable[level.firstLevel][level.secondLevel]->blockSize() < minimumSize) {
+                return nullptr;
+            }
+            return queryAllocationWithFreeLevel(level);
+        }
+
+        // 把一个取下来的空闲块连续切成最多 count 个 blockSize 大小的已分配块，剩下的一次性插回去
+        size_t carveAllocations( AllocHeader* block, size_t blockSize, size_t count, void** out ) {
+            const TLSFPool* pool = locatePool(block);
+            size_t totalSize = block->blockSize();
+            size_t stride = blockSize + AllocHeader::TrueSize;
+            size_t carved = (totalSize + AllocHeader::TrueSize) / stride;
+            if(carved > count) {
+                carved = count;
+            }
+            AllocHeader* allocation = block;
+            allocation->setFree(false);
+            allocation->setBlockSize(blockSize);
+            out[0] = allocation->ptr();
+            for( size_t i = 1; i < carved; ++i ) {
+                AllocHeader* prevAlloc = allocation;
+                allocation = (AllocHeader*)((uint8_t*)prevAlloc->ptr() + blockSize);
+                allocation->setBlockSize(blockSize);
+                allocation->setFree(false);
+                allocation->setPrevPhysical(prevAlloc);
+                out[i] = allocation->ptr();
+            }
+            size_t leftSize = totalSize + AllocHeader::TrueSize - carved * stride;
+            AllocHeader* lastAlloc = allocation;
+            countSplits(carved - 1);
+            if(leftSize >= AllocHeader::TrueSize + MinimumBlockSize) {
+                countSplits(1);
+                AllocHeader* restAlloc = (AllocHeader*)((uint8_t*)lastAlloc->ptr() + blockSize);
+                restAlloc->setBlockSize(leftSize - AllocHeader::TrueSize);
+                restAlloc->setFree(true);
+                restAlloc->setPrevPhysical(lastAlloc);
+                lastAlloc = restAlloc;
+                insertFreeAllocation(restAlloc); // 原来的块是空闲的，前后都不可能是空闲块，不用合并
+            } else {
+                lastAlloc->setBlockSize(blockSize + leftSize);
+            }
+            AllocHeader* nextAlloc = lastAlloc->nextPhyAllocation();
+            if(pool->check_next_contains(nextAlloc)) {
+                nextAlloc->setPrevPhysical(lastAlloc);
+            }
+            return carved;
+        }
+
         inline BitmapLevel findLevelForSplit( BitmapLevel baseLevel ) {
-            
-            for( uint16_t firstLevel = baseLevel.firstLevel; firstLevel < FLC; ++firstLevel) {
-                if(!(_firstLevelBitmap&(1<<firstLevel))) {
-                    baseLevel.secondLevel = 0;
-                    continue;
+            // 两步查找：先在当前 first level 里找不小于 secondLevel 的空闲块，
+            // 找不到再去更高的 first level 里取最低的那个，都是 ffs 一条指令搞定
+            uint32_t firstLevel = baseLevel.firstLevel;
+            if( firstLevel >= FLC ) {
+                return BitmapLevel();
+            }
+            SecondLevelBitmap secondLevelMap = _secondLevelBitmap[firstLevel] & (~(SecondLevelBitmap)0 << baseLevel.secondLevel);
+            if(!secondLevelMap) {
+                if( firstLevel + 1 >= FLC ) {
+                    return BitmapLevel();
                 }
-                for( uint16_t secondLevel = baseLevel.secondLevel; secondLevel<SLC; ++secondLevel) {
-                    BitmapLevel acquiredLevel = {firstLevel, secondLevel};
-                    if(queryFreeStatus(acquiredLevel)) {
-                        return acquiredLevel;
-                    }
+                FirstLevelBitmap firstLevelMap = _firstLevelBitmap & (~(FirstLevelBitmap)0 << (firstLevel + 1));
+                if(!firstLevelMap) {
+                    return BitmapLevel();
                 }
+                firstLevel = tlsf_bitmap_ffs(firstLevelMap);
+                secondLevelMap = _secondLevelBitmap[firstLevel];
             }
-            return BitmapLevel();
+            return BitmapLevel( (uint16_t)firstLevel, (uint16_t)tlsf_bitmap_ffs(secondLevelMap) );
         }
 
         // 给定一个bitmap level（确信它一定有空闲块），
@@ -200,29 +435,29 @@ namespace ugi {
         inline AllocHeader* splitAllocation( BitmapLevel level, size_t size ) {
             AllocHeader* targetAlloc  = queryAllocationWithFreeLevel(level);
             assert(targetAlloc && "it must not be nullptr!");
-            assert(targetAlloc->size >= size );
-            removeFreeAllocationAndUpdateBitmap(targetAlloc, level);
-            if(targetAlloc->size - size < AllocHeader::TrueSize + MinimiumAllocationSize) {
+            assert(targetAlloc->blockSize() >= size );
+            if(targetAlloc->blockSize() - size < AllocHeader::TrueSize + MinimumBlockSize) {
                 return targetAlloc; // 剩余的太小了，就不分割了
             }
+            countSplits(1);
             // splited free allocation
             auto nextNextPhyAlloc = targetAlloc->nextPhyAllocation();
             const TLSFPool* pool = locatePool(targetAlloc);
-            size_t splitedSize = targetAlloc->size - size - AllocHeader::TrueSize;
-            targetAlloc->size = size; 
+            size_t splitedSize = targetAlloc->blockSize() - size - AllocHeader::TrueSize;
+            targetAlloc->setBlockSize(size);
             AllocHeader* nextAlloc = targetAlloc->nextPhyAllocation();
             //nextAlloc->initForSplit(splitedSize, targetAlloc);
-            nextAlloc->size = splitedSize;
-            nextAlloc->free = 1;
-            nextAlloc->prevPhyAlloc = targetAlloc;
+            nextAlloc->setBlockSize(splitedSize);
+            nextAlloc->setFree(true);
+            nextAlloc->setPrevPhysical(targetAlloc);    // targetAlloc 分配出去的时候 markAllocated 会再更新一次
             // insert the free allocation to list
             if(pool->check_next_contains(nextNextPhyAlloc)) {
-                nextNextPhyAlloc->prevPhyAlloc = nextAlloc;
+                nextNextPhyAlloc->setPrevPhysical(nextAlloc);
             }
             insertFreeAllocation(nextAlloc);
             #if TLSF_DEBUG_ASSERT
             if(pool->check_next_contains(nextNextPhyAlloc)) {
-                assert( nextNextPhyAlloc->prevPhyAlloc == nextAlloc );
+                assert( nextNextPhyAlloc->prevPhysical() == nextAlloc );
                 assert( nextAlloc->nextPhyAllocation() == nextNextPhyAlloc );
             }
             #endif
@@ -230,33 +465,39 @@ namespace ugi {
         }
 
         inline AllocHeader* queryAllocationWithFreeLevel( BitmapLevel level ) {
-            AllocHeader** levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
+            typename AllocHeader::Link* levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
             AllocHeader* originHeader = *levelHeaderPtr;
             assert(originHeader && "it must not be nullptr!");
             AllocHeader* nextFreeAlloc = originHeader->nextFreeAlloc;
+            countFreeListRemove(level, originHeader->blockSize());
+            verifyNodeRemoved(originHeader);
+            purgeCandidateRemoved(originHeader);
             *levelHeaderPtr = nextFreeAlloc;
             if(nextFreeAlloc) {
                 nextFreeAlloc->prevFreeAlloc = nullptr;
             } else {
                 // 如果这一级分配了之后就没有空间的内存块了，那么更新 bitmap
-                _secondLevelBitmap[level.firstLevel] &= ~(1<<level.secondLevel);
+                _secondLevelBitmap[level.firstLevel] &= ~((SecondLevelBitmap)1<<level.secondLevel);
                 if( 0 == _secondLevelBitmap[level.firstLevel]) {
-                    _firstLevelBitmap &= ~(1<<level.firstLevel);
+                    _firstLevelBitmap &= ~((FirstLevelBitmap)1<<level.firstLevel);
                 }
             }
             #if TLSF_DEBUG_ASSERT
-            if(originHeader->prevPhyAlloc) {
-                assert(!originHeader->prevPhyAlloc->free);
+            if(originHeader->prevPhysical()) {
+                assert(!originHeader->prevPhysical()->isFree());
             }
             #endif
             return originHeader;
         }
 
         inline void removeFreeAllocationAndUpdateBitmap( AllocHeader* allocation ) {
-            BitmapLevel level = queryBitmapLevelForInsert(allocation->size);
-            AllocHeader** levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
+            BitmapLevel level = queryBitmapLevelForInsert(allocation->blockSize());
+            typename AllocHeader::Link* levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
             AllocHeader* nextFreeAlloc = allocation->nextFreeAlloc; // could be nullptr
             AllocHeader* prevFreeAlloc = allocation->prevFreeAlloc;
+            countFreeListRemove(level, allocation->blockSize());
+            verifyNodeRemoved(allocation);
+            purgeCandidateRemoved(allocation);
 
             if(prevFreeAlloc) {
                 prevFreeAlloc->nextFreeAlloc = allocation->nextFreeAlloc;
@@ -267,17 +508,20 @@ namespace ugi {
                 nextFreeAlloc->prevFreeAlloc = prevFreeAlloc;
             }
             if( nullptr == *levelHeaderPtr) { // 需要更新bitmap
-                _secondLevelBitmap[level.firstLevel] &= ~(1<<level.secondLevel);
+                _secondLevelBitmap[level.firstLevel] &= ~((SecondLevelBitmap)1<<level.secondLevel);
                 if( 0 == _secondLevelBitmap[level.firstLevel]) {
-                    _firstLevelBitmap &= ~(1<<level.firstLevel);
+                    _firstLevelBitmap &= ~((FirstLevelBitmap)1<<level.firstLevel);
                 }
             }
         }
 
         inline void removeFreeAllocationAndUpdateBitmap( AllocHeader* allocation, BitmapLevel level ) /*pass*/ {
-            AllocHeader** levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
+            typename AllocHeader::Link* levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
             AllocHeader* nextFreeAlloc = allocation->nextFreeAlloc; // could be nullptr
             AllocHeader* prevFreeAlloc = allocation->prevFreeAlloc;
+            countFreeListRemove(level, allocation->blockSize());
+            verifyNodeRemoved(allocation);
+            purgeCandidateRemoved(allocation);
 
             if(prevFreeAlloc) {
                 prevFreeAlloc->nextFreeAlloc = allocation->nextFreeAlloc;
@@ -288,9 +532,9 @@ namespace ugi {
                 nextFreeAlloc->prevFreeAlloc = prevFreeAlloc;
             }
             if( nullptr == *levelHeaderPtr) { // 需要更新bitmap
-                _secondLevelBitmap[level.firstLevel] &= ~(1<<level.secondLevel);
+                _secondLevelBitmap[level.firstLevel] &= ~((SecondLevelBitmap)1<<level.secondLevel);
                 if( 0 == _secondLevelBitmap[level.firstLevel]) {
-                    _firstLevelBitmap &= ~(1<<level.firstLevel);
+                    _firstLevelBitmap &= ~((FirstLevelBitmap)1<<level.firstLevel);
                 }
             }
         }
@@ -300,85 +544,650 @@ namespace ugi {
         // mergeCheck 是因为我们会在两种情况下调用这个方法，一个是回收内存，一个是分割大块剩下一个小块
         inline void insertFreeAllocation( AllocHeader* allocation, bool mergeCheck = false, const TLSFPool* pool = nullptr ) /*pass*/ {
             BitmapLevel level;
+            PurgeRange dirty = _purgeCarry; // 不合并的时候是切剩下的块，脏范围跟着刚摘下来的那个空闲块
             if(mergeCheck) {
                 assert(pool);
-                AllocHeader* prevPhyAlloc = allocation->prevPhyAlloc;
+                AllocHeader* prevPhyAlloc = allocation->prevPhysical();
                 AllocHeader* nextPhyAlloc = allocation->nextPhyAllocation();
+                dirty = PurgeRange{ (uintptr_t)allocation, (uintptr_t)nextPhyAlloc };
                 ///////////////// AllocHeader* mergedAlloc = allocation;
-                if(prevPhyAlloc && prevPhyAlloc->free) {
+                if(prevPhyAlloc && prevPhyAlloc->isFree()) {
                     removeFreeAllocationAndUpdateBitmap(prevPhyAlloc);
-                    prevPhyAlloc->size += (allocation->size + AllocHeader::TrueSize);
+                    dirty.extend(_purgeCarry);
+                    prevPhyAlloc->setBlockSize(prevPhyAlloc->blockSize() + allocation->blockSize() + AllocHeader::TrueSize);
                     allocation = prevPhyAlloc;
+                    countMerges(1);
                 }
                 if(pool->check_next_contains(nextPhyAlloc)) {
-                    if(nextPhyAlloc->free) {
+                    if(nextPhyAlloc->isFree()) {
                         removeFreeAllocationAndUpdateBitmap(nextPhyAlloc);
-                        allocation->size += (nextPhyAlloc->size + AllocHeader::TrueSize);
+                        dirty.extend(_purgeCarry);
+                        allocation->setBlockSize(allocation->blockSize() + nextPhyAlloc->blockSize() + AllocHeader::TrueSize);
+                        countMerges(1);
                         auto nextNextAlloc = nextPhyAlloc->nextPhyAllocation();
                         if(pool->check_next_contains(nextNextAlloc)) {
-                            nextNextAlloc->prevPhyAlloc = allocation;
-                            assert(!nextNextAlloc->free);
+                            nextNextAlloc->setPrevPhysical(allocation);
+                            assert(!nextNextAlloc->isFree());
                             assert(allocation->nextPhyAllocation() == nextNextAlloc);
                         }
                     } else {
-                        nextPhyAlloc->prevPhyAlloc = allocation;
+                        nextPhyAlloc->setPrevPhysical(allocation);
                     }
                 }
+                verifyBlocksMerged(allocation);
                 // 为合并的 allocation 找个位置
                 // allocation = mergedAlloc;
                 #if TLSF_DEBUG_ASSERT
                 auto next = allocation->nextPhyAllocation();
                 if(pool->check_next_contains(next)) {
-                    assert(allocation == next->prevPhyAlloc);
+                    assert(allocation == next->prevPhysical());
                 }
-                auto prev = allocation->prevPhyAlloc;
+                auto prev = allocation->prevPhysical();
                 if(prev) {
                     assert(prev->nextPhyAllocation() == allocation );
                 }
                 #endif
             }
-            level = queryBitmapLevelForInsert(allocation->size);
-            AllocHeader** levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
+            level = queryBitmapLevelForInsert(allocation->blockSize());
+            typename AllocHeader::Link* levelHeaderPtr = &_allocationLinkTable[level.firstLevel][level.secondLevel];
             AllocHeader* originHeader = *levelHeaderPtr;
             *levelHeaderPtr = allocation;
             allocation->nextFreeAlloc = originHeader;
             allocation->prevFreeAlloc = nullptr;
+            countFreeListInsert(level, allocation->blockSize());
             if(!originHeader) { // update bitmap if need
-                _secondLevelBitmap[level.firstLevel] |= 1<<level.secondLevel;
-                _firstLevelBitmap |= 1<<(level.firstLevel);
+                _secondLevelBitmap[level.firstLevel] |= (SecondLevelBitmap)1<<level.secondLevel;
+                _firstLevelBitmap |= (FirstLevelBitmap)1<<(level.firstLevel);
             } else {
                 originHeader->prevFreeAlloc = allocation;
             }
+            if(_purgeThreshold) {
+                purgeCandidateInserted(allocation, dirty);
+            }
         }
-    public:
-        bool initialize( TLSFPool pool ) {
-            size_t capacity = pool.capacity();
+        // 新加的 pool 要比请求的 level size 大出两个 segment，保证它插入的 level 不低于分配的 level
+        bool growPools( size_t size ) {
+            size_t levelSize = queryAlignedLevelSize(size);
+            size_t minimumCapacity = levelSize + (levelSize >> 3) + AllocHeader::FullSize * 2;
+            TLSFPool pool = _poolProvider->acquirePool(minimumCapacity);
+            if(!pool.ptr()) {
+                return false;
+            }
+            pool.setRetirable(true);
+            if(!initialize(pool)) {
+                _poolProvider->releasePool(pool);
+                return false;
+            }
+            return true;
+        }
+
+        // 紧凑块头在 pool 末尾有个哨兵，块只到它前面为止
+        static inline void* poolBlocksEnd( const TLSFPool& pool ) {
+            return (uint8_t*)pool.endPtr() - AllocHeader::PoolTailSize;
+        }
+
+        // 从空闲链表里取出来的块交给用户，紧凑块头还要清掉下一块的 prev-free 标记（下一块至少是哨兵）
+        inline void markAllocated( AllocHeader* allocation ) {
+            allocation->setFree(false);
+            if(AllocHeader::TracksPrevFree) {
+                allocation->nextPhyAllocation()->setPrevPhysical(allocation);
+            }
+        }
+
+        inline bool isPoolUnused( const TLSFPool& pool ) {
+            AllocHeader* allocation = (AllocHeader*)pool.ptr();
+            return allocation->isFree() && (void*)allocation->nextPhyAllocation() == poolBlocksEnd(pool);
+        }
+
+        // 整个 pool 都空闲了，超过保留的数量才还给 provider，避免来回申请释放
+        void retirePoolIfUnused( const TLSFPool* pool ) {
+            if(!isPoolUnused(*pool)) {
+                return;
+            }
+            size_t unusedPools = 0;
+            for( const auto& p : _memoryPools ) {
+                if(p.retirable() && isPoolUnused(p)) {
+                    ++unusedPools;
+                }
+            }
+            if(unusedPools <= _retainedFreePools) {
+                return;
+            }
+            removeFreeAllocationAndUpdateBitmap((AllocHeader*)pool->ptr());
+            countPoolRetired(*pool);
+            if(_verifyCursor.poolBase == pool->ptr()) {
+                _verifyCursor.block = nullptr; // 接着查地址更高的下一个 pool
+            }
+            TLSFPool retired(*pool);
+            _memoryPools.remove(retired.ptr());
+            _poolProvider->releasePool(retired);
+        }
+
+        // 请求大小对齐到 MinBlock，且不小于 MinimumBlockSize
+        static inline size_t roundRequestSize( size_t size ) {
+            return size > MinimumBlockSize ? (size + MinimiumAllocationSize - 1) & ~(MinimiumAllocationSize - 1) : MinimumBlockSize;
+        }
+
+        // 已分配的块只留 size 字节，多出来的够一个最小块就切下来还回去（会和后面的空闲块合并）
+        inline void trimAllocation( AllocHeader* allocation, size_t size, const TLSFPool* pool ) {
+            if(allocation->blockSize() - size < AllocHeader::TrueSize + MinimumBlockSize) {
+                return;
+            }
+            countSplits(1);
+            AllocHeader* tailAlloc = (AllocHeader*)((uint8_t*)allocation->ptr() + size);
+            tailAlloc->setBlockSize(allocation->blockSize() - size - AllocHeader::TrueSize);
+            tailAlloc->setFree(true);
+            allocation->setBlockSize(size);
+            tailAlloc->setPrevPhysical(allocation);
+            insertFreeAllocation(tailAlloc, true, pool);
+        }
+
+        // 只吞并后面的空闲块，不移动数据；size 已经是 roundRequestSize 过的
+        inline bool expandInPlace( AllocHeader* allocation, size_t size, const TLSFPool* pool ) {
+            AllocHeader* nextPhyAlloc = allocation->nextPhyAllocation();
+            if(!pool->check_next_contains(nextPhyAlloc) || !nextPhyAlloc->isFree()) {
+                return false;
+            }
+            size_t mergedSize = allocation->blockSize() + AllocHeader::TrueSize + nextPhyAlloc->blockSize();
+            if(mergedSize < size) {
+                return false;
+            }
+            removeFreeAllocationAndUpdateBitmap(nextPhyAlloc);
+            allocation->setBlockSize(mergedSize);
+            countMerges(1);
+            verifyBlocksMerged(allocation);
+            AllocHeader* nextNextAlloc = allocation->nextPhyAllocation();
+            if(pool->check_next_contains(nextNextAlloc)) {
+                nextNextAlloc->setPrevPhysical(allocation);
+            }
+            trimAllocation(allocation, size, pool);
+            updatePeakUsage();
+            return true;
+        }
+
+        // 前面的空闲块（加上后面的空闲块）够大的话，把数据往前挪过去，返回新的块
+        inline AllocHeader* slideIntoPrevious( AllocHeader* allocation, size_t size, const TLSFPool* pool ) {
+            AllocHeader* prevPhyAlloc = allocation->prevPhysical();
+            if(!prevPhyAlloc || !prevPhyAlloc->isFree()) {
+                return nullptr;
+            }
+            AllocHeader* nextPhyAlloc = allocation->nextPhyAllocation();
+            bool nextFree = pool->check_next_contains(nextPhyAlloc) && nextPhyAlloc->isFree();
+            size_t currentSize = allocation->blockSize();
+            size_t mergedSize = prevPhyAlloc->blockSize() + AllocHeader::TrueSize + currentSize;
+            if(nextFree) {
+                mergedSize += AllocHeader::TrueSize + nextPhyAlloc->blockSize();
+            }
+            if(mergedSize < size) {
+                return nullptr;
+            }
+            removeFreeAllocationAndUpdateBitmap(prevPhyAlloc);
+            if(nextFree) {
+                removeFreeAllocationAndUpdateBitmap(nextPhyAlloc);
+            }
+            // 先挪数据再改块头，源和目标可能重叠，allocation 的块头会被覆盖
+            tlsf_move_memory(prevPhyAlloc->ptr(), allocation->ptr(), currentSize);
+            prevPhyAlloc->setBlockSize(mergedSize);
+            prevPhyAlloc->setFree(false);
+            countMerges(nextFree ? 2 : 1);
+            verifyBlocksMerged(prevPhyAlloc);
+            AllocHeader* nextNextAlloc = prevPhyAlloc->nextPhyAllocation();
+            if(pool->check_next_contains(nextNextAlloc)) {
+                nextNextAlloc->setPrevPhysical(prevPhyAlloc);
+            }
+            trimAllocation(prevPhyAlloc, size, pool);
+            updatePeakUsage();
+            return prevPhyAlloc;
+        }
+
+        // 合并之后被吞掉的块头就不存在了，verifyStep 的游标落在里面的话退回到合并后的块
+        inline void verifyBlocksMerged( AllocHeader* merged ) {
+            if(_verifyCursor.block > merged && _verifyCursor.block < merged->nextPhyAllocation()) {
+                _verifyCursor.block = merged;
+            }
+        }
+
+        // 节点要从空闲链表里摘掉了，游标指着它的话挪到同一个链表的下一个节点
+        inline void verifyNodeRemoved( AllocHeader* node ) {
+            if(_verifyCursor.node == node) {
+                _verifyCursor.node = node->nextFreeAlloc;
+            }
+        }
+
+        static inline PurgeStamp& purgeStamp( AllocHeader* block ) {
+            return *(PurgeStamp*)((uint8_t*)block + AllocHeader::FullSize);
+        }
+
+        // 块离开空闲链表（被分配、被合并、pool 被回收），还在队列里的话作废，它的脏范围记到 _purgeCarry。
+        // 小块没有 PurgeStamp，整块都当成脏的；大块的序号不对的话是没排过队
+        inline void purgeCandidateRemoved( AllocHeader* block ) {
+            if(!_purgeThreshold) {
+                return;
+            }
+            PurgeRange whole{ (uintptr_t)block, (uintptr_t)block->nextPhyAllocation() };
+            if(block->blockSize() < _purgeThreshold) {
+                _purgeCarry = whole;
+                return;
+            }
+            PurgeStamp& stamp = purgeStamp(block);
+            if(stamp.sequence - _purgeHead < _purgeTail - _purgeHead) {
+                PurgeCandidate& candidate = _purgeQueue[stamp.sequence % PurgeQueueSize];
+                if(candidate.block == block) {
+                    candidate.block = nullptr;
+                }
+            }
+            _purgeCarry = PurgeRange{ std::max(stamp.dirty.begin, whole.begin), std::min(stamp.dirty.end, whole.end) };
+        }
+
+        // 每次插入空闲链表都走一下时钟，有脏页的大块排进队列；队列满了就提前还掉最早的那个。
+        // 然后最多还一个过了 decay 的块，不会在一次 free 里做很多次系统调用
+        void purgeCandidateInserted( AllocHeader* block, const PurgeRange& dirty ) {
+            ++_purgeClock;
+            if(block->blockSize() >= _purgeThreshold) {
+                PurgeStamp& stamp = purgeStamp(block);
+                stamp.dirty = PurgeRange{ std::max(dirty.begin, (uintptr_t)block), std::min(dirty.end, (uintptr_t)block->nextPhyAllocation()) };
+                if(stamp.dirty.begin < stamp.dirty.end) {
+                    if(_purgeTail - _purgeHead == PurgeQueueSize) {
+                        PurgeCandidate& oldest = _purgeQueue[_purgeHead++ % PurgeQueueSize];
+                        if(oldest.block) {
+                            purgeBlock(oldest.block, false);
+                        }
+                    }
+                    stamp.sequence = _purgeTail++;
+                    _purgeQueue[stamp.sequence % PurgeQueueSize] = PurgeCandidate{ block, _purgeClock };
+                } else {
+                    stamp.sequence = _purgeHead - 1; // 干净的块不排队
+                }
+            }
+            while(_purgeHead != _purgeTail) {
+                PurgeCandidate& oldest = _purgeQueue[_purgeHead % PurgeQueueSize];
+                if(oldest.block && _purgeClock - oldest.freeSince < _purgeDecay) {
+                    break;
+                }
+                ++_purgeHead;
+                if(oldest.block) {
+                    purgeBlock(oldest.block, false);
+                    break;
+                }
+            }
+        }
+
+        // 把空闲块中间碰到脏范围的整页还给系统（whole 的时候不管脏范围），块头、PurgeStamp 和紧凑块头的
+        // footer 所在的页留着。大页的 pool 按 2 MB 还，免得把大页拆碎；mlock 的 pool 不还
+        size_t purgeBlock( AllocHeader* block, bool whole ) {
+            PurgeStamp& stamp = purgeStamp(block);
+            PurgeRange range = whole ? PurgeRange{ (uintptr_t)block, (uintptr_t)block->nextPhyAllocation() } : stamp.dirty;
+            stamp.dirty = PurgeRange{};
+            const TLSFPool* pool = locatePool(block);
+            if(pool->flags() & TLSFPoolLocked) {
+                return 0;
+            }
+            uintptr_t granule = (pool->flags() & (TLSFPoolHugePages | TLSFPoolHugetlb)) ? TLSFHugePageSize : tlsf_page_size();
+            uintptr_t begin = std::max(((uintptr_t)(&stamp + 1) + granule - 1) & ~(granule - 1), range.begin & ~(granule - 1));
+            uintptr_t end = std::min(((uintptr_t)block->nextPhyAllocation() - sizeof(void*)) & ~(granule - 1), (range.end + granule - 1) & ~(granule - 1));
+            if(end <= begin || !tlsf_purge_pages((void*)begin, end - begin, _purgeAdvice)) {
+                return 0;
+            }
+            _purgedBytes += end - begin;
+            ++_purgeCalls;
+            return end - begin;
+        }
+
+        inline bool inPools( const void* ptr ) const {
+            return _memoryPools.locate(ptr) != nullptr;
+        }
+
+        static inline bool verifyFailed( TLSFVerifyResult& result, const char* error, const void* block ) {
+            result.error = error;
+            result.block = block;
+            return false;
+        }
+
+        // 物理块链上的一个块：大小、前后链接、不能有相邻的空闲块，空闲块要挂在它该在的链表上。
+        // 返回下一个要查的块，pool 查完了或者出错了返回 nullptr
+        AllocHeader* verifyBlock( const TLSFPool& pool, AllocHeader* block, TLSFVerifyResult& result ) const {
+            ++result.checked;
+            uint8_t* end = (uint8_t*)poolBlocksEnd(pool);
+            if((uintptr_t)block->ptr() & (AllocHeader::Alignment - 1)) {
+                verifyFailed(result, "misaligned block header", block);
+                return nullptr;
+            }
+            if(block == pool.ptr() && block->prevPhysical()) {
+                verifyFailed(result, "first block of a pool has a previous block", block);
+                return nullptr;
+            }
+            size_t size = block->blockSize();
+            if(size < MinimumBlockSize || size > (size_t)(end - (uint8_t*)block->ptr())) {
+                verifyFailed(result, "block size out of bounds", block);
+                return nullptr;
+            }
+            AllocHeader* next = block->nextPhyAllocation();
+            if(AllocHeader::PoolTailSize || (uint8_t*)next < end) {
+                AllocHeader* expected = !AllocHeader::TracksPrevFree || block->isFree() ? block : nullptr;
+                if(next->prevPhysical() != expected) {
+                    verifyFailed(result, "next block does not link back", block);
+                    return nullptr;
+                }
+            }
+            if((uint8_t*)next < end && block->isFree() && next->isFree()) {
+                verifyFailed(result, "adjacent free blocks", block);
+                return nullptr;
+            }
+            if(block->isFree()) {
+                BitmapLevel level = queryBitmapLevelForInsert(size);
+                AllocHeader* prevFree = block->prevFreeAlloc;
+                AllocHeader* nextFree = block->nextFreeAlloc;
+                bool linked = prevFree ? inPools(prevFree) && prevFree->nextFreeAlloc == block : _allocationLinkTable[level.firstLevel][level.secondLevel] == block;
+                linked = linked && (!nextFree || (inPools(nextFree) && nextFree->prevFreeAlloc == block));
+                if(!linked || !(_secondLevelBitmap[level.firstLevel] & ((SecondLevelBitmap)1 << level.secondLevel))) {
+                    verifyFailed(result, "free block is not on its free list", block);
+                    return nullptr;
+                }
+            }
+            if((uint8_t*)next == end) {
+                if(AllocHeader::PoolTailSize && (next->blockSize() || next->isFree())) {
+                    verifyFailed(result, "pool sentinel overwritten", next);
+                }
+                return nullptr;
+            }
+            return next;
+        }
+
+        // 一个 bin 的 bitmap 位要和链表是否为空一致，second level 的第 0 个 bin 顺便查 first level 的位
+        bool verifyBin( size_t bin, TLSFVerifyResult& result ) const {
+            ++result.checked;
+            size_t firstLevel = bin / SLC;
+            size_t secondLevel = bin % SLC;
+            bool listed = _allocationLinkTable[firstLevel][secondLevel] != nullptr;
+            bool marked = (_secondLevelBitmap[firstLevel] >> secondLevel) & 1;
+            if(listed != marked) {
+                return verifyFailed(result, "bitmap disagrees with free list", _allocationLinkTable[firstLevel][secondLevel]);
+            }
+            if(!secondLevel && ((_firstLevelBitmap >> firstLevel) & 1) != (_secondLevelBitmap[firstLevel] != 0)) {
+                return verifyFailed(result, "first level bitmap disagrees with second level", nullptr);
+            }
+            return true;
+        }
+
+        // 空闲链表上的一个节点：在某个 pool 里、是空闲的、大小属于这个 bin、前后指针对得上
+        bool verifyFreeNode( size_t bin, AllocHeader* node, TLSFVerifyResult& result ) const {
+            ++result.checked;
+            if(!inPools(node)) {
+                return verifyFailed(result, "free list node outside every pool", node);
+            }
+            if(!node->isFree()) {
+                return verifyFailed(result, "allocated block on a free list", node);
+            }
+            BitmapLevel level = queryBitmapLevelForInsert(node->blockSize());
+            if((size_t)level.firstLevel * SLC + level.secondLevel != bin) {
+                return verifyFailed(result, "free block in the wrong bin", node);
+            }
+            AllocHeader* prevFree = node->prevFreeAlloc;
+            AllocHeader* nextFree = node->nextFreeAlloc;
+            if(prevFree ? !inPools(prevFree) || prevFree->nextFreeAlloc != node : _allocationLinkTable[bin / SLC][bin % SLC] != node) {
+                return verifyFailed(result, "free list previous link broken", node);
+            }
+            if(nextFree && (!inPools(nextFree) || nextFree->prevFreeAlloc != node)) {
+                return verifyFailed(result, "free list next link broken", node);
+            }
+            return true;
+        }
+
+        // 统计计数器，TLSF_ENABLE_STATS 为 0 的时候都是空函数
+        // 已分配的字节不单独记：pool 的字节 = 所有块的大小 + 所有块头，减掉空闲的部分就是
+        inline size_t queryBytesInUse() const {
+#if TLSF_ENABLE_STATS
+            return _stats.poolBytes - _stats.freeBytes - (_stats.freeBlocks + _stats.usedBlocks) * AllocHeader::TrueSize;
+#else
+            return 0;
+#endif
+        }
+
+        inline void updatePeakUsage() {
+#if TLSF_ENABLE_STATS
+            _stats.peakBytesInUse = std::max(_stats.peakBytesInUse, queryBytesInUse());
+#endif
+        }
+
+        inline void countFreeListInsert( BitmapLevel level, size_t size ) {
+#if TLSF_ENABLE_STATS
+            ++_stats.freeBlocks;
+            _stats.freeBytes += size;
+            ++_stats.freeBlocksPerBin[level.firstLevel][level.secondLevel];
+#else
+            (void)level; (void)size;
+#endif
+        }
+
+        inline void countFreeListRemove( BitmapLevel level, size_t size ) {
+#if TLSF_ENABLE_STATS
+            --_stats.freeBlocks;
+            _stats.freeBytes -= size;
+            --_stats.freeBlocksPerBin[level.firstLevel][level.secondLevel];
+#else
+            (void)level; (void)size;
+#endif
+        }
+
+        inline void countPoolAdded( const TLSFPool& pool ) {
+#if TLSF_ENABLE_STATS
+            _stats.poolBytes += pool.capacity() - AllocHeader::PoolTailSize;
+#else
+            (void)pool;
+#endif
+        }
+
+        inline void countPoolRetired( const TLSFPool& pool ) {
+#if TLSF_ENABLE_STATS
+            _stats.poolBytes -= pool.capacity() - AllocHeader::PoolTailSize;
+#else
+            (void)pool;
+#endif
+        }
+
+        inline void countAllocatedBlocks( size_t count ) {
+#if TLSF_ENABLE_STATS
+            _stats.usedBlocks += count;
+            updatePeakUsage();
+#else
+            (void)count;
+#endif
+        }
+
+        inline void countReleasedBlocks( size_t count ) {
+#if TLSF_ENABLE_STATS
+            _stats.usedBlocks -= count;
+#else
+            (void)count;
+#endif
+        }
+
+        inline void countSplits( size_t count ) {
+#if TLSF_ENABLE_STATS
+            _stats.splitCount += count;
+#else
+            (void)count;
+#endif
+        }
+
+        inline void countMerges( size_t count ) {
+#if TLSF_ENABLE_STATS
+            _stats.mergeCount += count;
+#else
+            (void)count;
+#endif
+        }
+
+        inline void countFailedAllocation() {
+#if TLSF_ENABLE_STATS
+            ++_stats.failedAllocations;
+#endif
+        }
+
+        // 整个 pool 写成一个空闲块（还没插入空闲链表），紧凑块头的话后面再放哨兵
+        AllocHeader* formatPool( const TLSFPool& pool ) {
             AllocHeader* allocation = (AllocHeader*)pool.ptr();
             //allocation->prevPhyAlloc = nullptr;
             //allocation->prevFreeAlloc = nullptr;
             // allocation->initForSplit(capacity - AllocHeader::TrueSize, nullptr);
-            allocation->size = capacity - AllocHeader::TrueSize;
-            allocation->free = 1;
-            allocation->prevPhyAlloc = nullptr;
+            allocation->setBlockSize(pool.capacity() - AllocHeader::TrueSize - AllocHeader::PoolTailSize);
+            allocation->setFree(true);
+            allocation->setPrevPhysical(nullptr);
+            if(AllocHeader::PoolTailSize) { // 哨兵：大小为 0，永远是已分配状态
+                AllocHeader* sentinel = allocation->nextPhyAllocation();
+                sentinel->setBlockSize(0);
+                sentinel->setFree(false);
+                sentinel->setPrevPhysical(allocation);
+            }
+            return allocation;
+        }
+    public:
+        bool initialize( TLSFPool pool ) {
+            size_t capacity = pool.capacity();
+            if(capacity < AllocHeader::TrueSize + MinimumBlockSize + AllocHeader::PoolTailSize || capacity >= MaxPoolCapacity) {
+                return false; // 太大的块会落到 FLC 之外的 first level
+            }
+            AllocHeader* allocation = formatPool(pool);
+            countPoolAdded(pool);
+            _memoryPools.add(pool);
+            _purgeCarry = PurgeRange{}; // 新 pool 的页还没碰过，是干净的
             insertFreeAllocation(allocation);
-            _memoryPools.emplace_back(pool.ptr(), pool.capacity());
             return true;
         }
+
+        // growth mode : when alloc misses, a new pool is requested from `provider`; provider pools
+        // that become completely free are handed back once more than `retainedFreePools` are idle
+        void setPoolProvider( TLSFPoolProvider* provider, size_t retainedFreePools = 1 ) {
+            _poolProvider = provider;
+            _retainedFreePools = retainedFreePools;
+        }
+
+        /*
+        ** 堆对象和它唯一的 pool 在同一块映射里，一起换了地址（同一个文件被重新映射）以后接着用，
+        ** 不用重建。只有 RelativeAllocHeader 的堆能这样：块头和空闲链表表头都是相对地址。
+        ** 只属于原来那个进程的东西都重新来：pool 登记表（它的数组在原来进程的堆上，不释放）、
+        ** pool provider、verify 的游标和 purge 队列。空闲块里记的 purge 范围是绝对地址，
+        ** 所以 purge 是关着的，要的话重新 setPurgePolicy
+        */
+        template< class Header = AllocHeader >
+        void reattach( const TLSFPool& pool ) {
+            static_assert(Header::PositionIndependent, "only heaps with RelativeAllocHeader can be reattached");
+            new (&_memoryPools) TLSFPoolRegistry();
+            _memoryPools.add(pool);
+            _poolProvider = nullptr;
+            _retainedFreePools = 0;
+            _verifyCursor = VerifyCursor{};
+            _purgeThreshold = 0;
+            _purgeHead = _purgeTail;
+            _purgeCarry = PurgeRange{};
+        }
+
+        /*
+        ** 几个进程把同一个堆映射在不同的地址上（共享内存），每个进程有自己的 pool 登记表，
+        ** 拿到锁以后换进堆里，放锁之前再换回来。堆里放着的登记表只是别的进程的几个字，不会被用到。
+        ** 共享的堆不能用 verifyStep 和 purge，它们的状态是绝对地址
+        */
+        template< class Header = AllocHeader >
+        void swapPoolRegistry( TLSFPoolRegistry& registry ) {
+            static_assert(Header::PositionIndependent, "only heaps with RelativeAllocHeader can be shared");
+            _memoryPools.swap(registry);
+        }
+
+        // 释放 pool 登记表，然后堆对象不能再用，也不能析构，只能连着 pool 一起卸载，以后 reattach
+        template< class Header = AllocHeader >
+        void detach() {
+            static_assert(Header::PositionIndependent, "only heaps with RelativeAllocHeader can be detached");
+            _memoryPools.~TLSFPoolRegistry();
+        }
+        /*
+        ** 空闲块还给系统：不小于 minimumBlockSize（至少一页）的空闲块在空闲链表里又插入了
+        ** decay 次还没被用掉，就用 madvise 把它中间整页的部分还掉。decay 防止经常来回分配
+        ** 释放的大块每次都被还掉再缺页。块里记着还没还过的范围，还过的页不会再还一次。
+        ** minimumBlockSize 为 0 关掉。只在 Linux 上有效
+        */
+        void setPurgePolicy( size_t minimumBlockSize, uint64_t decay, TLSFPurgeAdvice advice = TLSFPurgeAdvice::DontNeed ) {
+            _purgeThreshold = minimumBlockSize ? std::max(minimumBlockSize, tlsf_page_size()) : 0;
+            _purgeDecay = decay;
+            _purgeAdvice = advice;
+            _purgeHead = _purgeTail; // 原来的候选都不要了
+            if(!_purgeThreshold) {
+                return;
+            }
+            // 现有的空闲大块没记过脏范围，当成整块都脏，等它们下次被切开或者合并再排队
+            for( size_t bin = 0; bin < FLC * SLC; ++bin ) {
+                for( AllocHeader* node = _allocationLinkTable[bin / SLC][bin % SLC]; node; node = node->nextFreeAlloc ) {
+                    if(node->blockSize() >= _purgeThreshold) {
+                        PurgeStamp& stamp = purgeStamp(node);
+                        stamp.sequence = _purgeHead - 1;
+                        stamp.dirty = PurgeRange{ (uintptr_t)node, (uintptr_t)node->nextPhyAllocation() };
+                    }
+                }
+            }
+        }
+
+        // 马上把所有空闲块中间整页的部分还给系统（不管 decay 和大小），返回还掉的字节数
+        size_t trim() {
+            size_t purged = 0;
+            for( size_t bin = 0; bin < FLC * SLC; ++bin ) {
+                for( AllocHeader* node = _allocationLinkTable[bin / SLC][bin % SLC]; node; node = node->nextFreeAlloc ) {
+                    if(node->blockSize() >= tlsf_page_size()) {
+                        purged += purgeBlock(node, true);
+                    }
+                }
+            }
+            _purgeHead = _purgeTail;
+            return purged;
+        }
+
+        /*
+        ** 一次放掉所有已分配的块：每个 pool 回到刚 initialize 完只有一个空闲块的样子，
+        ** 只写每个 pool 开头的块头，和块的数量没关系。pool 都留着，growth mode 申请的也不还给 provider。
+        ** 之前分配的指针全部失效，放在前端（TLSFThreadCache 之类）缓存里的块也一样，
+        ** 所以不要在还挂着前端的堆上用。累计的计数（peak、split、merge、failed、purge）不清零
+        */
+        void reset() {
+            _firstLevelBitmap = 0;
+            for( size_t firstLevel = 0; firstLevel < FLC; ++firstLevel ) {
+                _secondLevelBitmap[firstLevel] = 0;
+                for( size_t secondLevel = 0; secondLevel < SLC; ++secondLevel ) {
+                    _allocationLinkTable[firstLevel][secondLevel] = nullptr;
+                }
+            }
+            _verifyCursor = VerifyCursor{};
+            _purgeHead = _purgeTail;
+#if TLSF_ENABLE_STATS
+            _stats.usedBlocks = 0;
+            _stats.freeBlocks = 0;
+            _stats.freeBytes = 0;
+            _stats.freeBlocksPerBin = decltype(_stats.freeBlocksPerBin){};
+#endif
+            for( const auto& pool : _memoryPools ) {
+                AllocHeader* allocation = formatPool(pool);
+                _purgeCarry = PurgeRange{ (uintptr_t)pool.ptr(), (uintptr_t)pool.ptr() + pool.capacity() }; // 用过的页都当成脏的
+                insertFreeAllocation(allocation);
+            }
+        }
+
         // ===============================================
         void* alloc( size_t size ) {
             auto allocation = queryFreeAllocation(size);
+            if(!allocation && _poolProvider && growPools(size)) {
+                allocation = queryFreeAllocation(size);
+            }
             if(!allocation) {
+                countFailedAllocation();
                 return nullptr;
             } else {
-                // allocation->setFree(false);
-                allocation->free = 0;
+                markAllocated(allocation);
+                countAllocatedBlocks(1);
                 #if TLSF_DEBUG_ASSERT
                 auto pool = locatePool(allocation);
                 auto next = allocation->nextPhyAllocation();
                 if(pool->check_next_contains(next)) {
-                    assert(allocation == next->prevPhyAlloc);
+                    // 紧凑块头只记录空闲的前一块
+                    assert((AllocHeader::TracksPrevFree ? nullptr : allocation) == next->prevPhysical());
                 }
-                auto prev = allocation->prevPhyAlloc;
+                auto prev = allocation->prevPhysical();
                 if(prev) {
                     assert(prev->nextPhyAllocation() == allocation );
                 }
@@ -387,74 +1196,392 @@ namespace ugi {
             }
         }
 
-        inline const TLSFPool* locatePool( AllocHeader* allocation ) {
-            const TLSFPool* allocPool = nullptr;
-            for( const auto& pool : _memoryPools ) {
-                if(pool.contains(allocation)) {
-                    allocPool = &pool;
+        // align 必须是 2 的幂。多申请 align + 一个最小块，对齐之后前面空出来的部分
+        // 切成一个自由块还回去，后面多出来的也切掉，所以不会每次都浪费 align 字节
+        void* allocAligned( size_t size, size_t align ) {
+            assert(!(align & (align - 1)) && "alignment must be a power of two");
+            if(align <= AllocHeader::Alignment) {
+                return alloc(size);
+            }
+            constexpr size_t gapMinimum = AllocHeader::TrueSize + MinimumBlockSize;
+            // 先挡住放不进任何 pool 的请求，不然下面的取整和加法会回绕成一个很小的块
+            if(size >= MaxPoolCapacity || align >= MaxPoolCapacity - gapMinimum || size > MaxPoolCapacity - align - gapMinimum) {
+                countFailedAllocation();
+                return nullptr;
+            }
+            size = roundRequestSize(size);
+            size_t requestSize = size + align + gapMinimum;
+            auto allocation = queryFreeAllocation(requestSize);
+            if(!allocation && _poolProvider && growPools(requestSize)) {
+                allocation = queryFreeAllocation(requestSize);
+            }
+            if(!allocation) {
+                countFailedAllocation();
+                return nullptr;
+            }
+            const TLSFPool* pool = locatePool(allocation);
+            uintptr_t ptr = (uintptr_t)allocation->ptr();
+            uintptr_t alignedPtr = (ptr + align - 1) & ~(uintptr_t)(align - 1);
+            if(alignedPtr != ptr && alignedPtr - ptr < gapMinimum) {
+                alignedPtr = (ptr + gapMinimum + align - 1) & ~(uintptr_t)(align - 1);
+            }
+            if(alignedPtr != ptr) { // 前面的空隙作为自由块还回去
+                size_t gap = alignedPtr - ptr;
+                AllocHeader* alignedAlloc = AllocHeader::fromPtr((void*)alignedPtr);
+                alignedAlloc->setBlockSize(allocation->blockSize() - gap);
+                alignedAlloc->setFree(false);
+                countSplits(1);
+                allocation->setBlockSize(gap - AllocHeader::TrueSize);
+                allocation->setFree(true);
+                alignedAlloc->setPrevPhysical(allocation);
+                auto next = alignedAlloc->nextPhyAllocation();
+                if(pool->check_next_contains(next)) {
+                    next->setPrevPhysical(alignedAlloc);
                 }
+                insertFreeAllocation(allocation, true, pool);
+                allocation = alignedAlloc;
             }
+            markAllocated(allocation);
+            trimAllocation(allocation, size, pool); // 后面多出来的也切掉
+            countAllocatedBlocks(1);
+            return allocation->ptr();
+        }
+
+        inline const TLSFPool* locatePool( AllocHeader* allocation ) {
+            const TLSFPool* allocPool = _memoryPools.locate(allocation);
             assert(allocPool);
             return allocPool;
         }
 
+        // 和 C 的 realloc 一样：ptr 为空就是 alloc，size 为 0 就是 free。
+        // 依次尝试：原地缩小（切掉尾巴）-> 吞并后面的空闲块 -> 挪到前面的空闲块里 -> 重新分配再拷贝。
+        // 失败的时候返回 nullptr，原来的块不动
         void* realloc( void* ptr, size_t size ) {
-            AllocHeader* allocation = (AllocHeader*)((uint8_t*)ptr-AllocHeader::TrueSize);
-            const TLSFPool* allocPool = nullptr;
-            for( const auto& pool : _memoryPools ) {
-                if(pool.contains(allocation)) {
-                    allocPool = &pool;
+            if(!ptr) {
+                return alloc(size);
+            }
+            if(!size) {
+                free(ptr);
+                return nullptr;
+            }
+            if(size >= MaxPoolCapacity) {
+                countFailedAllocation();
+                return nullptr;
+            }
+            AllocHeader* allocation = AllocHeader::fromPtr(ptr);
+            const TLSFPool* allocPool = locatePool(allocation);
+            size_t blockSize = roundRequestSize(size);
+            size_t currentSize = allocation->blockSize();
+            if(blockSize <= currentSize) {
+                trimAllocation(allocation, blockSize, allocPool);
+                return ptr;
+            }
+            if(expandInPlace(allocation, blockSize, allocPool)) {
+                return ptr;
+            }
+            AllocHeader* moved = slideIntoPrevious(allocation, blockSize, allocPool);
+            if(moved) {
+                return moved->ptr();
+            }
+            void* newPtr = alloc(size);
+            if(!newPtr) {
+                return nullptr;
+            }
+            tlsf_copy_memory(newPtr, ptr, currentSize);
+            free(ptr);
+            return newPtr;
+        }
+
+        // 一次分配 count 个同样大小的块，返回实际分配到的个数（不够的时候后面的 out 不动）。
+        // 尽量从一个够大的空闲块里连续切出来，只取一次块、插回一次剩余的部分，
+        // 这样 freeBatch 的时候它们也能拼成一段一次合并。没有够大的块才用这个 level 上零散的块
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            if(!count) {
+                return 0;
+            }
+            if( size >= MaxPoolCapacity ) {
+                countFailedAllocation();
+                return 0;
+            }
+            BitmapLevel level = queryBitmapLevelForAlloc(size < MinimumBlockSize ? MinimumBlockSize : size);
+            if( level.firstLevel >= FLC ) {
+                countFailedAllocation();
+                return 0;
+            }
+            size_t blockSize = queryLevelSize(level);
+            size_t allocated = 0;
+            while(allocated < count) {
+                size_t batchSize = (count - allocated) * (blockSize + AllocHeader::TrueSize) - AllocHeader::TrueSize;
+                AllocHeader* block = takeFreeBlock(batchSize);
+                if(!block && queryFreeStatus(level)) {
+                    AllocHeader* allocation = queryAllocationWithFreeLevel(level);
+                    markAllocated(allocation);
+                    out[allocated++] = allocation->ptr();
+                    continue;
                 }
+                if(!block) {
+                    block = takeLargestFreeBlock(blockSize);
+                }
+                if(!block) {
+                    if(_poolProvider && (growPools(batchSize) || growPools(blockSize))) {
+                        continue;
+                    }
+                    break;
+                }
+                allocated += carveAllocations(block, blockSize, count - allocated, out + allocated);
             }
-            assert(allocPool);
-            AllocHeader* nextPhyAlloc = allocation->nextPhyAllocation();
-            if( (void*)nextPhyAlloc>=allocPool->endPtr()) {
-                nextPhyAlloc = nullptr;
+            countAllocatedBlocks(allocated);
+            if(allocated < count) {
+                countFailedAllocation();
             }
-            if(nextPhyAlloc && nextPhyAlloc->free) {
-                size_t alignedLevelSize = queryAlignedLevelSize(size);
-                size_t mergedSize = nextPhyAlloc->size + AllocHeader::TrueSize + allocation->size;
-                if( (mergedSize >= size) && (mergedSize < alignedLevelSize) ) {
-                    removeFreeAllocationAndUpdateBitmap(nextPhyAlloc);
-                    allocation->size = mergedSize;
-                    return ptr;
+            return allocated;
+        }
+
+        // 一次释放 count 个块，ptrs 会被按地址排序（空指针跳过）。
+        // 地址上连续的已分配块先拼成一个块，整段只插入、合并一次
+        void freeBatch( void** ptrs, size_t count ) {
+            std::sort(ptrs, ptrs + count);
+            const TLSFPool* pool = nullptr;
+            size_t index = 0;
+            while(index < count && !ptrs[index]) {
+                ++index;
+            }
+            while(index < count) {
+                AllocHeader* firstAlloc = AllocHeader::fromPtr(ptrs[index]);
+                if(!pool || !pool->contains(firstAlloc)) {
+                    pool = locatePool(firstAlloc);
+                }
+                AllocHeader* lastAlloc = firstAlloc;
+                size_t runLength = 1;
+                for( ++index; index < count; ++index ) {
+                    AllocHeader* nextAlloc = lastAlloc->nextPhyAllocation();
+                    if(!pool->check_next_contains(nextAlloc) || AllocHeader::fromPtr(ptrs[index]) != nextAlloc) {
+                        break; // 相邻的 pool 首尾挨着的时候也不能跨 pool 拼
+                    }
+                    lastAlloc = nextAlloc;
+                    ++runLength;
                 }
+                countReleasedBlocks(runLength);
+                countMerges(runLength - 1);
+                if(lastAlloc != firstAlloc) {
+                    firstAlloc->setBlockSize((uint8_t*)lastAlloc->nextPhyAllocation() - (uint8_t*)firstAlloc->ptr());
+                }
+                firstAlloc->setFree(true);
+                insertFreeAllocation(firstAlloc, true, pool);
+                if(_poolProvider && pool->retirable()) {
+                    retirePoolIfUnused(pool);
+                    pool = nullptr; // pool 可能已经被移出 _memoryPools 了
+                }
+            }
+        }
+
+        // 只在原地扩展（吞并后面的空闲块），不会移动数据，成功之后块至少有 size 字节。
+        // 容器扩容的时候先试这个，失败了再自己 alloc + 拷贝
+        bool tryExpand( void* ptr, size_t size ) {
+            AllocHeader* allocation = AllocHeader::fromPtr(ptr);
+            if(size <= allocation->blockSize()) {
+                return true;
+            }
+            if(size >= MaxPoolCapacity) {
+                return false;
             }
-            insertFreeAllocation(allocation, true, allocPool); // 回收旧的，分配新的
-            return alloc(size);
+            return expandInPlace(allocation, roundRequestSize(size), locatePool(allocation));
         }
 
         void free( void* ptr ) {
             AllocHeader* allocation = (AllocHeader*)((uint8_t*)ptr-AllocHeader::TrueSize);
-            // allocation->setFree(true);
-            allocation->free = 1;
-            const TLSFPool* allocPool = nullptr;
+            allocation->setFree(true);
+            countReleasedBlocks(1);
+            const TLSFPool* allocPool = locatePool(allocation);
+            assert(allocPool);
+            insertFreeAllocation(allocation, true, allocPool);
+            if(_poolProvider && allocPool->retirable()) {
+                retirePoolIfUnused(allocPool);
+            }
+        }
+
+        bool contains( const void* ptr ) const {
+            return _memoryPools.locate(ptr) != nullptr;
+        }
+
+        // usable size of an allocated block, at least the size it was requested with
+        size_t queryAllocationSize( void* ptr ) {
+            return AllocHeader::fromPtr(ptr)->blockSize();
+        }
+
+        // 放进 [firstLevel][secondLevel] 的最小块。queryBitmapLevelForInsert 随 size 单调，
+        // 所以按 MinBlock 二分，最多 MaxPoolLog2 次，不碰任何块
+        size_t binLowerBound( uint32_t firstLevel, uint32_t secondLevel ) const {
+            size_t low = MinimumBlockSize / MinimiumAllocationSize;
+            size_t high = MaxPoolCapacity / MinimiumAllocationSize;
+            while(low < high) {
+                size_t middle = low + (high - low) / 2;
+                BitmapLevel level = queryBitmapLevelForInsert(middle * MinimiumAllocationSize);
+                if(level.firstLevel < firstLevel || (level.firstLevel == firstLevel && level.secondLevel < secondLevel)) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            return low * MinimiumAllocationSize;
+        }
+
+        // 最大空闲块的下限，只看 bitmap：最高的非空 bin 的下界。真实的最大块在这个 bin 里，
+        // 最多再大一个 segment（大小的 1 / SLC），遍历那条链表在它很长的时候太贵
+        size_t queryLargestFreeBlock() const {
+            if(!_firstLevelBitmap) {
+                return 0;
+            }
+            uint32_t firstLevel = (uint32_t)tlsf_bitmap_fls(_firstLevelBitmap);
+            uint32_t secondLevel = (uint32_t)tlsf_bitmap_fls(_secondLevelBitmap[firstLevel]);
+            return binLowerBound(firstLevel, secondLevel);
+        }
+
+        Stats getStats() const {
+            Stats stats{};
+#if TLSF_ENABLE_STATS
+            stats = _stats;
+            stats.bytesInUse = queryBytesInUse();
+#endif
+            stats.largestFreeBlock = queryLargestFreeBlock();
+            stats.purgedBytes = _purgedBytes;
+            stats.purgeCalls = _purgeCalls;
+            return stats;
+        }
+
+        // pool 按地址从低到高，visitor( const TLSFPool& )
+        template< class Visitor >
+        void walkPools( Visitor&& visitor ) const {
+            for( const auto& pool : _memoryPools ) {
+                visitor(pool);
+            }
+        }
+
+        // 按物理顺序访问 pool 里的每个块，visitor( const TLSFBlockInfo& )。
+        // 不分配内存，visitor 里不能分配或者释放这个堆的内存
+        template< class Visitor >
+        void walkBlocks( const TLSFPool& pool, Visitor&& visitor ) const {
+            TLSFBlockInfo info;
+            info.pool = &pool;
+            AllocHeader* allocation = (AllocHeader*)pool.ptr();
+            while((void*)allocation < poolBlocksEnd(pool)) {
+                info.ptr = allocation->ptr();
+                info.offset = (uint8_t*)allocation - (uint8_t*)pool.ptr();
+                info.size = allocation->blockSize();
+                info.free = allocation->isFree();
+                visitor(info);
+                allocation = allocation->nextPhyAllocation();
+            }
+        }
+
+        template< class Visitor >
+        void walkBlocks( Visitor&& visitor ) const {
             for( const auto& pool : _memoryPools ) {
-                if(pool.contains(allocation)) {
-                    allocPool = &pool;
+                walkBlocks(pool, visitor);
+            }
+        }
+
+        /*
+        ** 增量检查，每次最多看 budget 个物理块 / 空闲链表节点 / bin，从上次停下的地方接着查。
+        ** 两次调用之间堆可以随便用，游标会跟着合并和摘链表修正；一轮走完所有 pool 和 bin
+        ** 的那次调用 passCompleted 为 true，下次从头开始。出错以后跳过出错的 pool 或者 bin 继续
+        */
+        TLSFVerifyResult verifyStep( size_t budget ) {
+            TLSFVerifyResult result{};
+            VerifyCursor& cursor = _verifyCursor;
+            const TLSFPool* pool = cursor.block ? _memoryPools.locate(cursor.poolBase) : nullptr;
+            if(!pool) {
+                cursor.block = nullptr;
+            }
+            while(result.checked < budget && result.ok()) {
+                if(!cursor.inFreeLists) {
+                    if(!cursor.block) {
+                        pool = nullptr;
+                        for( const auto& p : _memoryPools ) {
+                            if(!cursor.poolBase || p.ptr() > cursor.poolBase) {
+                                pool = &p;
+                                break;
+                            }
+                        }
+                        if(!pool) {
+                            cursor.inFreeLists = true;
+                            cursor.bin = 0;
+                            cursor.node = nullptr;
+                            if(verifyBin(0, result)) {
+                                cursor.node = _allocationLinkTable[0][0];
+                            }
+                            continue;
+                        }
+                        cursor.poolBase = pool->ptr();
+                        cursor.block = (AllocHeader*)pool->ptr();
+                    }
+                    cursor.block = verifyBlock(*pool, cursor.block, result);
+                }
+                else if(cursor.node) {
+                    AllocHeader* node = cursor.node;
+                    cursor.node = verifyFreeNode(cursor.bin, node, result) ? node->nextFreeAlloc : nullptr;
+                }
+                else if(++cursor.bin < FLC * SLC) {
+                    if(verifyBin(cursor.bin, result)) {
+                        cursor.node = _allocationLinkTable[cursor.bin / SLC][cursor.bin % SLC];
+                    }
+                }
+                else {
+                    cursor = VerifyCursor{};
+                    result.passCompleted = true;
+                    break;
                 }
             }
-            assert(allocPool);
-            insertFreeAllocation(allocation, true, allocPool);
+            return result;
+        }
+
+        // 一次查完一个 pool 的物理块链，不改堆，不同的 pool 可以在不同线程里同时查（见 TLSFVerify.h）
+        TLSFVerifyResult verifyPool( const TLSFPool& pool ) const {
+            TLSFVerifyResult result{};
+            AllocHeader* block = (AllocHeader*)pool.ptr();
+            while(block) {
+                block = verifyBlock(pool, block, result);
+            }
+            return result;
+        }
+
+        // 一次查完所有 bin 的 bitmap 和空闲链表
+        TLSFVerifyResult verifyFreeLists() const {
+            TLSFVerifyResult result{};
+            for( size_t bin = 0; bin < FLC * SLC && result.ok(); ++bin ) {
+                if(!verifyBin(bin, result)) {
+                    break;
+                }
+                for( AllocHeader* node = _allocationLinkTable[bin / SLC][bin % SLC]; node; node = node->nextFreeAlloc ) {
+                    if(!verifyFreeNode(bin, node, result)) {
+                        break;
+                    }
+                }
+            }
+            return result;
         }
 
         void dump() {
             size_t allocCount = 0;
             size_t freeCount = 0;
             size_t freeSize = 0;
-            for( auto& pool : _memoryPools) {
-                auto a = (AllocHeader*)pool.ptr();
-                while(pool.check_next_contains(a)) {
-                    ++allocCount;
-                    if(a->free) {
-                        ++freeCount;
-                        freeSize += a->size;
-                    }
-                    a = a->nextPhyAllocation();
+            walkBlocks([&]( const TLSFBlockInfo& block ) {
+                ++allocCount;
+                if(block.free) {
+                    ++freeCount;
+                    freeSize += block.size;
                 }
-            }
+            });
             printf("allocation count : %zu \nfree count: %zu\n free size: %zu\n", allocCount, freeCount, freeSize);
         }
     };
 
+    typedef TLSFBasic<> TLSF;
+    // 64 位寻址：pool 最大 256 TB，first level bitmap 是 64 位的
+    typedef TLSFBasic<5, 16, 48> TLSF64;
+    // 8 字节块头，指针按 8 字节对齐，小对象多的时候省一半的块头开销
+    typedef TLSFBasic<5, 8, 31, CompactAllocHeader> TLSFCompact;
+    // 链表是相对地址，堆可以放在映射文件 / 共享内存里，换个地址接着用，见 TLSFPersistentHeap.h
+    typedef TLSFBasic<5, 16, 31, RelativeAllocHeader> TLSFRelative;
+
 }
\ No newline at end of file
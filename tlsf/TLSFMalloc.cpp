@@ -0,0 +1,329 @@
+﻿/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** libtlsfmalloc.so : malloc / free / calloc / realloc / posix_memalign /
+** aligned_alloc / memalign / valloc / pvalloc / malloc_usable_size /
+** malloc_trim on one process wide TLSF64 heap, for running unmodified
+** programs with
+**
+**   LD_PRELOAD=libtlsfmalloc.so ./service
+**
+** - The heap grows by mmap'd pools ( 4 MB doubling up to 1 GB, or exactly as
+**   big as one larger request ), pools that become free are unmapped once more
+**   than one is idle. TLSF64 takes pools above 2 GB, so huge requests are just
+**   pools of their own.
+** - Free blocks of `PurgeThreshold` and more that stay unused for
+**   `PurgeDecay` free list insertions have their pages released, so the RSS
+**   falls again after a spike. malloc_trim releases every free page at once.
+** - One mutex guards the heap, forks are safe through pthread_atfork.
+** - The heap is built by the first call, whenever that happens, no static
+**   constructor is involved. Anything the heap itself allocates while it is
+**   locked ( its pool registry ), and whatever dlsym allocates, comes from a
+**   small static bootstrap arena that is never reused.
+** - Pointers that are neither in the heap nor in the arena were handed out by
+**   the next malloc in the lookup chain ( normally glibc, before the preload
+**   or through an entry point not exported here ). free and
+**   malloc_usable_size pass them on, realloc moves them into the heap.
+*/
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "TLSF.hpp"
+
+// the library is built with hidden visibility, only the malloc family is exported
+#define TLSF_MALLOC_EXPORT __attribute__((visibility("default")))
+
+namespace {
+
+    typedef ugi::TLSF64 Heap;
+
+    constexpr size_t InitialPoolCapacity = 4ULL * 1024 * 1024;
+    constexpr size_t MaxGrowthCapacity = 1ULL << 30;
+    constexpr size_t MaxRequestSize = Heap::MaxPoolCapacity >> 1;
+    constexpr size_t PurgeThreshold = 64 * 1024;
+    constexpr uint64_t PurgeDecay = 1024;
+    constexpr size_t BootstrapArenaSize = 256 * 1024;
+    constexpr size_t BootstrapAlignment = 16;
+
+    class MmapPoolProvider : public ugi::TLSFPoolProvider {
+    private:
+        size_t      _nextCapacity;
+    public:
+        MmapPoolProvider()
+            : _nextCapacity(InitialPoolCapacity)
+        {}
+        virtual ugi::TLSFPool acquirePool( size_t minimumCapacity ) override {
+            size_t capacity = _nextCapacity > minimumCapacity ? _nextCapacity : minimumCapacity;
+            ugi::TLSFPool pool = ugi::TLSFPool::createPool(capacity, ugi::TLSFPoolMapped);
+            if(pool.ptr() && minimumCapacity <= _nextCapacity && _nextCapacity < MaxGrowthCapacity) {
+                _nextCapacity *= 2;
+            }
+            return pool;
+        }
+        virtual void releasePool( ugi::TLSFPool& pool ) override {
+            ugi::TLSFPool::destroyPool(pool);
+        }
+    };
+
+    // bump allocator for re-entrant calls, every block has its size in the 16 bytes before it.
+    // only used under heapMutex
+    alignas(BootstrapAlignment) uint8_t     bootstrapArena[BootstrapArenaSize];
+    size_t                                  bootstrapUsed = 0;
+
+    inline bool inBootstrapArena( const void* ptr ) {
+        return ptr >= bootstrapArena && ptr < bootstrapArena + BootstrapArenaSize;
+    }
+
+    void* bootstrapAlloc( size_t size, size_t align ) {
+        if(align < BootstrapAlignment) {
+            align = BootstrapAlignment;
+        }
+        if(size > BootstrapArenaSize || align > BootstrapArenaSize) {
+            return nullptr;
+        }
+        size = (size + BootstrapAlignment - 1) & ~(BootstrapAlignment - 1);
+        size_t offset = (bootstrapUsed + BootstrapAlignment + align - 1) & ~(align - 1);
+        if(offset + size > BootstrapArenaSize) {
+            return nullptr;
+        }
+        bootstrapUsed = offset + size;
+        *(size_t*)(bootstrapArena + offset - BootstrapAlignment) = size;
+        return bootstrapArena + offset;
+    }
+
+    inline size_t bootstrapSize( const void* ptr ) {
+        return *(const size_t*)((const uint8_t*)ptr - BootstrapAlignment);
+    }
+
+    struct NextAllocator {
+        void    (*free)( void* );
+        size_t  (*usableSize)( void* );
+    };
+
+    // all constant initialized, so usable before any static constructor has run
+    std::mutex                              heapMutex;
+    bool                                    heapReady = false;
+    alignas(Heap) uint8_t                   heapStorage[sizeof(Heap)];
+    alignas(MmapPoolProvider) uint8_t       providerStorage[sizeof(MmapPoolProvider)];
+    NextAllocator                           nextAllocator = {};
+    // set while this thread holds heapMutex, calls made from inside the heap or dlsym must not lock again
+    thread_local bool                       insideHeap __attribute__((tls_model("initial-exec"))) = false;
+
+    inline Heap& heap() {
+        return *(Heap*)heapStorage;
+    }
+
+    void lockBeforeFork() {
+        heapMutex.lock();
+    }
+
+    void unlockAfterFork() {
+        heapMutex.unlock();
+    }
+
+    // under heapMutex. dlsym runs once the heap is usable, it may free blocks it got from it earlier
+    void initializeHeap() {
+        MmapPoolProvider* provider = new (providerStorage) MmapPoolProvider();
+        Heap* tlsf = new (heapStorage) Heap();
+        tlsf->setPoolProvider(provider, 1);
+        tlsf->setPurgePolicy(PurgeThreshold, PurgeDecay);
+        heapReady = true;
+        nextAllocator.free = (void(*)(void*))dlsym(RTLD_NEXT, "free");
+        nextAllocator.usableSize = (size_t(*)(void*))dlsym(RTLD_NEXT, "malloc_usable_size");
+        pthread_atfork(lockBeforeFork, unlockAfterFork, unlockAfterFork);
+    }
+
+    // locks the heap unless this thread already holds it, the heap is built by the first lock
+    class HeapLock {
+    private:
+        bool        _nested;
+    public:
+        HeapLock()
+            : _nested(insideHeap)
+        {
+            if(_nested) {
+                return;
+            }
+            heapMutex.lock();
+            insideHeap = true;
+            if(!heapReady) {
+                initializeHeap();
+            }
+        }
+        ~HeapLock() {
+            if(!_nested) {
+                insideHeap = false;
+                heapMutex.unlock();
+            }
+        }
+        // a nested call comes from the middle of a heap operation, it must not allocate from the heap
+        bool nested() const {
+            return _nested;
+        }
+        bool owns( void* ptr ) const {
+            return heapReady && heap().contains(ptr);
+        }
+    };
+
+    void* allocate( size_t size, size_t align ) {
+        void* ptr = nullptr;
+        if(size <= MaxRequestSize) {
+            HeapLock lock;
+            if(lock.nested()) {
+                ptr = bootstrapAlloc(size, align);
+            } else if(align > Heap::AllocHeader::Alignment) {
+                ptr = heap().allocAligned(size, align);
+            } else {
+                ptr = heap().alloc(size);
+            }
+        }
+        if(!ptr) {
+            errno = ENOMEM;
+        }
+        return ptr;
+    }
+
+    size_t usableSize( void* ptr ) {
+        if(inBootstrapArena(ptr)) {
+            return bootstrapSize(ptr);
+        }
+        size_t (*nextUsableSize)( void* );
+        {
+            HeapLock lock;
+            if(lock.owns(ptr)) {
+                return heap().queryAllocationSize(ptr);
+            }
+            nextUsableSize = nextAllocator.usableSize;
+        }
+        return nextUsableSize ? nextUsableSize(ptr) : 0;
+    }
+
+}
+
+extern "C" {
+
+    TLSF_MALLOC_EXPORT void* malloc( size_t size ) noexcept {
+        return allocate(size, 0);
+    }
+
+    TLSF_MALLOC_EXPORT void free( void* ptr ) noexcept {
+        if(!ptr || inBootstrapArena(ptr)) {
+            return;
+        }
+        void (*nextFree)( void* );
+        {
+            HeapLock lock;
+            if(lock.owns(ptr)) {
+                heap().free(ptr);
+                return;
+            }
+            nextFree = nextAllocator.free;
+        }
+        if(nextFree) {
+            nextFree(ptr);
+        }
+    }
+
+    TLSF_MALLOC_EXPORT void* calloc( size_t count, size_t size ) noexcept {
+        if(size && count > (size_t)-1 / size) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        void* ptr = allocate(count * size, 0);
+        if(ptr && !inBootstrapArena(ptr)) {
+            memset(ptr, 0, count * size);
+        }
+        return ptr;
+    }
+
+    TLSF_MALLOC_EXPORT void* realloc( void* ptr, size_t size ) noexcept {
+        if(!ptr) {
+            return allocate(size, 0);
+        }
+        if(!size) {
+            free(ptr);
+            return nullptr;
+        }
+        if(size > MaxRequestSize) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        if(!inBootstrapArena(ptr)) {
+            HeapLock lock;
+            if(lock.owns(ptr)) {
+                void* newPtr = heap().realloc(ptr, size);
+                if(!newPtr) {
+                    errno = ENOMEM;
+                }
+                return newPtr;
+            }
+        }
+        // bootstrap and foreign blocks move into the heap
+        size_t oldSize = usableSize(ptr);
+        void* newPtr = allocate(size, 0);
+        if(newPtr) {
+            memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+            free(ptr);
+        }
+        return newPtr;
+    }
+
+    TLSF_MALLOC_EXPORT int posix_memalign( void** out, size_t align, size_t size ) noexcept {
+        if(!align || (align & (align - 1)) || align % sizeof(void*)) {
+            return EINVAL;
+        }
+        void* ptr = allocate(size, align);
+        if(!ptr) {
+            return ENOMEM;
+        }
+        *out = ptr;
+        return 0;
+    }
+
+    TLSF_MALLOC_EXPORT void* aligned_alloc( size_t align, size_t size ) noexcept {
+        if(!align || (align & (align - 1))) {
+            errno = EINVAL;
+            return nullptr;
+        }
+        return allocate(size, align);
+    }
+
+    TLSF_MALLOC_EXPORT void* memalign( size_t align, size_t size ) noexcept {
+        return aligned_alloc(align, size);
+    }
+
+    TLSF_MALLOC_EXPORT void* valloc( size_t size ) noexcept {
+        return allocate(size, (size_t)sysconf(_SC_PAGESIZE));
+    }
+
+    TLSF_MALLOC_EXPORT void* pvalloc( size_t size ) noexcept {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return allocate((size + pageSize - 1) & ~(pageSize - 1), pageSize);
+    }
+
+    TLSF_MALLOC_EXPORT size_t malloc_usable_size( void* ptr ) noexcept {
+        return ptr ? usableSize(ptr) : 0;
+    }
+
+    // 1 when pages were released, like glibc. `pad` is ignored, whole free pages are always released
+    TLSF_MALLOC_EXPORT int malloc_trim( size_t ) noexcept {
+        HeapLock lock;
+        return !lock.nested() && heap().trim() ? 1 : 0;
+    }
+
+}
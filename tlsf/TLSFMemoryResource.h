@@ -0,0 +1,61 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+// std::pmr is C++17, the rest of the library stays C++11
+#if defined(_MSVC_LANG)
+#define TLSF_CPLUSPLUS _MSVC_LANG
+#else
+#define TLSF_CPLUSPLUS __cplusplus
+#endif
+#if TLSF_CPLUSPLUS < 201703L
+#error "TLSFMemoryResource.h needs C++17, see tlsf_bench_containers in benchmark/CMakeLists.txt"
+#endif
+
+#include <memory_resource>
+
+#include "TLSFStlAllocator.h"
+
+namespace ugi {
+
+    /*
+    ** std::pmr::memory_resource over a heap ( TLSFBasic, MemoryAllocator, ... ),
+    ** so pmr containers and pool resources can draw from it :
+    **
+    **   ugi::TLSFMemoryResource<> resource(tlsf);
+    **   std::pmr::vector<int> values(&resource);
+    **
+    ** Alignments above the pointer size go through allocAligned. Two resources
+    ** are equal only when they are the same object, like the standard ones.
+    ** Not synchronized beyond what the heap itself does.
+    */
+    template< class HeapType = TLSFBasic<> >
+    class TLSFMemoryResource : public std::pmr::memory_resource {
+    private:
+        HeapType*       _heap;
+    public:
+        explicit TLSFMemoryResource( HeapType& heap ) noexcept
+            : _heap(&heap)
+        {}
+        HeapType& heap() const noexcept {
+            return *_heap;
+        }
+    private:
+        void* do_allocate( size_t bytes, size_t alignment ) override {
+            return tlsf_heap_allocate(*_heap, bytes, alignment);
+        }
+        void do_deallocate( void* ptr, size_t, size_t ) override {
+            _heap->free(ptr);
+        }
+        bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override {
+            return this == &other;
+        }
+    };
+
+}
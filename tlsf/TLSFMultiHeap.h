@@ -0,0 +1,539 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "TLSFUtility.h"
+
+namespace ugi {
+
+    struct TLSFMultiHeapConfig {
+        size_t          initialPoolCapacity;    // first pool of every thread heap
+        size_t          growthFactor;           // each further pool of a thread heap grows by this factor
+        size_t          maxPoolCapacity;
+        size_t          retainedFreePools;      // idle pools a thread heap keeps before handing them back
+        uint32_t        poolFlags;              // TLSFPoolFlags, where the pools come from
+        size_t          purgeThreshold;         // TLSFBasic::setPurgePolicy of every thread heap, 0 keeps free pages
+        uint64_t        purgeDecay;
+        TLSFMultiHeapConfig()
+            : initialPoolCapacity(256 * 1024)
+            , growthFactor(2)
+            , maxPoolCapacity(1ULL << 30)
+            , retainedFreePools(1)
+            , poolFlags(TLSFPoolHeapMemory)
+            , purgeThreshold(0)
+            , purgeDecay(0)
+        {}
+    };
+
+    /*
+    ** One HeapType instance per thread, grown on demand from its own pools.
+    ** A block freed by the thread that owns its heap goes straight back to that heap.
+    ** A block freed by any other thread is pushed onto the owner's lock-free MPSC list
+    ** and the owner drains that list during its own alloc/free calls, so the owner's
+    ** fast path does not touch any atomic except one load of the list head.
+    **
+    ** The owner of a foreign pointer is found without locking, in an immutable copy
+    ** of the pool registry. The copy is only replaced when a thread heap grows or
+    ** retires a pool, and the old one is deleted once no lookup can still read it.
+    ** Heaps of exited threads are kept and adopted by the next new thread.
+    ** A thread that only frees never gets a heap of its own.
+    **
+    ** With CompactAllocHeader heaps the owner rewrites the size word of a block when
+    ** a neighbour is freed or merged, so every heap is locked while it is used and a
+    ** cross-thread realloc reads the old size under that lock ( SizeWordShared ).
+    */
+    template< class HeapType >
+    class TLSFMultiHeap {
+    public:
+        constexpr static size_t MaxHeapsPerThread = 8;
+        // the size word of an allocated block is only written by the thread holding it, except in
+        // headers that keep the previous block's free flag in it ( CompactAllocHeader )
+        constexpr static bool SizeWordShared = HeapType::AllocHeader::TracksPrevFree;
+    private:
+        struct ThreadHeap;
+
+        struct RemoteFree {
+            RemoteFree*                     next;
+        };
+
+        struct OwnedPool : public TLSFPool {
+            ThreadHeap*                     heap;
+            OwnedPool()
+                : TLSFPool()
+                , heap(nullptr)
+            {}
+            OwnedPool( const TLSFPool& pool, ThreadHeap* owner )
+                : TLSFPool(pool)
+                , heap(owner)
+            {}
+        };
+
+        // registers every pool of a thread heap in the shared registry
+        class OwnedPoolProvider : public TLSFPoolProvider {
+        private:
+            ThreadHeap*                     _heap;
+            TLSFGeometricPoolProvider       _provider;
+        public:
+            OwnedPoolProvider( ThreadHeap* heap, const TLSFMultiHeapConfig& config )
+                : _heap(heap)
+                , _provider(config.initialPoolCapacity, config.growthFactor, config.maxPoolCapacity, config.poolFlags)
+            {}
+            virtual TLSFPool acquirePool( size_t minimumCapacity ) override {
+                TLSFPool pool = _provider.acquirePool(minimumCapacity);
+                TLSFMultiHeap* owner = _heap->owner.load();
+                if (pool.ptr() && owner) {
+                    owner->registerPool(pool, _heap);
+                }
+                return pool;
+            }
+            virtual void releasePool( TLSFPool& pool ) override {
+                TLSFMultiHeap* owner = _heap->owner.load();
+                if (owner) {
+                    owner->unregisterPool(pool);
+                }
+                _provider.releasePool(pool);
+            }
+        };
+
+        struct ThreadHeap {
+            std::atomic<TLSFMultiHeap*>     owner;
+            std::atomic<uint32_t>           references;     // multi heap + bound thread, the last one deletes it
+            std::atomic<RemoteFree*>        remoteFrees;
+            bool                            abandoned;
+            std::mutex                      sizeWordMutex;  // only locked when SizeWordShared
+            ThreadHeap*                     next;
+            OwnedPoolProvider               provider;       // declared before heap, the heap releases its pools to it
+            HeapType                        heap;
+            ThreadHeap( TLSFMultiHeap* multiHeap, const TLSFMultiHeapConfig& config )
+                : owner(multiHeap)
+                , references(1)
+                , remoteFrees(nullptr)
+                , abandoned(false)
+                , next(nullptr)
+                , provider(this, config)
+                , heap()
+            {
+                heap.setPoolProvider(&provider, config.retainedFreePools);
+                heap.setPurgePolicy(config.purgeThreshold, config.purgeDecay);
+            }
+        };
+
+        // excludes the heap's owner while the size word of one of its blocks is read elsewhere.
+        // A thread heap's guard is taken before _mutex ( pool growth locks it under the guard ),
+        // the shared heap's after it
+        class HeapGuard {
+        private:
+            std::unique_lock<std::mutex>    _lock;
+        public:
+            HeapGuard( ThreadHeap* heap, bool tryOnly = false )
+                : _lock(heap->sizeWordMutex, std::defer_lock)
+            {
+                if (SizeWordShared) {
+                    if (tryOnly) {
+                        _lock.try_lock();
+                    }
+                    else {
+                        _lock.lock();
+                    }
+                }
+            }
+            bool locked() const {
+                return !SizeWordShared || _lock.owns_lock();
+            }
+        };
+
+        struct ThreadSlot {
+            uint64_t                        multiHeapId;
+            ThreadHeap*                     heap;
+        };
+
+        struct ThreadSlots {
+            ThreadSlot                      slots[MaxHeapsPerThread];
+            ThreadSlots()
+                : slots{}
+            {}
+            ~ThreadSlots() {
+                for (auto& slot : slots) {
+                    if (slot.heap) {
+                        TLSFMultiHeap* owner = slot.heap->owner.load();
+                        if (owner) {
+                            owner->abandonHeap(slot.heap);
+                        }
+                        releaseHeap(slot.heap);
+                    }
+                }
+            }
+        };
+        typedef TLSFBasicPoolRegistry<OwnedPool> PoolSnapshot;
+    private:
+        TLSFMultiHeapConfig                 _config;
+        uint64_t                            _multiHeapId;
+        std::recursive_mutex                _mutex;         // guards _pools, _heaps and abandoned heaps, re-entered by pool growth/retirement
+        TLSFBasicPoolRegistry<OwnedPool>    _pools;
+        std::atomic<PoolSnapshot*>          _snapshot;      // copy of _pools read by locateHeap, replaced under _mutex
+        std::atomic<uint64_t>               _snapshotEpoch; // bumped by every replacement
+        std::atomic<uint32_t>               _snapshotReaders[2];    // lookups in progress, by epoch parity
+        ThreadHeap*                         _heaps;
+        ThreadHeap*                         _sharedHeap;    // for threads that ran out of slots, used under _mutex
+        static std::atomic<uint64_t>        _nextMultiHeapId;
+    private:
+        static ThreadSlots& threadSlots() {
+            static thread_local ThreadSlots slots;
+            return slots;
+        }
+
+        static void releaseHeap( ThreadHeap* heap ) {
+            if (--heap->references == 0) {
+                delete heap;
+            }
+        }
+
+        static void pushRemoteFree( ThreadHeap* heap, void* ptr ) {
+            RemoteFree* node = (RemoteFree*)ptr;
+            node->next = heap->remoteFrees.load(std::memory_order_relaxed);
+            while (!heap->remoteFrees.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+        }
+
+        // only the thread bound to the heap ( or _mutex holder for unbound heaps ) may drain
+        static void drainRemoteFrees( ThreadHeap* heap ) {
+            if (!heap->remoteFrees.load(std::memory_order_relaxed)) {
+                return;
+            }
+            RemoteFree* node = heap->remoteFrees.exchange(nullptr, std::memory_order_acquire);
+            while (node) {
+                RemoteFree* next = node->next;
+                heap->heap.free(node);
+                node = next;
+            }
+        }
+
+        // _mutex must be held. The lookups that may still read the old copy all counted
+        // themselves under the epoch before the bump, the old copy goes when they are done
+        void publishPools() {
+            PoolSnapshot* snapshot = new PoolSnapshot();
+            for (const OwnedPool& pool : _pools) {
+                snapshot->add(pool);
+            }
+            PoolSnapshot* previous = _snapshot.exchange(snapshot);
+            uint64_t epoch = _snapshotEpoch.fetch_add(1);
+            while (_snapshotReaders[epoch & 1].load()) {
+                std::this_thread::yield();
+            }
+            delete previous;
+        }
+
+        void registerPool( const TLSFPool& pool, ThreadHeap* heap ) {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            _pools.add(OwnedPool(pool, heap));
+            publishPools();
+        }
+
+        void unregisterPool( const TLSFPool& pool ) {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            _pools.remove(pool.ptr());
+            publishPools();
+        }
+
+        // lock-free, a replacement that starts meanwhile waits for it
+        ThreadHeap* locateHeap( const void* ptr ) {
+            for (;;) {
+                uint64_t epoch = _snapshotEpoch.load();
+                std::atomic<uint32_t>& readers = _snapshotReaders[epoch & 1];
+                readers.fetch_add(1);
+                if (_snapshotEpoch.load() != epoch) {   // counted too late for that replacement
+                    readers.fetch_sub(1);
+                    continue;
+                }
+                const OwnedPool* pool = _snapshot.load()->locate(ptr);
+                ThreadHeap* heap = pool ? pool->heap : nullptr;
+                readers.fetch_sub(1);
+                return heap;
+            }
+        }
+
+        // the calling thread's heap if it has one already, never creates it
+        ThreadHeap* boundHeap() {
+            for (auto& slot : threadSlots().slots) {
+                if (slot.multiHeapId == _multiHeapId) {
+                    return slot.heap;
+                }
+            }
+            return nullptr;
+        }
+
+        ThreadHeap* threadHeap() {
+            ThreadSlots& slots = threadSlots();
+            ThreadSlot* vacant = nullptr;
+            for (auto& slot : slots.slots) {
+                if (slot.multiHeapId == _multiHeapId) {
+                    return slot.heap;
+                }
+                if (slot.heap && !slot.heap->owner.load()) {    // multi heap destroyed, recycle the slot
+                    releaseHeap(slot.heap);
+                    slot.heap = nullptr;
+                    slot.multiHeapId = 0;
+                }
+                if (!slot.heap && !vacant) {
+                    vacant = &slot;
+                }
+            }
+            if (!vacant) {
+                return nullptr;
+            }
+            ThreadHeap* heap = nullptr;
+            {
+                std::lock_guard<std::recursive_mutex> lock(_mutex);
+                for (ThreadHeap* h = _heaps; h; h = h->next) {
+                    if (h->abandoned) {
+                        heap = h;
+                        break;
+                    }
+                }
+                if (heap) {
+                    heap->abandoned = false;
+                }
+                else {
+                    heap = new ThreadHeap(this, _config);
+                    heap->next = _heaps;
+                    _heaps = heap;
+                }
+                ++heap->references;
+            }
+            vacant->multiHeapId = _multiHeapId;
+            vacant->heap = heap;
+            return heap;
+        }
+
+        void abandonHeap( ThreadHeap* heap ) {
+            HeapGuard guard(heap);
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            drainRemoteFrees(heap);
+            heap->abandoned = true;
+        }
+    public:
+        TLSFMultiHeap( const TLSFMultiHeapConfig& config = TLSFMultiHeapConfig() )
+            : _config(config)
+            , _multiHeapId(_nextMultiHeapId++)
+            , _pools()
+            , _snapshot(new PoolSnapshot())
+            , _snapshotEpoch(0)
+            , _snapshotReaders{}
+            , _heaps(nullptr)
+            , _sharedHeap(nullptr)
+        {
+            _sharedHeap = new ThreadHeap(this, _config);
+        }
+
+        ~TLSFMultiHeap() {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            drainRemoteFrees(_sharedHeap);
+            _sharedHeap->owner = nullptr;
+            releaseHeap(_sharedHeap);
+            while (_heaps) {
+                ThreadHeap* heap = _heaps;
+                _heaps = heap->next;
+                if (heap->abandoned) {
+                    drainRemoteFrees(heap);
+                }
+                heap->owner = nullptr;
+                releaseHeap(heap);
+            }
+            delete _snapshot.load();
+        }
+
+        void* alloc( size_t size ) {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.alloc(size);
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.alloc(size);
+        }
+
+        void* allocAligned( size_t size, size_t align ) {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.allocAligned(size, align);
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.allocAligned(size, align);
+        }
+
+        void free( void* ptr ) {
+            ThreadHeap* heap = boundHeap();
+            if (heap && heap->heap.contains(ptr)) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                heap->heap.free(ptr);
+                return;
+            }
+            ThreadHeap* owner = locateHeap(ptr);
+            assert(owner && "pointer does not belong to this heap");
+            pushRemoteFree(owner, ptr);
+        }
+
+        void* realloc( void* ptr, size_t size ) {
+            if (!ptr) {
+                return alloc(size);
+            }
+            if (!size) {
+                free(ptr);
+                return nullptr;
+            }
+            ThreadHeap* heap = threadHeap();
+            if (heap && heap->heap.contains(ptr)) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.realloc(ptr, size);
+            }
+            void* newPtr = alloc(size);
+            if (!newPtr) {
+                return nullptr;
+            }
+            ThreadHeap* owner = locateHeap(ptr);
+            assert(owner && "pointer does not belong to this heap");
+            size_t oldSize = 0;
+            {
+                HeapGuard guard(owner);
+                oldSize = owner->heap.queryAllocationSize(ptr);
+            }
+            memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+            pushRemoteFree(owner, ptr);
+            return newPtr;
+        }
+
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.allocBatch(size, count, out);
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.allocBatch(size, count, out);
+        }
+
+        // blocks of the calling thread's heap are freed as one batch, the others go to their owners
+        void freeBatch( void** ptrs, size_t count ) {
+            ThreadHeap* heap = boundHeap();
+            size_t ownCount = 0;
+            for (size_t i = 0; i < count; ++i) {
+                void* ptr = ptrs[i];
+                if (!ptr) {
+                    continue;
+                }
+                if (heap && heap->heap.contains(ptr)) {
+                    ptrs[ownCount++] = ptr;
+                    continue;
+                }
+                ThreadHeap* owner = locateHeap(ptr);
+                assert(owner && "pointer does not belong to this heap");
+                pushRemoteFree(owner, ptr);
+            }
+            if (ownCount) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                heap->heap.freeBatch(ptrs, ownCount);
+            }
+        }
+
+        // only blocks of the calling thread's own heap can grow in place
+        bool tryExpand( void* ptr, size_t size ) {
+            ThreadHeap* heap = boundHeap();
+            if (heap && heap->heap.contains(ptr)) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.tryExpand(ptr, size);
+            }
+            return false;
+        }
+
+        bool contains( const void* ptr ) {
+            return locateHeap(ptr) != nullptr;
+        }
+
+        // stats of the calling thread's heap ( or the shared heap ), other thread heaps are not synchronized
+        typename HeapType::Stats getStats() {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.getStats();
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.getStats();
+        }
+
+        // the calling thread's heap, like getStats
+        TLSFVerifyResult verifyStep( size_t budget ) {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.verifyStep(budget);
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.verifyStep(budget);
+        }
+
+        // the calling thread's heap, like getStats
+        size_t trim() {
+            ThreadHeap* heap = threadHeap();
+            if (heap) {
+                HeapGuard guard(heap);
+                drainRemoteFrees(heap);
+                return heap->heap.trim();
+            }
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            HeapGuard guard(_sharedHeap);
+            drainRemoteFrees(_sharedHeap);
+            return _sharedHeap->heap.trim();
+        }
+
+        // drains the remote frees of heaps whose threads have exited, skips those in use right now
+        void collectAbandoned() {
+            std::lock_guard<std::recursive_mutex> lock(_mutex);
+            for (ThreadHeap* heap = _heaps; heap; heap = heap->next) {
+                if (!heap->abandoned) {
+                    continue;
+                }
+                HeapGuard guard(heap, true);
+                if (guard.locked()) {
+                    drainRemoteFrees(heap);
+                }
+            }
+        }
+    };
+
+    template< class HeapType >
+    std::atomic<uint64_t> TLSFMultiHeap<HeapType>::_nextMultiHeapId(1);
+
+}
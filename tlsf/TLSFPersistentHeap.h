@@ -0,0 +1,308 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#if defined(_WIN32)
+#error "TLSFPersistentHeap.h needs POSIX open / mmap / flock"
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TLSF.hpp"
+
+namespace ugi {
+
+    /*
+    ** Heap file, native byte order :
+    **
+    **   TLSFPersistentHeader    at offset 0
+    **   HeapType                at TLSFPersistentHeapOffset, the TLSFBasic object, free list heads included
+    **   pool                    from the first page boundary after it to the end of the file
+    **
+    ** HeapType must use RelativeAllocHeader ( TLSFRelative ), so nothing in the
+    ** file is an absolute address and a restarted process maps it anywhere and
+    ** goes on without a rebuild pass.
+    */
+    constexpr char TLSFPersistentMagic[8] = { 'T', 'L', 'S', 'F', 'H', 'E', 'A', 'P' };
+    constexpr uint32_t TLSFPersistentVersion = 1;
+    constexpr size_t TLSFPersistentHeapOffset = 64;
+
+    struct TLSFPersistentHeader {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        cleanShutdown;      // 1 after close(), 0 while a process has the file open
+        uint64_t        layout;             // tlsf_persistent_layout<HeapType>()
+        uint64_t        fileSize;
+        uint64_t        poolOffset;
+        uint64_t        rootOffset;         // 0 when no root was set
+    };
+
+    static_assert(sizeof(TLSFPersistentHeader) == 48 && sizeof(TLSFPersistentHeader) <= TLSFPersistentHeapOffset, "the header must not have padding");
+
+    // everything that changes the bytes of HeapType, a file only opens with the same heap type it was created with
+    template< class HeapType >
+    constexpr uint64_t tlsf_persistent_layout() {
+        return (uint64_t)sizeof(HeapType)
+            | (uint64_t)HeapType::SLI << 32
+            | (uint64_t)tlsf_log2(HeapType::MinimiumAllocationSize) << 40
+            | (uint64_t)tlsf_log2(HeapType::MaxPoolCapacity) << 48
+            | (uint64_t)sizeof(void*) << 56;
+    }
+
+    enum class TLSFPersistentState {
+        Closed,
+        Failed,         // see error()
+        Created,        // the file was new ( or its creation never finished ), the heap is empty
+        Reattached,     // the last process closed the file
+        Recovered,      // the last process did not close the file, the heap was verified and is consistent
+    };
+
+    /*
+    ** A TLSF heap in a file, so a service keeps its heap across restarts :
+    **
+    **   TLSFPersistentHeap<> file;
+    **   if(file.open("cache.heap", 1ULL << 30) == TLSFPersistentState::Created) {
+    **       file.setRoot(buildIndex(file.heap()));
+    **   }
+    **   Index* index = (Index*)file.root();
+    **
+    ** Pointers the application stores inside the heap must be relative as well,
+    ** TLSFRelativePtr or toOffset / fromOffset, the root is the one entry point.
+    **
+    ** open() clears cleanShutdown and syncs it before the heap can change,
+    ** close() sets it again after everything else has been synced. A file that
+    ** does not have it went through a crash ; open() then checks every block
+    ** and free list ( verifyPool / verifyFreeLists ) before handing the heap
+    ** out, and refuses a broken one. Blocks of the crashed process stay allocated.
+    **
+    ** The file is flock'ed by one process at a time. Not thread safe, like TLSFBasic.
+    */
+    template< class HeapType = TLSFRelative >
+    class TLSFPersistentHeap {
+    private:
+        int                     _fd;
+        uint8_t*                _base;
+        size_t                  _size;
+        bool                    _attached;      // the heap object is usable and must be detached by close()
+        TLSFPersistentState     _state;
+        const char*             _error;
+
+        inline TLSFPersistentHeader* header() const {
+            return (TLSFPersistentHeader*)_base;
+        }
+
+        inline TLSFPool pool() const {
+            return TLSFPool(_base + header()->poolOffset, _size - header()->poolOffset);
+        }
+
+        // the header is in the first page
+        inline bool syncHeader() {
+            return msync(_base, tlsf_page_size(), MS_SYNC) == 0;
+        }
+
+        // the file keeps cleanShutdown as it is
+        TLSFPersistentState fail( const char* error ) {
+            if(_attached) {
+                heap().detach();
+                _attached = false;
+            }
+            close();
+            _state = TLSFPersistentState::Failed;
+            _error = error;
+            return _state;
+        }
+
+        TLSFPersistentState createHeap() {
+            size_t poolOffset = (TLSFPersistentHeapOffset + sizeof(HeapType) + tlsf_page_size() - 1) & ~(tlsf_page_size() - 1);
+            if(_size <= poolOffset || _size - poolOffset >= HeapType::MaxPoolCapacity) {
+                return fail("the capacity does not fit HeapType");
+            }
+            TLSFPersistentHeader* fileHeader = header();
+            memset(fileHeader, 0, sizeof(TLSFPersistentHeader));
+            fileHeader->version = TLSFPersistentVersion;
+            fileHeader->layout = tlsf_persistent_layout<HeapType>();
+            fileHeader->fileSize = _size;
+            fileHeader->poolOffset = poolOffset;
+            HeapType* heap = new (_base + TLSFPersistentHeapOffset) HeapType();
+            if(!heap->initialize(pool())) {
+                return fail("the capacity does not fit HeapType");
+            }
+            _attached = true;
+            // the magic goes last, a file without it is created again by the next open()
+            if(!syncHeader() || msync(_base, poolOffset, MS_SYNC)) {
+                return fail("msync failed");
+            }
+            memcpy(fileHeader->magic, TLSFPersistentMagic, sizeof(fileHeader->magic));
+            if(!syncHeader()) {
+                return fail("msync failed");
+            }
+            _state = TLSFPersistentState::Created;
+            return _state;
+        }
+
+        TLSFPersistentState attachHeap() {
+            TLSFPersistentHeader* fileHeader = header();
+            if(memcmp(fileHeader->magic, TLSFPersistentMagic, sizeof(fileHeader->magic))) {
+                return fail("not a TLSF heap file");
+            }
+            if(fileHeader->version != TLSFPersistentVersion) {
+                return fail("unsupported heap file version");
+            }
+            if(fileHeader->layout != tlsf_persistent_layout<HeapType>()) {
+                return fail("the file was created with a different heap type");
+            }
+            if(fileHeader->fileSize != _size || fileHeader->poolOffset < TLSFPersistentHeapOffset + sizeof(HeapType) || fileHeader->poolOffset >= _size) {
+                return fail("the heap file is truncated or damaged");
+            }
+            bool clean = fileHeader->cleanShutdown != 0;
+            fileHeader->cleanShutdown = 0;
+            if(!syncHeader()) {
+                return fail("msync failed");
+            }
+            heap().reattach(pool());
+            _attached = true;
+            if(clean) {
+                _state = TLSFPersistentState::Reattached;
+                return _state;
+            }
+            TLSFVerifyResult result = heap().verifyPool(pool());
+            if(result.ok()) {
+                result = heap().verifyFreeLists();
+            }
+            if(!result.ok()) {
+                return fail(result.error);
+            }
+            _state = TLSFPersistentState::Recovered;
+            return _state;
+        }
+
+    public:
+        TLSFPersistentHeap()
+            : _fd(-1)
+            , _base(nullptr)
+            , _size(0)
+            , _attached(false)
+            , _state(TLSFPersistentState::Closed)
+            , _error(nullptr)
+        {}
+        TLSFPersistentHeap( const TLSFPersistentHeap& ) = delete;
+        TLSFPersistentHeap& operator =( const TLSFPersistentHeap& ) = delete;
+        ~TLSFPersistentHeap() {
+            close();
+        }
+
+        // `capacity` ( rounded up to the page size ) is only used when the file is created
+        TLSFPersistentState open( const char* path, size_t capacity ) {
+            close();
+            _error = nullptr;
+            _fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if(_fd < 0) {
+                return fail("cannot open the heap file");
+            }
+            if(flock(_fd, LOCK_EX | LOCK_NB)) {
+                return fail("the heap file is open in another process");
+            }
+            struct stat info;
+            if(fstat(_fd, &info)) {
+                return fail("cannot stat the heap file");
+            }
+            bool create = info.st_size == 0;
+            if(create) {
+                _size = (capacity + tlsf_page_size() - 1) & ~(tlsf_page_size() - 1);
+                if(_size <= TLSFPersistentHeapOffset + sizeof(HeapType) || ftruncate(_fd, (off_t)_size)) {
+                    return fail("cannot size the heap file");
+                }
+            } else {
+                _size = (size_t)info.st_size;
+                if(_size < tlsf_page_size()) {
+                    return fail("not a TLSF heap file");
+                }
+            }
+            void* base = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+            if(base == MAP_FAILED) {
+                return fail("cannot map the heap file");
+            }
+            _base = (uint8_t*)base;
+            static const char noMagic[sizeof(TLSFPersistentMagic)] = {};
+            if(create || !memcmp(header()->magic, noMagic, sizeof(noMagic))) {
+                return createHeap();
+            }
+            return attachHeap();
+        }
+
+        // syncs the heap, marks the file as cleanly closed and unmaps it
+        void close() {
+            if(_attached) {
+                heap().detach();
+                if(msync(_base, _size, MS_SYNC) == 0) {
+                    header()->cleanShutdown = 1;
+                    syncHeader();
+                }
+                _attached = false;
+            }
+            if(_base) {
+                munmap(_base, _size);
+                _base = nullptr;
+            }
+            if(_fd >= 0) {
+                ::close(_fd); // drops the flock
+                _fd = -1;
+            }
+            _size = 0;
+            _state = TLSFPersistentState::Closed;
+        }
+
+        // writes the dirty pages back without closing, the file stays marked as open
+        bool sync() {
+            return _attached && msync(_base, _size, MS_SYNC) == 0;
+        }
+
+        bool isOpen() const {
+            return _attached;
+        }
+        TLSFPersistentState state() const {
+            return _state;
+        }
+        // why open() failed, nullptr otherwise
+        const char* error() const {
+            return _error;
+        }
+        HeapType& heap() {
+            return *(HeapType*)(_base + TLSFPersistentHeapOffset);
+        }
+        size_t fileSize() const {
+            return _size;
+        }
+
+        // file offsets of heap memory, the same in every process and after every restart
+        uint64_t toOffset( const void* ptr ) const {
+            return ptr ? (uint64_t)((const uint8_t*)ptr - _base) : 0;
+        }
+        void* fromOffset( uint64_t offset ) const {
+            return offset ? _base + offset : nullptr;
+        }
+
+        // the entry point of the application's data, kept in the file header
+        void setRoot( void* ptr ) {
+            header()->rootOffset = toOffset(ptr);
+        }
+        void* root() const {
+            return _attached ? fromOffset(header()->rootOffset) : nullptr;
+        }
+    };
+
+}
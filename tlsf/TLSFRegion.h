@@ -0,0 +1,235 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cassert>
+
+#include "TLSF.hpp"
+
+namespace ugi {
+
+    /*
+    ** Region ( arena ) on top of a TLSF heap, for scratch memory that dies all
+    ** at once, a request, a frame, a parse :
+    **
+    **   TLSFRegion<> region(tlsf);
+    **   {
+    **       TLSFRegionScope<> scope(region);
+    **       Node* nodes = (Node*)region.alloc(sizeof(Node) * count);
+    **       ...
+    **   }   // everything allocated inside the scope is released here
+    **
+    ** alloc is a pointer bump in the current chunk, a heap block of ChunkSize.
+    ** Single allocations are never freed. mark() / rewind() ( or TLSFRegionScope )
+    ** nest and must be used in LIFO order : rewind drops everything allocated
+    ** after the mark and hands the chunks that became unused back to the heap
+    ** with one freeBatch. One chunk is kept as a spare, so a scope that opens and
+    ** closes on an empty region does not go to the heap every time. Requests
+    ** above ChunkSize / 4 get a heap block of their own instead of wasting the
+    ** rest of a chunk, and so do requests whose alignment a chunk cannot
+    ** satisfy, they are released by rewind like everything else.
+    **
+    ** The heap is not owned. Not thread safe, like TLSFBasic.
+    */
+    template< class HeapType = TLSF >
+    class TLSFRegion {
+    public:
+        constexpr static size_t DefaultChunkSize = 64 * 1024;
+        constexpr static size_t DefaultAlignment = 16;
+        constexpr static size_t BatchSize = 64;         // chunks returned by one freeBatch call
+
+        struct Mark {
+            void*       chunk;
+            uint8_t*    cursor;
+            void*       large;
+        };
+    private:
+        // in front of every chunk and every large block, newest first
+        struct Chunk {
+            Chunk*      prev;
+            uint8_t*    end;
+        };
+    private:
+        HeapType&       _heap;
+        size_t          _chunkSize;
+        Chunk*          _chunk;         // the chunk alloc bumps in
+        uint8_t*        _cursor;
+        uint8_t*        _end;
+        Chunk*          _large;         // dedicated blocks of large requests
+        Chunk*          _spare;         // an unused chunk kept instead of going back to the heap
+        size_t          _chunkCount;    // chunks and large blocks held, the spare included
+    private:
+        static inline uint8_t* alignUp( uint8_t* ptr, size_t align ) {
+            return (uint8_t*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+        }
+
+        void* allocLarge( size_t size, size_t align ) {
+            size_t padding = align > sizeof(Chunk) ? align - sizeof(Chunk) : 0;
+            // the header and the padding must not wrap the request into a small block
+            if(size >= HeapType::MaxPoolCapacity || size > SIZE_MAX - sizeof(Chunk) - padding) {
+                return nullptr;
+            }
+            Chunk* block = (Chunk*)_heap.allocAligned(sizeof(Chunk) + padding + size, align > alignof(Chunk) ? align : alignof(Chunk));
+            if(!block) {
+                return nullptr;
+            }
+            uint8_t* ptr = alignUp((uint8_t*)(block + 1), align);
+            block->prev = _large;
+            block->end = ptr + size;
+            _large = block;
+            ++_chunkCount;
+            return ptr;
+        }
+
+        void* allocSlow( size_t size, size_t align ) {
+            // a fresh chunk holds `size` at any alignment up to `align` only if this fits,
+            // written so that nothing wraps once size is below a quarter chunk
+            if(size > _chunkSize / 4 || align - 1 > _chunkSize - sizeof(Chunk) - size) {
+                return allocLarge(size, align);
+            }
+            Chunk* chunk = _spare;
+            if(chunk) {
+                _spare = nullptr;
+            } else {
+                chunk = (Chunk*)_heap.alloc(_chunkSize);
+                if(!chunk) {
+                    return nullptr;
+                }
+                chunk->end = (uint8_t*)chunk + _chunkSize;
+                ++_chunkCount;
+            }
+            chunk->prev = _chunk;
+            _chunk = chunk;
+            _end = chunk->end;
+            uint8_t* ptr = alignUp((uint8_t*)(chunk + 1), align);
+            _cursor = ptr + size;
+            return ptr;
+        }
+
+        void flush( void** batch, size_t& count ) {
+            _heap.freeBatch(batch, count);
+            _chunkCount -= count;
+            count = 0;
+        }
+    public:
+        TLSFRegion( HeapType& heap, size_t chunkSize = DefaultChunkSize )
+            : _heap(heap)
+            , _chunkSize(chunkSize > 1024 ? chunkSize : 1024)
+            , _chunk(nullptr)
+            , _cursor(nullptr)
+            , _end(nullptr)
+            , _large(nullptr)
+            , _spare(nullptr)
+            , _chunkCount(0)
+        {}
+        TLSFRegion( const TLSFRegion& ) = delete;
+        TLSFRegion& operator =( const TLSFRegion& ) = delete;
+        ~TLSFRegion() {
+            release();
+        }
+
+        // align must be a power of two, nullptr when the heap is out of memory
+        inline void* alloc( size_t size, size_t align = DefaultAlignment ) {
+            assert(!(align & (align - 1)) && "alignment must be a power of two");
+            uint8_t* ptr = alignUp(_cursor, align);
+            if(_chunk && ptr <= _end && size <= (size_t)(_end - ptr)) {
+                _cursor = ptr + size;
+                return ptr;
+            }
+            return allocSlow(size, align);
+        }
+
+        template< class T >
+        T* allocArray( size_t count ) {
+            return (T*)alloc(sizeof(T) * count, alignof(T) > DefaultAlignment ? alignof(T) : DefaultAlignment);
+        }
+
+        Mark mark() const {
+            return Mark{ _chunk, _cursor, _large };
+        }
+
+        // releases everything allocated after `position`, newer marks become invalid
+        void rewind( const Mark& position ) {
+            void* batch[BatchSize];
+            size_t count = 0;
+            while(_large != position.large) {
+                assert(_large && "rewind to a mark that was already rewound");
+                batch[count++] = _large;
+                _large = _large->prev;
+                if(count == BatchSize) {
+                    flush(batch, count);
+                }
+            }
+            while(_chunk != position.chunk) {
+                assert(_chunk && "rewind to a mark that was already rewound");
+                Chunk* chunk = _chunk;
+                _chunk = chunk->prev;
+                if(!_spare && _chunk == position.chunk) {
+                    _spare = chunk; // the oldest one, its pages were touched first
+                    continue;
+                }
+                batch[count++] = chunk;
+                if(count == BatchSize) {
+                    flush(batch, count);
+                }
+            }
+            if(count) {
+                flush(batch, count);
+            }
+            _cursor = position.cursor;
+            _end = _chunk ? _chunk->end : nullptr;
+        }
+
+        // releases every allocation, keeps the spare chunk
+        void reset() {
+            rewind(Mark{ nullptr, nullptr, nullptr });
+        }
+
+        // reset() and the spare chunk goes back to the heap as well
+        void release() {
+            reset();
+            if(_spare) {
+                _heap.free(_spare);
+                _spare = nullptr;
+                --_chunkCount;
+            }
+        }
+
+        HeapType& heap() {
+            return _heap;
+        }
+        size_t chunkSize() const {
+            return _chunkSize;
+        }
+        // heap blocks held by the region, the spare chunk and large blocks included
+        size_t chunkCount() const {
+            return _chunkCount;
+        }
+    };
+
+    // rewinds the region to where it was when the scope was opened
+    template< class HeapType = TLSF >
+    class TLSFRegionScope {
+    private:
+        TLSFRegion<HeapType>&                       _region;
+        typename TLSFRegion<HeapType>::Mark         _mark;
+    public:
+        TLSFRegionScope( TLSFRegion<HeapType>& region )
+            : _region(region)
+            , _mark(region.mark())
+        {}
+        TLSFRegionScope( const TLSFRegionScope& ) = delete;
+        TLSFRegionScope& operator =( const TLSFRegionScope& ) = delete;
+        ~TLSFRegionScope() {
+            _region.rewind(_mark);
+        }
+    };
+
+}
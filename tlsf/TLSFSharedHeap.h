@@ -0,0 +1,327 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#if defined(_WIN32)
+#error "TLSFSharedHeap.h needs POSIX shared memory and process-shared mutexes"
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "TLSF.hpp"
+#include "TLSFPersistentHeap.h"
+
+namespace ugi {
+
+    /*
+    ** Shared memory segment, native byte order :
+    **
+    **   TLSFSharedHeader    at offset 0, the process-shared lock included
+    **   HeapType            at TLSFSharedHeapOffset
+    **   pool                from the first page boundary after it to the end of the segment
+    **
+    ** Like TLSFPersistentHeap the heap uses RelativeAllocHeader ( TLSFRelative ),
+    ** every process maps the segment wherever mmap puts it.
+    */
+    constexpr char TLSFSharedMagic[8] = { 'T', 'L', 'S', 'F', 'S', 'H', 'M', 0 };
+    constexpr uint32_t TLSFSharedVersion = 1;
+    constexpr size_t TLSFSharedHeapOffset = 256;
+
+    // offset of a block from the segment base, the same in every process, 0 is null
+    typedef uint64_t TLSFSharedHandle;
+
+    struct TLSFSharedHeader {
+        char                        magic[8];       // written last by the creator
+        uint32_t                    version;
+        uint32_t                    broken;         // a process died inside the heap and left it inconsistent
+        uint64_t                    layout;         // tlsf_persistent_layout<HeapType>()
+        uint64_t                    segmentSize;
+        uint64_t                    poolOffset;
+        std::atomic<uint64_t>       root;           // handle of the application's entry point
+        std::atomic<uint64_t>       recoveries;     // lock owners that died and were cleaned up after
+        pthread_mutex_t             lock;           // robust, process-shared
+    };
+
+    static_assert(sizeof(TLSFSharedHeader) <= TLSFSharedHeapOffset, "TLSFSharedHeapOffset is too small");
+
+    /*
+    ** A TLSF heap in a POSIX shared memory segment, for processes that hand
+    ** buffers to each other :
+    **
+    **   producer                                   consumer
+    **   heap.create("/frames", 256 << 20);         heap.attach("/frames");
+    **   void* frame = heap.alloc(size);
+    **   send(queue, heap.toHandle(frame));         void* frame = heap.fromHandle(receive(queue));
+    **                                              heap.free(frame);
+    **
+    ** Any attached process may free any block. Every call takes the robust,
+    ** process-shared mutex in the header. A process dying while it holds the
+    ** mutex hands it to the next one with EOWNERDEAD : that one verifies the
+    ** whole heap ( verifyPool / verifyFreeLists ) and goes on when it is
+    ** consistent, otherwise the heap is marked broken and every later call
+    ** fails. Blocks the dead process had allocated stay allocated.
+    **
+    ** The heap object in the segment cannot keep the pool registry of all
+    ** processes, each process has its own and swaps it in while it holds the
+    ** mutex, see TLSFBasic::swapPoolRegistry. Threads of one process may share
+    ** one TLSFSharedHeap, the mutex serializes them as well.
+    **
+    ** create() fails when the segment exists. attach() fails until the creator
+    ** has finished, retry it. The segment stays until unlink().
+    */
+    template< class HeapType = TLSFRelative >
+    class TLSFSharedHeap {
+    private:
+        int                     _fd;
+        uint8_t*                _base;
+        size_t                  _size;
+        TLSFPoolRegistry        _registry;      // this process' view of the pool, lent to the heap under the lock
+        const char*             _error;
+
+        inline TLSFSharedHeader* header() const {
+            return (TLSFSharedHeader*)_base;
+        }
+        inline HeapType& sharedHeap() const {
+            return *(HeapType*)(_base + TLSFSharedHeapOffset);
+        }
+        inline TLSFPool pool() const {
+            return TLSFPool(_base + header()->poolOffset, _size - header()->poolOffset);
+        }
+
+        bool fail( const char* error ) {
+            detach();
+            _error = error;
+            return false;
+        }
+
+        bool map( size_t size ) {
+            void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+            if(base == MAP_FAILED) {
+                return false;
+            }
+            _base = (uint8_t*)base;
+            _size = size;
+            return true;
+        }
+
+        // the previous owner died holding the mutex, the heap is usable again when it verifies
+        void recover() {
+            TLSFVerifyResult result = sharedHeap().verifyPool(pool());
+            if(result.ok()) {
+                result = sharedHeap().verifyFreeLists();
+            }
+            if(!result.ok()) {
+                header()->broken = 1;
+            }
+            header()->recoveries.fetch_add(1, std::memory_order_relaxed);
+            pthread_mutex_consistent(&header()->lock);
+        }
+
+        // holds the mutex with this process' registry swapped in, `valid` is false for a broken heap
+        class Lock {
+        private:
+            TLSFSharedHeap&     _owner;
+            bool                _held;
+            bool                _valid;
+        public:
+            Lock( TLSFSharedHeap& owner )
+                : _owner(owner)
+            {
+                int result = pthread_mutex_lock(&owner.header()->lock);
+                _held = result == 0 || result == EOWNERDEAD; // ENOTRECOVERABLE otherwise
+                if(!_held) {
+                    _valid = false;
+                    return;
+                }
+                _owner.sharedHeap().swapPoolRegistry(_owner._registry);
+                if(result == EOWNERDEAD) {
+                    _owner.recover();
+                }
+                _valid = !_owner.header()->broken;
+            }
+            ~Lock() {
+                if(_held) {
+                    _owner.sharedHeap().swapPoolRegistry(_owner._registry);
+                    pthread_mutex_unlock(&_owner.header()->lock);
+                }
+            }
+            bool valid() const {
+                return _valid;
+            }
+        };
+
+    public:
+        TLSFSharedHeap()
+            : _fd(-1)
+            , _base(nullptr)
+            , _size(0)
+            , _registry()
+            , _error(nullptr)
+        {}
+        TLSFSharedHeap( const TLSFSharedHeap& ) = delete;
+        TLSFSharedHeap& operator =( const TLSFSharedHeap& ) = delete;
+        ~TLSFSharedHeap() {
+            detach();
+        }
+
+        // creates the segment `name` ( "/something" ) of `capacity` bytes, rounded up to the page size, and attaches to it
+        bool create( const char* name, size_t capacity ) {
+            detach();
+            _error = nullptr;
+            size_t size = (capacity + tlsf_page_size() - 1) & ~(tlsf_page_size() - 1);
+            size_t poolOffset = (TLSFSharedHeapOffset + sizeof(HeapType) + tlsf_page_size() - 1) & ~(tlsf_page_size() - 1);
+            if(size <= poolOffset || size - poolOffset >= HeapType::MaxPoolCapacity) {
+                return fail("the capacity does not fit HeapType");
+            }
+            _fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if(_fd < 0) {
+                return fail(errno == EEXIST ? "the segment exists" : "cannot create the segment");
+            }
+            if(ftruncate(_fd, (off_t)size) || !map(size)) {
+                shm_unlink(name);
+                return fail("cannot size or map the segment");
+            }
+            TLSFSharedHeader* segmentHeader = new (_base) TLSFSharedHeader();
+            segmentHeader->version = TLSFSharedVersion;
+            segmentHeader->broken = 0;
+            segmentHeader->layout = tlsf_persistent_layout<HeapType>();
+            segmentHeader->segmentSize = size;
+            segmentHeader->poolOffset = poolOffset;
+            segmentHeader->root.store(0, std::memory_order_relaxed);
+            segmentHeader->recoveries.store(0, std::memory_order_relaxed);
+            pthread_mutexattr_t attributes;
+            pthread_mutexattr_init(&attributes);
+            pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+            int result = pthread_mutex_init(&segmentHeader->lock, &attributes);
+            pthread_mutexattr_destroy(&attributes);
+            HeapType* heap = new (_base + TLSFSharedHeapOffset) HeapType();
+            if(result || !heap->initialize(pool())) {
+                shm_unlink(name);
+                return fail("cannot initialize the segment");
+            }
+            heap->swapPoolRegistry(_registry); // the registry stays with this process
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(segmentHeader->magic, TLSFSharedMagic, sizeof(segmentHeader->magic));
+            return true;
+        }
+
+        bool attach( const char* name ) {
+            detach();
+            _error = nullptr;
+            _fd = shm_open(name, O_RDWR | O_CLOEXEC, 0600);
+            if(_fd < 0) {
+                return fail("cannot open the segment");
+            }
+            struct stat info;
+            if(fstat(_fd, &info) || (size_t)info.st_size < TLSFSharedHeapOffset || !map((size_t)info.st_size)) {
+                return fail("the segment is not initialized yet");
+            }
+            if(memcmp(header()->magic, TLSFSharedMagic, sizeof(header()->magic))) {
+                return fail("the segment is not initialized yet");
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(header()->version != TLSFSharedVersion || header()->layout != tlsf_persistent_layout<HeapType>() || header()->segmentSize != _size) {
+                return fail("the segment was created with a different heap type");
+            }
+            _registry.add(pool());
+            return true;
+        }
+
+        // unmaps the segment, blocks allocated by this process stay allocated
+        void detach() {
+            while(_registry.size()) {
+                _registry.remove(_registry.begin()->ptr());
+            }
+            if(_base) {
+                munmap(_base, _size);
+                _base = nullptr;
+            }
+            if(_fd >= 0) {
+                close(_fd);
+                _fd = -1;
+            }
+            _size = 0;
+        }
+
+        // removes the name, the memory goes away with the last mapping
+        static bool unlink( const char* name ) {
+            return shm_unlink(name) == 0;
+        }
+
+        bool isAttached() const {
+            return _base != nullptr;
+        }
+        const char* error() const {
+            return _error;
+        }
+        bool broken() const {
+            return header()->broken != 0;
+        }
+        uint64_t recoveries() const {
+            return header()->recoveries.load(std::memory_order_relaxed);
+        }
+
+        void* alloc( size_t size ) {
+            Lock lock(*this);
+            return lock.valid() ? sharedHeap().alloc(size) : nullptr;
+        }
+        void* allocAligned( size_t size, size_t align ) {
+            Lock lock(*this);
+            return lock.valid() ? sharedHeap().allocAligned(size, align) : nullptr;
+        }
+        void free( void* ptr ) {
+            if(!ptr) {
+                return;
+            }
+            assert(ptr >= _base + header()->poolOffset && ptr < _base + _size);
+            Lock lock(*this);
+            if(lock.valid()) {
+                sharedHeap().free(ptr);
+            }
+        }
+
+        // runs `func( HeapType& )` with the heap locked ( stats, verification ), false for a broken heap
+        template< class Func >
+        bool locked( Func&& func ) {
+            Lock lock(*this);
+            if(!lock.valid()) {
+                return false;
+            }
+            func(sharedHeap());
+            return true;
+        }
+
+        TLSFSharedHandle toHandle( const void* ptr ) const {
+            return ptr ? (TLSFSharedHandle)((const uint8_t*)ptr - _base) : 0;
+        }
+        void* fromHandle( TLSFSharedHandle handle ) const {
+            return handle ? _base + handle : nullptr;
+        }
+
+        // the handle of the application's entry point ( a queue, a directory of buffers ), kept in the header
+        void setRoot( TLSFSharedHandle handle ) {
+            header()->root.store(handle, std::memory_order_release);
+        }
+        TLSFSharedHandle root() const {
+            return header()->root.load(std::memory_order_acquire);
+        }
+    };
+
+}
@@ -0,0 +1,403 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <cstdio>
+#include <utility>
+
+#include "fls.h"
+#include "TLSFUtility.h"
+
+namespace ugi {
+
+    /*
+    ** Slab front-end for tiny requests ( up to HeapType::FLM ).
+    ** Requests are rounded to MinimiumAllocationSize classes and served from slabs,
+    ** header-less runs of equal-sized slots managed by a two level bitmap, so both
+    ** alloc and free are a couple of ffs and no split / merge work in the heap.
+    **
+    ** Slabs are carved out of regions, one heap block each. A region's slab metadata
+    ** lives in front of its slab data, a freed pointer finds its region through a
+    ** sorted registry and its slab by offset. Empty slabs go back to their region and
+    ** a region goes back to the heap once all of its slabs are empty ( one empty region
+    ** is kept around so a single alloc/free pair at the boundary does not thrash ).
+    ** Bigger requests are passed through to the heap.
+    ** When the heap cannot supply a region, tiny requests are passed through as well
+    ** until memory goes back to the heap, instead of searching for a region every time.
+    */
+    template< class HeapType >
+    class TLSFSlabAllocator {
+    public:
+        constexpr static size_t SlabShift = 14;
+        constexpr static size_t SlabSize = 1 << SlabShift;                                     // 16 KB
+        constexpr static size_t SlotGranularity = HeapType::MinimiumAllocationSize;
+        constexpr static size_t MaxSlotSize = HeapType::FLM;
+        constexpr static size_t ClassCount = MaxSlotSize / SlotGranularity;
+        constexpr static size_t MaxSlotCount = SlabSize / SlotGranularity;
+        constexpr static size_t BitmapWordCount = MaxSlotCount / 32;
+        static_assert(BitmapWordCount <= 64, "the summary mask is 64 bits wide");
+    private:
+        struct Region;
+
+        struct Slab {
+            Slab*           prev;
+            Slab*           next;
+            Region*         region;
+            uint8_t*        data;
+            uint32_t        slotSize;
+            uint32_t        capacity;
+            uint32_t        used;
+            uint32_t        classIndex;
+            uint64_t        summary;                            // bit i : freeBits[i] has free slots
+            uint32_t        freeBits[BitmapWordCount];          // bit set : slot is free
+        };
+
+        struct Region {
+            Region*         prevAvailable;                      // regions with free slabs
+            Region*         nextAvailable;
+            void*           block;
+            uint8_t*        data;
+            uint32_t        slabCount;
+            uint32_t        freeSlabCount;
+            Slab*           freeSlabs;
+            Slab*           slabs;
+        };
+
+        struct RegionPool : public TLSFPool {
+            Region*         region;
+            RegionPool()
+                : TLSFPool()
+                , region(nullptr)
+            {}
+            RegionPool( Region* r )
+                : TLSFPool(r->data, (size_t)r->slabCount << SlabShift)
+                , region(r)
+            {}
+        };
+    private:
+        HeapType                                _heap;
+        uint32_t                                _slabsPerRegion;
+        Slab*                                   _partialSlabs[ClassCount];      // slabs with at least one free slot
+        Region*                                 _availableRegions;              // regions with at least one free slab
+        TLSFBasicPoolRegistry<RegionPool>       _regions;
+        Region*                                 _emptyRegion;                   // kept instead of going back to the heap
+        bool                                    _regionFailed;                  // createRegion failed, cleared when heap memory is freed
+    private:
+        static void linkSlab( Slab*& head, Slab* slab ) {
+            slab->prev = nullptr;
+            slab->next = head;
+            if (head) {
+                head->prev = slab;
+            }
+            head = slab;
+        }
+
+        static void unlinkSlab( Slab*& head, Slab* slab ) {
+            if (slab->prev) {
+                slab->prev->next = slab->next;
+            }
+            else {
+                head = slab->next;
+            }
+            if (slab->next) {
+                slab->next->prev = slab->prev;
+            }
+        }
+
+        void linkAvailableRegion( Region* region ) {
+            region->prevAvailable = nullptr;
+            region->nextAvailable = _availableRegions;
+            if (_availableRegions) {
+                _availableRegions->prevAvailable = region;
+            }
+            _availableRegions = region;
+        }
+
+        void unlinkAvailableRegion( Region* region ) {
+            if (region->prevAvailable) {
+                region->prevAvailable->nextAvailable = region->nextAvailable;
+            }
+            else {
+                _availableRegions = region->nextAvailable;
+            }
+            if (region->nextAvailable) {
+                region->nextAvailable->prevAvailable = region->prevAvailable;
+            }
+        }
+
+        Region* createRegion() {
+            size_t headerSize = (sizeof(Region) + sizeof(Slab) * _slabsPerRegion + SlotGranularity - 1) & ~(SlotGranularity - 1);
+            void* block = _heap.alloc(headerSize + ((size_t)_slabsPerRegion << SlabShift));
+            if (!block) {
+                return nullptr;
+            }
+            Region* region = (Region*)block;
+            region->block = block;
+            region->slabs = (Slab*)(region + 1);
+            region->data = (uint8_t*)block + headerSize;
+            region->slabCount = _slabsPerRegion;
+            region->freeSlabCount = _slabsPerRegion;
+            region->freeSlabs = nullptr;
+            for (uint32_t i = _slabsPerRegion; i > 0; --i) {
+                Slab* slab = &region->slabs[i - 1];
+                slab->region = region;
+                slab->data = region->data + ((size_t)(i - 1) << SlabShift);
+                slab->used = 0;
+                linkSlab(region->freeSlabs, slab);
+            }
+            linkAvailableRegion(region);
+            _regions.add(RegionPool(region));
+            return region;
+        }
+
+        void destroyRegion( Region* region ) {
+            if (region->freeSlabCount) {
+                unlinkAvailableRegion(region);
+            }
+            _regions.remove(region->data);
+            _heap.free(region->block);
+            _regionFailed = false;
+        }
+
+        Slab* createSlab( size_t classIndex ) {
+            Region* region = _availableRegions;
+            if (!region) {
+                if (_regionFailed) {
+                    return nullptr;
+                }
+                region = createRegion();
+                if (!region) {
+                    _regionFailed = true;
+                    return nullptr;
+                }
+            }
+            if (region == _emptyRegion) {
+                _emptyRegion = nullptr;
+            }
+            Slab* slab = region->freeSlabs;
+            unlinkSlab(region->freeSlabs, slab);
+            if (!--region->freeSlabCount) {
+                unlinkAvailableRegion(region);
+            }
+            slab->slotSize = (uint32_t)((classIndex + 1) * SlotGranularity);
+            slab->capacity = (uint32_t)(SlabSize / slab->slotSize);
+            slab->used = 0;
+            slab->classIndex = (uint32_t)classIndex;
+            slab->summary = 0;
+            for (uint32_t word = 0; word < BitmapWordCount; ++word) {
+                uint32_t firstSlot = word * 32;
+                if (firstSlot >= slab->capacity) {
+                    slab->freeBits[word] = 0;
+                }
+                else {
+                    uint32_t count = slab->capacity - firstSlot;
+                    slab->freeBits[word] = count >= 32 ? 0xffffffff : ((1U << count) - 1);
+                    slab->summary |= 1ULL << word;
+                }
+            }
+            linkSlab(_partialSlabs[classIndex], slab);
+            return slab;
+        }
+
+        void releaseSlab( Slab* slab ) {
+            Region* region = slab->region;
+            unlinkSlab(_partialSlabs[slab->classIndex], slab);
+            linkSlab(region->freeSlabs, slab);
+            if (!region->freeSlabCount++) {
+                linkAvailableRegion(region);
+            }
+            if (region->freeSlabCount < region->slabCount) {
+                return;
+            }
+            if (_emptyRegion) {
+                destroyRegion(_emptyRegion);
+            }
+            _emptyRegion = region;
+        }
+
+        inline Slab* locateSlab( const void* ptr ) const {
+            const RegionPool* pool = _regions.locate(ptr);
+            if (!pool) {
+                return nullptr;
+            }
+            Region* region = pool->region;
+            return &region->slabs[((const uint8_t*)ptr - region->data) >> SlabShift];
+        }
+    public:
+        TLSFSlabAllocator( uint32_t slabsPerRegion = 64 )
+            : _heap()
+            , _slabsPerRegion(slabsPerRegion ? slabsPerRegion : 1)
+            , _partialSlabs{}
+            , _availableRegions(nullptr)
+            , _regions()
+            , _emptyRegion(nullptr)
+            , _regionFailed(false)
+        {}
+
+        ~TLSFSlabAllocator() {
+            while (_regions.size()) {
+                destroyRegion(_regions.begin()->region);
+            }
+        }
+
+        template< class ...ARGS >
+        bool initialize( ARGS&& ...args ) {
+            _regionFailed = false;
+            return _heap.initialize( std::forward<ARGS>(args)... );
+        }
+
+        void* alloc( size_t size ) {
+            if (size > MaxSlotSize) {
+                return _heap.alloc(size);
+            }
+            size_t classIndex = size ? (size - 1) / SlotGranularity : 0;
+            Slab* slab = _partialSlabs[classIndex];
+            if (!slab) {
+                slab = createSlab(classIndex);
+                if (!slab) {
+                    return _heap.alloc(size);
+                }
+            }
+            uint32_t word = (uint32_t)tlsf_ffs64(slab->summary);
+            uint32_t bit = tlsf_ffs(slab->freeBits[word]);
+            slab->freeBits[word] &= ~(1U << bit);
+            if (!slab->freeBits[word]) {
+                slab->summary &= ~(1ULL << word);
+            }
+            if (++slab->used == slab->capacity) {
+                unlinkSlab(_partialSlabs[classIndex], slab);
+            }
+            return slab->data + (size_t)(word * 32 + bit) * slab->slotSize;
+        }
+
+        // slots are only MinimiumAllocationSize aligned
+        void* allocAligned( size_t size, size_t align ) {
+            if (align <= SlotGranularity) {
+                return alloc(size);
+            }
+            return _heap.allocAligned(size, align);
+        }
+
+        void free( void* ptr ) {
+            Slab* slab = locateSlab(ptr);
+            if (!slab) {
+                _heap.free(ptr);
+                _regionFailed = false;
+                return;
+            }
+            uint32_t slot = (uint32_t)(((uint8_t*)ptr - slab->data) / slab->slotSize);
+            assert(!(slab->freeBits[slot >> 5] & (1U << (slot & 31))) && "double free");
+            slab->freeBits[slot >> 5] |= 1U << (slot & 31);
+            slab->summary |= 1ULL << (slot >> 5);
+            if (slab->used-- == slab->capacity) {
+                linkSlab(_partialSlabs[slab->classIndex], slab);
+            }
+            if (!slab->used) {
+                releaseSlab(slab);
+            }
+        }
+
+        void* realloc( void* ptr, size_t size ) {
+            if (!ptr) {
+                return alloc(size);
+            }
+            Slab* slab = locateSlab(ptr);
+            if (!slab) {
+                _regionFailed = false;
+                return _heap.realloc(ptr, size);
+            }
+            if (!size) {
+                free(ptr);
+                return nullptr;
+            }
+            if (size <= slab->slotSize) {
+                return ptr;
+            }
+            void* newPtr = alloc(size);
+            if (newPtr) {
+                memcpy(newPtr, ptr, slab->slotSize);
+                free(ptr);
+            }
+            return newPtr;
+        }
+
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            if (size > MaxSlotSize) {
+                return _heap.allocBatch(size, count, out);
+            }
+            size_t allocated = 0;
+            while (allocated < count && (out[allocated] = alloc(size))) {
+                ++allocated;
+            }
+            return allocated;
+        }
+
+        void freeBatch( void** ptrs, size_t count ) {
+            for (size_t i = 0; i < count; ++i) {
+                if (ptrs[i]) {
+                    free(ptrs[i]);
+                }
+            }
+        }
+
+        // slots never grow, only pass-through blocks can
+        bool tryExpand( void* ptr, size_t size ) {
+            Slab* slab = locateSlab(ptr);
+            if (!slab) {
+                return _heap.tryExpand(ptr, size);
+            }
+            return size <= slab->slotSize;
+        }
+
+        size_t queryAllocationSize( void* ptr ) {
+            Slab* slab = locateSlab(ptr);
+            return slab ? slab->slotSize : _heap.queryAllocationSize(ptr);
+        }
+
+        bool contains( const void* ptr ) const {
+            return _heap.contains(ptr);
+        }
+
+        HeapType& heap() {
+            return _heap;
+        }
+
+        // slab regions are heap blocks, so they count as in use as a whole
+        typename HeapType::Stats getStats() {
+            return _heap.getStats();
+        }
+
+        // slab regions are ordinary allocated blocks of the heap
+        TLSFVerifyResult verifyStep( size_t budget ) {
+            return _heap.verifyStep(budget);
+        }
+
+        // only purges free heap blocks, empty slabs still hold their pages until they go back to the heap
+        size_t trim() {
+            return _heap.trim();
+        }
+
+        void dump() {
+            size_t slabCount = 0;
+            size_t usedSlots = 0;
+            for (const RegionPool& pool : _regions) {
+                slabCount += pool.region->slabCount - pool.region->freeSlabCount;
+                for (uint32_t i = 0; i < pool.region->slabCount; ++i) {
+                    usedSlots += pool.region->slabs[i].used;
+                }
+            }
+            printf("slab regions : %zu\nslabs in use : %zu\nslots in use : %zu\n", _regions.size(), slabCount, usedSlots);
+            _heap.dump();
+        }
+    };
+
+}
@@ -0,0 +1,115 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "TLSFUtility.h"
+
+namespace ugi {
+
+    /*
+    ** Heap snapshot file, native byte order, written by tlsf_write_snapshot :
+    **
+    **   TLSFSnapshotHeader
+    **   for every pool, in address order :
+    **       TLSFSnapshotPool
+    **       TLSFSnapshotPool::blockCount x TLSFSnapshotBlock, in address order
+    **
+    ** Block headers are at least 8 byte aligned, so the lowest bit of
+    ** TLSFSnapshotBlock::offset carries the free flag. 16 bytes per block.
+    ** tools/SnapshotTool.cpp summarizes and diffs these files.
+    */
+    constexpr char TLSFSnapshotMagic[8] = { 'T', 'L', 'S', 'F', 'S', 'N', 'A', 'P' };
+    constexpr uint32_t TLSFSnapshotVersion = 1;
+    constexpr size_t TLSFSnapshotBufferBlocks = 256;
+
+    struct TLSFSnapshotHeader {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        blockHeaderSize;    // AllocHeader::TrueSize of the heap
+        uint64_t        poolCount;
+    };
+
+    struct TLSFSnapshotPool {
+        uint64_t        base;
+        uint64_t        capacity;
+        uint64_t        blockCount;
+    };
+
+    struct TLSFSnapshotBlock {
+        uint64_t        offset;             // block header offset from the pool base | free
+        uint64_t        size;
+        inline uint64_t blockOffset() const {
+            return offset & ~(uint64_t)1;
+        }
+        inline bool isFree() const {
+            return (offset & 1) != 0;
+        }
+    };
+
+    static_assert(sizeof(TLSFSnapshotHeader) == 24 && sizeof(TLSFSnapshotPool) == 24 && sizeof(TLSFSnapshotBlock) == 16, "snapshot records must not have padding");
+
+    /*
+    ** Writes a snapshot of `heap` ( a TLSFBasic ) to `file`.
+    ** Records go through a fixed buffer on the stack, nothing is allocated from
+    ** any heap here. fwrite only uses the buffer of `file`; if `heap` backs
+    ** malloc, give the file a static buffer with setvbuf ( or none ) first.
+    ** The heap must not change while this runs, lock the front-end around it.
+    */
+    template< class HeapType >
+    bool tlsf_write_snapshot( const HeapType& heap, FILE* file ) {
+        TLSFSnapshotHeader header;
+        memcpy(header.magic, TLSFSnapshotMagic, sizeof(header.magic));
+        header.version = TLSFSnapshotVersion;
+        header.blockHeaderSize = (uint32_t)HeapType::AllocHeader::TrueSize;
+        header.poolCount = 0;
+        heap.walkPools([&]( const TLSFPool& ) {
+            ++header.poolCount;
+        });
+        if(fwrite(&header, sizeof(header), 1, file) != 1) {
+            return false;
+        }
+        TLSFSnapshotBlock buffer[TLSFSnapshotBufferBlocks];
+        size_t buffered = 0;
+        bool succeeded = true;
+        auto flush = [&]() {
+            if(buffered && fwrite(buffer, sizeof(TLSFSnapshotBlock), buffered, file) != buffered) {
+                succeeded = false;
+            }
+            buffered = 0;
+        };
+        heap.walkPools([&]( const TLSFPool& pool ) {
+            // 先数一遍块，pool 记录要写在它的块前面
+            TLSFSnapshotPool poolRecord;
+            poolRecord.base = (uint64_t)(uintptr_t)pool.ptr();
+            poolRecord.capacity = pool.capacity();
+            poolRecord.blockCount = 0;
+            heap.walkBlocks(pool, [&]( const TLSFBlockInfo& ) {
+                ++poolRecord.blockCount;
+            });
+            if(!succeeded || fwrite(&poolRecord, sizeof(poolRecord), 1, file) != 1) {
+                succeeded = false;
+                return;
+            }
+            heap.walkBlocks(pool, [&]( const TLSFBlockInfo& block ) {
+                buffer[buffered].offset = (uint64_t)block.offset | (block.free ? 1 : 0);
+                buffer[buffered].size = block.size;
+                if(++buffered == TLSFSnapshotBufferBlocks) {
+                    flush();
+                }
+            });
+            flush();
+        });
+        return succeeded;
+    }
+
+}
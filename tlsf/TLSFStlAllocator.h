@@ -0,0 +1,94 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#include "TLSF.hpp"
+
+namespace ugi {
+
+    // every heap here returns at least pointer aligned blocks, stricter alignments go through allocAligned
+    constexpr size_t TLSFNaturalAlignment = sizeof(void*);
+
+    template< class HeapType >
+    inline void* tlsf_heap_allocate( HeapType& heap, size_t size, size_t align ) {
+        void* ptr = align <= TLSFNaturalAlignment ? heap.alloc(size) : heap.allocAligned(size, align);
+        if(!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    /*
+    ** Stateful STL allocator drawing from a heap : a TLSFBasic, a MemoryAllocator
+    ** or anything else with alloc / allocAligned / free. It only keeps a pointer,
+    ** copies share the heap and compare equal when the heap is the same, and the
+    ** heap travels with the container on copy, move and swap.
+    **
+    **   ugi::TLSF tlsf;   tlsf.initialize(pool);
+    **   std::vector<int, ugi::TLSFStlAllocator<int>> values(ugi::TLSFStlAllocator<int>(tlsf));
+    **
+    ** Failure throws std::bad_alloc, as containers expect. The allocator is as
+    ** thread safe as the heap, a bare TLSF is not.
+    */
+    template< class T, class HeapType = TLSFBasic<> >
+    class TLSFStlAllocator {
+    private:
+        template< class U, class H > friend class TLSFStlAllocator;
+        HeapType*       _heap;
+    public:
+        typedef T                   value_type;
+        typedef T*                  pointer;
+        typedef const T*            const_pointer;
+        typedef size_t              size_type;
+        typedef ptrdiff_t           difference_type;
+        typedef std::true_type      propagate_on_container_copy_assignment;
+        typedef std::true_type      propagate_on_container_move_assignment;
+        typedef std::true_type      propagate_on_container_swap;
+        template< class U >
+        struct rebind {
+            typedef TLSFStlAllocator<U, HeapType> other;
+        };
+
+        explicit TLSFStlAllocator( HeapType& heap ) noexcept
+            : _heap(&heap)
+        {}
+        template< class U >
+        TLSFStlAllocator( const TLSFStlAllocator<U, HeapType>& other ) noexcept
+            : _heap(other._heap)
+        {}
+
+        T* allocate( size_t count ) {
+            if(count > (size_t)-1 / sizeof(T)) {
+                throw std::bad_alloc();
+            }
+            return (T*)tlsf_heap_allocate(*_heap, count * sizeof(T), alignof(T));
+        }
+        void deallocate( T* ptr, size_t ) noexcept {
+            _heap->free(ptr);
+        }
+        HeapType& heap() const noexcept {
+            return *_heap;
+        }
+
+        template< class U >
+        bool operator==( const TLSFStlAllocator<U, HeapType>& other ) const noexcept {
+            return _heap == other._heap;
+        }
+        template< class U >
+        bool operator!=( const TLSFStlAllocator<U, HeapType>& other ) const noexcept {
+            return _heap != other._heap;
+        }
+    };
+
+}
@@ -0,0 +1,402 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <utility>
+
+#include "TLSFUtility.h"
+
+namespace ugi {
+
+    struct TLSFThreadCacheConfig {
+        size_t          maxCachedSize;          // requests above this go straight to the shared heap ( clamped to 2 KB )
+        uint32_t        magazineCapacity;       // blocks kept per size class per thread
+        uint32_t        refillCount;            // blocks fetched from the heap at once when a magazine runs dry
+        uint32_t        flushCount;             // blocks handed back to the heap at once when a magazine overflows
+        bool            drainOnThreadExit;      // false : blocks of exited threads stay cached until drainExitedThreads()
+        TLSFThreadCacheConfig()
+            : maxCachedSize(1024)
+            , magazineCapacity(64)
+            , refillCount(16)
+            , flushCount(32)
+            , drainOnThreadExit(true)
+        {}
+    };
+
+    /*
+    ** Per-thread magazine cache in front of a single shared heap.
+    ** Small and medium requests are binned with the heap's own queryBitmapLevelForAlloc
+    ** mapping and served from thread-local stacks without locking, the heap is only locked
+    ** to refill or flush a magazine in batches, or for requests above maxCachedSize.
+    ** With CompactAllocHeader heaps free also locks it, to read the block size ( SizeWordShared ).
+    **
+    ** The cache must be destroyed after every thread using it stopped allocating.
+    */
+    template< class HeapType >
+    class TLSFThreadCache {
+    public:
+        constexpr static size_t MaxClassCount = HeapType::SLC * 3;                              // first level 0..2
+        constexpr static size_t MaxCachesPerThread = 8;
+        // the size word of an allocated block is only written by its owner, except in headers that keep
+        // the previous block's free flag in it ( CompactAllocHeader ) : a neighbour's free rewrites it under _mutex
+        constexpr static bool SizeWordShared = HeapType::AllocHeader::TracksPrevFree;
+    private:
+        struct Magazine {
+            void**                          slots;
+            uint32_t                        count;
+        };
+        struct ThreadState {
+            std::atomic<TLSFThreadCache*>   owner;
+            std::atomic<uint32_t>           references;     // owner + thread, the last one deletes it
+            bool                            exited;
+            ThreadState*                    next;
+            void**                          storage;
+            Magazine                        magazines[MaxClassCount];
+        };
+        struct ThreadSlot {
+            uint64_t                        cacheId;
+            ThreadState*                    state;
+        };
+        struct ThreadSlots {
+            ThreadSlot                      slots[MaxCachesPerThread];
+            ThreadSlots()
+                : slots{}
+            {}
+            ~ThreadSlots() {
+                for (auto& slot : slots) {
+                    if (slot.state) {
+                        TLSFThreadCache* owner = slot.state->owner.load();
+                        if (owner) {
+                            owner->onThreadExit(slot.state);
+                        }
+                        releaseState(slot.state);
+                    }
+                }
+            }
+        };
+    private:
+        HeapType                            _heap;
+        std::mutex                          _mutex;             // guards _heap and _threadStates
+        TLSFThreadCacheConfig               _config;
+        uint64_t                            _cacheId;
+        size_t                              _classCount;
+        size_t                              _classSize[MaxClassCount];
+        ThreadState*                        _threadStates;
+        static std::atomic<uint64_t>        _nextCacheId;
+    private:
+        static ThreadSlots& threadSlots() {
+            static thread_local ThreadSlots slots;
+            return slots;
+        }
+
+        static void releaseState( ThreadState* state ) {
+            if (--state->references == 0) {
+                delete[] state->storage;
+                delete state;
+            }
+        }
+
+        inline size_t classIndex( size_t size ) {
+            auto level = _heap.queryBitmapLevelForAlloc(size);
+            return (size_t)level.firstLevel * HeapType::SLC + level.secondLevel;
+        }
+
+        // largest class whose level size still fits in the block
+        inline size_t blockClassIndex( size_t blockSize ) {
+            size_t index = classIndex(blockSize);
+            if (index < _classCount && _classSize[index] > blockSize) {
+                --index;
+            }
+            return index;
+        }
+
+        ThreadState* threadState() {
+            ThreadSlots& slots = threadSlots();
+            ThreadSlot* vacant = nullptr;
+            for (auto& slot : slots.slots) {
+                if (slot.cacheId == _cacheId) {
+                    return slot.state;
+                }
+                if (slot.state && !slot.state->owner.load()) {  // cache destroyed, recycle the slot
+                    releaseState(slot.state);
+                    slot.state = nullptr;
+                    slot.cacheId = 0;
+                }
+                if (!slot.state && !vacant) {
+                    vacant = &slot;
+                }
+            }
+            if (!vacant) {
+                return nullptr;
+            }
+            ThreadState* state = new ThreadState();
+            state->owner = this;
+            state->references = 2;
+            state->exited = false;
+            state->storage = new void*[_classCount * _config.magazineCapacity];
+            for (size_t i = 0; i < _classCount; ++i) {
+                state->magazines[i].slots = state->storage + i * _config.magazineCapacity;
+                state->magazines[i].count = 0;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                state->next = _threadStates;
+                _threadStates = state;
+            }
+            vacant->cacheId = _cacheId;
+            vacant->state = state;
+            return state;
+        }
+
+        // _mutex must be held
+        void flushMagazine( Magazine& magazine, uint32_t count ) {
+            for (uint32_t i = 0; i < count; ++i) {
+                _heap.free(magazine.slots[i]);
+            }
+            magazine.count -= count;
+            memmove(magazine.slots, magazine.slots + count, magazine.count * sizeof(void*));
+        }
+
+        // _mutex must be held
+        void flushState( ThreadState* state ) {
+            for (size_t i = 0; i < _classCount; ++i) {
+                flushMagazine(state->magazines[i], state->magazines[i].count);
+            }
+        }
+
+        // _mutex must be held
+        void unlinkState( ThreadState* state ) {
+            ThreadState** link = &_threadStates;
+            while (*link != state) {
+                link = &(*link)->next;
+            }
+            *link = state->next;
+        }
+
+        void* refill( Magazine& magazine, size_t index ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            while (magazine.count < _config.refillCount) {
+                void* ptr = _heap.alloc(_classSize[index]);
+                if (!ptr) {
+                    break;
+                }
+                magazine.slots[magazine.count++] = ptr;
+            }
+            return magazine.count ? magazine.slots[--magazine.count] : nullptr;
+        }
+
+        // the size is read under _mutex, the block still goes to the magazine when it has room
+        void freeLocked( void* ptr ) {
+            ThreadState* state = threadState();
+            std::lock_guard<std::mutex> lock(_mutex);
+            size_t index = blockClassIndex(_heap.queryAllocationSize(ptr));
+            if (index < _classCount && state) {
+                Magazine& magazine = state->magazines[index];
+                if (magazine.count == _config.magazineCapacity) {
+                    flushMagazine(magazine, _config.flushCount);
+                }
+                magazine.slots[magazine.count++] = ptr;
+                return;
+            }
+            _heap.free(ptr);
+        }
+
+        void onThreadExit( ThreadState* state ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            state->exited = true;
+            if (_config.drainOnThreadExit) {
+                flushState(state);
+                unlinkState(state);
+                state->owner = nullptr;
+                releaseState(state);
+            }
+        }
+    public:
+        TLSFThreadCache( const TLSFThreadCacheConfig& config = TLSFThreadCacheConfig() )
+            : _heap()
+            , _config(config)
+            , _cacheId(_nextCacheId++)
+            , _classCount(0)
+            , _classSize{}
+            , _threadStates(nullptr)
+        {
+            if (_config.maxCachedSize > (HeapType::FLM << 2)) {
+                _config.maxCachedSize = HeapType::FLM << 2;
+            }
+            if (!_config.magazineCapacity) {
+                _config.magazineCapacity = 1;
+            }
+            if (_config.refillCount > _config.magazineCapacity) {
+                _config.refillCount = _config.magazineCapacity;
+            }
+            if (_config.flushCount > _config.magazineCapacity || !_config.flushCount) {
+                _config.flushCount = _config.magazineCapacity;
+            }
+            for (size_t size = HeapType::MinimiumAllocationSize; size <= _config.maxCachedSize; size += HeapType::MinimiumAllocationSize) {
+                size_t index = classIndex(size);
+                _classSize[index] = _heap.queryAlignedLevelSize(size);
+                _classCount = index + 1;
+            }
+        }
+
+        ~TLSFThreadCache() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            while (_threadStates) {
+                ThreadState* state = _threadStates;
+                _threadStates = state->next;
+                flushState(state);
+                state->owner = nullptr;
+                releaseState(state);
+            }
+        }
+
+        template< class ...ARGS >
+        bool initialize( ARGS&& ...args ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.initialize( std::forward<ARGS>(args)... );
+        }
+
+        void* alloc( size_t size ) {
+            if (size && size <= _config.maxCachedSize) {
+                ThreadState* state = threadState();
+                if (state) {
+                    size_t index = classIndex(size);
+                    Magazine& magazine = state->magazines[index];
+                    if (magazine.count) {
+                        return magazine.slots[--magazine.count];
+                    }
+                    return refill(magazine, index);
+                }
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.alloc(size);
+        }
+
+        void* allocAligned( size_t size, size_t align ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.allocAligned(size, align);
+        }
+
+        void* realloc( void* ptr, size_t size ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.realloc(ptr, size);
+        }
+
+        // batches bypass the magazines, the heap is locked once per batch
+        size_t allocBatch( size_t size, size_t count, void** out ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.allocBatch(size, count, out);
+        }
+
+        void freeBatch( void** ptrs, size_t count ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _heap.freeBatch(ptrs, count);
+        }
+
+        bool tryExpand( void* ptr, size_t size ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.tryExpand(ptr, size);
+        }
+
+        void free( void* ptr ) {
+            if (SizeWordShared) {
+                freeLocked(ptr);
+                return;
+            }
+            size_t index = blockClassIndex(_heap.queryAllocationSize(ptr));
+            if (index < _classCount) {
+                ThreadState* state = threadState();
+                if (state) {
+                    Magazine& magazine = state->magazines[index];
+                    if (magazine.count == _config.magazineCapacity) {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        flushMagazine(magazine, _config.flushCount);
+                    }
+                    magazine.slots[magazine.count++] = ptr;
+                    return;
+                }
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _heap.free(ptr);
+        }
+
+        // hand every block cached by the calling thread back to the heap
+        void drainThread() {
+            ThreadState* state = threadState();
+            if (state) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                flushState(state);
+            }
+        }
+
+        // only needed with drainOnThreadExit == false
+        void drainExitedThreads() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ThreadState** link = &_threadStates;
+            while (*link) {
+                ThreadState* state = *link;
+                if (state->exited) {
+                    flushState(state);
+                    *link = state->next;
+                    state->owner = nullptr;
+                    releaseState(state);
+                }
+                else {
+                    link = &state->next;
+                }
+            }
+        }
+
+        // not synchronized, configure the heap before any thread allocates
+        HeapType& heap() {
+            return _heap;
+        }
+
+        const TLSFThreadCacheConfig& config() const {
+            return _config;
+        }
+
+        // blocks sitting in the magazines count as in use, the heap does not see them
+        typename HeapType::Stats getStats() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.getStats();
+        }
+
+        // blocks sitting in the magazines look allocated to the heap
+        TLSFVerifyResult verifyStep( size_t budget ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.verifyStep(budget);
+        }
+
+        // blocks sitting in the magazines are not free to the heap, they are never purged
+        void setPurgePolicy( size_t minimumBlockSize, uint64_t decay, TLSFPurgeAdvice advice = TLSFPurgeAdvice::DontNeed ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _heap.setPurgePolicy(minimumBlockSize, decay, advice);
+        }
+
+        size_t trim() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap.trim();
+        }
+
+        void dump() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _heap.dump();
+        }
+    };
+
+    template< class HeapType >
+    std::atomic<uint64_t> TLSFThreadCache<HeapType>::_nextCacheId(1);
+
+}
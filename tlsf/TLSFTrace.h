@@ -0,0 +1,388 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace ugi {
+
+    /*
+    ** Allocation trace file, native byte order :
+    **
+    **   TLSFTraceHeader
+    **   TLSFTraceHeader::eventCount x TLSFTraceEvent, in the order the slots were taken
+    **
+    ** The file is memory-mapped at its maximum size ( sparse, only written pages
+    ** get disk blocks ) and cut to the events actually written by close().
+    ** A free is logged before the block is released and an alloc / realloc
+    ** after it returns, so a replay in file order never sees an address handed
+    ** out twice without a free in between, except for the realloc / free races
+    ** of different threads, which tools/TraceReplay.cpp resolves first in first out.
+    */
+    constexpr char TLSFTraceMagic[8] = { 'T', 'L', 'S', 'F', 'T', 'R', 'A', 'C' };
+    constexpr uint32_t TLSFTraceVersion = 1;
+
+    enum class TLSFTraceEventType : uint8_t {
+        Alloc = 1,          // ptr = result, size
+        AllocAligned,       // ptr = result, size, aux = alignment
+        Realloc,            // ptr = result, size, aux = the block that was passed in
+        Expand,             // ptr, size : a successful tryExpand
+        Free,               // ptr
+    };
+
+    struct TLSFTraceHeader {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        eventSize;
+        uint64_t        eventCount;
+        uint64_t        droppedEvents;      // events after the file was full
+        uint64_t        ticksPerSecond;     // of TLSFTraceEvent timestamps
+    };
+
+    struct TLSFTraceEvent {
+        constexpr static uint64_t TimestampMask = (1ULL << 48) - 1;
+        constexpr static uint64_t SizeMask = (1ULL << 56) - 1;
+        uint64_t        timeAndThread;      // ticks since open() : 48, thread index : 16
+        uint64_t        sizeAndType;        // size : 56, TLSFTraceEventType : 8
+        uint64_t        ptr;
+        uint64_t        aux;
+        inline uint64_t timestamp() const {
+            return timeAndThread & TimestampMask;
+        }
+        inline uint32_t thread() const {
+            return (uint32_t)(timeAndThread >> 48);
+        }
+        inline uint64_t size() const {
+            return sizeAndType & SizeMask;
+        }
+        inline TLSFTraceEventType type() const {
+            return (TLSFTraceEventType)(sizeAndType >> 56);
+        }
+    };
+
+    static_assert(sizeof(TLSFTraceHeader) == 40 && sizeof(TLSFTraceEvent) == 32, "trace records must not have padding");
+
+    // a cheap monotonic tick, the time stamp counter where there is one
+    inline uint64_t tlsf_trace_ticks() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /*
+    ** Per-thread trace state. Reading the clock can cost more than the rest of
+    ** the event ( rdtsc traps in many virtual machines ), so a thread reads it
+    ** for every `TLSFTraceTickInterval`th event only and stamps the events in
+    ** between with the last reading. `slotLimit` is the first slot the thread
+    ** may not write without looking at the helper's progress again, it belongs
+    ** to the writer session `session`. Zero initialized, so reaching it costs
+    ** no guard, the index is given out when the thread records its first event.
+    ** The thread index is a small number that wraps after 65536 threads.
+    */
+    constexpr uint32_t TLSFTraceTickInterval = 16;
+
+    struct TLSFTraceThread {
+        uint64_t        ticks;
+        uint64_t        session;
+        uint64_t        slotLimit;
+        uint32_t        index;          // + 1, 0 until the first event
+        uint32_t        eventsToTick;
+    };
+
+    inline TLSFTraceThread& tlsf_trace_thread() {
+        static thread_local TLSFTraceThread thread;
+        return thread;
+    }
+
+    inline uint32_t tlsf_trace_next_thread_index() {
+        static std::atomic<uint32_t> nextIndex(0);
+        return nextIndex++;
+    }
+
+    inline uint64_t tlsf_trace_next_session() {
+        static std::atomic<uint64_t> nextSession(1);
+        return nextSession++;
+    }
+
+    /*
+    ** Lock-free trace log : every event takes a slot with one fetch_add and is
+    ** written into a small ring that stays in memory, a helper thread copies
+    ** the ring in slot order into the mapping. Fresh pages of the file cost
+    ** more to bring in than the event itself, this way only the helper pays
+    ** for them. When the ring is full the recording threads wait for it.
+    ** Events past `maxEvents` are counted as dropped, not written.
+    **
+    ** The fetch_add stays : the file order is the order the slots were taken,
+    ** and the replay depends on it across threads. Everything else on the
+    ** event's path is thread-local, the helper's progress is looked at once
+    ** per ring lap. Measured on one core of a virtual x86-64 machine :
+    **   record() alone            13 - 17 ns cpu, 23 - 37 ns wall per event
+    **   in benchmark/TraceBenchmark.cpp's churn   + 25 - 35 ns cpu, + 50 - 60 ns wall per op
+    ** So the 20 ns target is met for the event itself, on the recording thread.
+    ** It is not met on a single core, the helper then runs in between and
+    ** its copying evicts the allocator's cache lines, a spare core for the
+    ** helper is needed for that.
+    */
+    class TLSFTraceWriter {
+    private:
+        constexpr static uint64_t RingEvents = 1 << 15;     // 1 MB, a power of two
+        constexpr static uint64_t DrainBatch = 1 << 10;
+
+        struct RingEvent {
+            uint64_t                timeAndThread;
+            uint64_t                ptr;
+            uint64_t                aux;
+            std::atomic<uint64_t>   sizeAndType;        // written last, 0 while the slot is empty
+        };
+
+        uint8_t*                    _mapping;
+        size_t                      _mappingSize;
+        TLSFTraceEvent*             _events;
+        uint64_t                    _maxEvents;
+        RingEvent*                  _ring;
+        uint64_t                    _session;           // tells the threads' cached slot limits of earlier opens apart
+        alignas(64) std::atomic<uint64_t> _nextEvent;
+        alignas(64) std::atomic<uint64_t> _drainedEvents;   // published every `DrainBatch` events
+        alignas(64) uint64_t        _startTicks;
+        std::chrono::steady_clock::time_point _startTime;
+        std::thread                 _drainThread;
+        std::mutex                  _drainMutex;
+        std::condition_variable     _drainSignal;
+        bool                        _closing;
+#if defined(_WIN32)
+        HANDLE                      _file;
+        HANDLE                      _fileMapping;
+#else
+        int                         _file;
+#endif
+
+        void drain() {
+            uint64_t drained = 0;
+            for(;;) {
+                RingEvent& ringEvent = _ring[drained & (RingEvents - 1)];
+                uint64_t sizeAndType = ringEvent.sizeAndType.load(std::memory_order_acquire);
+                if(!sizeAndType) {
+                    _drainedEvents.store(drained, std::memory_order_release);
+                    std::unique_lock<std::mutex> lock(_drainMutex);
+                    if(_closing && drained >= (std::min)(_nextEvent.load(), _maxEvents)) {
+                        return;
+                    }
+                    _drainSignal.wait_for(lock, std::chrono::microseconds(200));
+                    continue;
+                }
+                TLSFTraceEvent& event = _events[drained];
+                event.timeAndThread = ringEvent.timeAndThread;
+                event.sizeAndType = sizeAndType;
+                event.ptr = ringEvent.ptr;
+                event.aux = ringEvent.aux;
+                ringEvent.sizeAndType.store(0, std::memory_order_relaxed);
+                if(!(++drained & (DrainBatch - 1))) {
+                    _drainedEvents.store(drained, std::memory_order_release);
+                }
+            }
+        }
+
+        // the slow part of record(), once per ring lap of a thread and when it starts on a new session
+        void waitForRing( TLSFTraceThread& thread, uint64_t slot ) {
+            if(!thread.index) {
+                thread.index = tlsf_trace_next_thread_index() + 1;
+            }
+            if(thread.session != _session) {
+                thread.session = _session;
+                thread.eventsToTick = 0;
+            }
+            uint64_t drained = _drainedEvents.load(std::memory_order_acquire);
+            while(slot - drained >= RingEvents) {
+                std::this_thread::yield();
+                drained = _drainedEvents.load(std::memory_order_acquire);
+            }
+            thread.slotLimit = drained + RingEvents;
+        }
+    public:
+        TLSFTraceWriter()
+            : _mapping(nullptr)
+            , _mappingSize(0)
+            , _events(nullptr)
+            , _maxEvents(0)
+            , _ring(nullptr)
+            , _session(0)
+            , _nextEvent(0)
+            , _drainedEvents(0)
+            , _startTicks(0)
+            , _closing(false)
+#if defined(_WIN32)
+            , _file(INVALID_HANDLE_VALUE)
+            , _fileMapping(nullptr)
+#else
+            , _file(-1)
+#endif
+        {}
+
+        ~TLSFTraceWriter() {
+            close();
+        }
+
+        TLSFTraceWriter( const TLSFTraceWriter& ) = delete;
+        TLSFTraceWriter& operator=( const TLSFTraceWriter& ) = delete;
+
+        bool open( const char* path, size_t maxEvents = 1 << 25 ) {
+            if(_mapping) {
+                return false;
+            }
+            size_t mappingSize = sizeof(TLSFTraceHeader) + maxEvents * sizeof(TLSFTraceEvent);
+#if defined(_WIN32)
+            _file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if(_file == INVALID_HANDLE_VALUE) {
+                return false;
+            }
+            _fileMapping = CreateFileMappingA(_file, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)mappingSize >> 32), (DWORD)mappingSize, nullptr);
+            _mapping = _fileMapping ? (uint8_t*)MapViewOfFile(_fileMapping, FILE_MAP_WRITE, 0, 0, mappingSize) : nullptr;
+            if(!_mapping) {
+                if(_fileMapping) {
+                    CloseHandle(_fileMapping);
+                    _fileMapping = nullptr;
+                }
+                CloseHandle(_file);
+                _file = INVALID_HANDLE_VALUE;
+                return false;
+            }
+#else
+            _file = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(_file < 0) {
+                return false;
+            }
+            void* mapping = MAP_FAILED;
+            if(ftruncate(_file, (off_t)mappingSize) == 0) {
+                mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+            }
+            if(mapping == MAP_FAILED) {
+                ::close(_file);
+                _file = -1;
+                return false;
+            }
+            _mapping = (uint8_t*)mapping;
+#endif
+            _mappingSize = mappingSize;
+            _events = (TLSFTraceEvent*)(_mapping + sizeof(TLSFTraceHeader));
+            _maxEvents = maxEvents;
+            _ring = new RingEvent[RingEvents];
+            for( uint64_t i = 0; i < RingEvents; ++i ) {
+                _ring[i].sizeAndType.store(0, std::memory_order_relaxed);
+            }
+            _nextEvent = 0;
+            _drainedEvents = 0;
+            _session = tlsf_trace_next_session();
+            _closing = false;
+            _drainThread = std::thread(&TLSFTraceWriter::drain, this);
+            _startTime = std::chrono::steady_clock::now();
+            _startTicks = tlsf_trace_ticks();
+            return true;
+        }
+
+        // writes the header and cuts the file to the written events, no thread may record any more
+        void close() {
+            if(!_mapping) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(_drainMutex);
+                _closing = true;
+            }
+            _drainSignal.notify_one();
+            _drainThread.join();
+            delete[] _ring;
+            _ring = nullptr;
+            // calibrate the ticks against the steady clock, over at least 10 ms
+            std::chrono::steady_clock::time_point now;
+            do {
+                now = std::chrono::steady_clock::now();
+            } while(now - _startTime < std::chrono::milliseconds(10));
+            uint64_t ticks = tlsf_trace_ticks() - _startTicks;
+            double seconds = std::chrono::duration<double>(now - _startTime).count();
+            uint64_t recorded = _nextEvent.load();
+            TLSFTraceHeader* header = (TLSFTraceHeader*)_mapping;
+            memcpy(header->magic, TLSFTraceMagic, sizeof(header->magic));
+            header->version = TLSFTraceVersion;
+            header->eventSize = sizeof(TLSFTraceEvent);
+            header->eventCount = recorded < _maxEvents ? recorded : _maxEvents;
+            header->droppedEvents = recorded - header->eventCount;
+            header->ticksPerSecond = (uint64_t)(ticks / seconds);
+            size_t fileSize = sizeof(TLSFTraceHeader) + header->eventCount * sizeof(TLSFTraceEvent);
+#if defined(_WIN32)
+            UnmapViewOfFile(_mapping);
+            CloseHandle(_fileMapping);
+            LARGE_INTEGER end;
+            end.QuadPart = (LONGLONG)fileSize;
+            SetFilePointerEx(_file, end, nullptr, FILE_BEGIN);
+            SetEndOfFile(_file);
+            CloseHandle(_file);
+            _fileMapping = nullptr;
+            _file = INVALID_HANDLE_VALUE;
+#else
+            munmap(_mapping, _mappingSize);
+            if(ftruncate(_file, (off_t)fileSize) != 0) {
+                // could not cut the zero filled tail, readers stop at eventCount anyway
+            }
+            ::close(_file);
+            _file = -1;
+#endif
+            _mapping = nullptr;
+            _events = nullptr;
+        }
+
+        bool isOpen() const {
+            return _mapping != nullptr;
+        }
+
+        inline void record( TLSFTraceEventType type, const void* ptr, size_t size, uint64_t aux = 0 ) {
+            uint64_t slot = _nextEvent.fetch_add(1, std::memory_order_relaxed);
+            if(slot >= _maxEvents) {
+                return;
+            }
+            TLSFTraceThread& thread = tlsf_trace_thread();
+            if(slot >= thread.slotLimit || thread.session != _session) {
+                waitForRing(thread, slot);
+            }
+            if(!thread.eventsToTick--) {
+                thread.ticks = tlsf_trace_ticks();
+                thread.eventsToTick = TLSFTraceTickInterval - 1;
+            }
+            RingEvent& ringEvent = _ring[slot & (RingEvents - 1)];
+            ringEvent.timeAndThread = ((thread.ticks - _startTicks) & TLSFTraceEvent::TimestampMask) | ((uint64_t)((thread.index - 1) & 0xffff) << 48);
+            ringEvent.ptr = (uint64_t)(uintptr_t)ptr;
+            ringEvent.aux = aux;
+            ringEvent.sizeAndType.store(((uint64_t)size & TLSFTraceEvent::SizeMask) | ((uint64_t)type << 56), std::memory_order_release);
+        }
+    };
+
+}
@@ -9,43 +9,169 @@
 ****************************************************/
 
 #include <new>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TLSF_STREAMING_COPY 1
+#else
+#define TLSF_STREAMING_COPY 0
+#endif
 
 namespace ugi {
 
+    // 超过这个大小的拷贝用 non-temporal store，目标不进 cache，也不会把 cache 里别的数据挤出去
+    constexpr size_t TLSFStreamingCopyThreshold = 4 * 1024 * 1024;
+
+#if TLSF_STREAMING_COPY
+    // dst 先按 16 字节对齐，之后每次 64 字节 : 先读完再用 stream 写
+    inline void tlsf_stream_copy( uint8_t* dst, const uint8_t* src, size_t size ) {
+        size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        size -= head;
+        for( ; size >= 64; size -= 64, dst += 64, src += 64 ) {
+            __m128i a = _mm_loadu_si128((const __m128i*)src);
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+            __m128i c = _mm_loadu_si128((const __m128i*)(src + 32));
+            __m128i d = _mm_loadu_si128((const __m128i*)(src + 48));
+            _mm_stream_si128((__m128i*)dst, a);
+            _mm_stream_si128((__m128i*)(dst + 16), b);
+            _mm_stream_si128((__m128i*)(dst + 32), c);
+            _mm_stream_si128((__m128i*)(dst + 48), d);
+        }
+        _mm_sfence();
+        memcpy(dst, src, size);
+    }
+#endif
+
+    // 不重叠的拷贝，realloc 换块的时候用
+    inline void tlsf_copy_memory( void* dst, const void* src, size_t size ) {
+#if TLSF_STREAMING_COPY
+        if(size >= TLSFStreamingCopyThreshold) {
+            tlsf_stream_copy((uint8_t*)dst, (const uint8_t*)src, size);
+            return;
+        }
+#endif
+        memcpy(dst, src, size);
+    }
+
+    // 可能重叠的拷贝，只有不重叠的时候才走 stream
+    inline void tlsf_move_memory( void* dst, const void* src, size_t size ) {
+#if TLSF_STREAMING_COPY
+        if(size >= TLSFStreamingCopyThreshold && ((const uint8_t*)src + size <= (uint8_t*)dst || (uint8_t*)dst + size <= (const uint8_t*)src)) {
+            tlsf_stream_copy((uint8_t*)dst, (const uint8_t*)src, size);
+            return;
+        }
+#endif
+        memmove(dst, src, size);
+    }
+
+    /* where TLSFPool::createPool takes the memory from. Mapped pools are Linux only,
+       elsewhere every flag falls back to new[]. TLSFPool::flags() tells what was granted */
+    enum TLSFPoolFlags : uint32_t {
+        TLSFPoolHeapMemory  = 0,        // new[]
+        TLSFPoolMapped      = 1 << 0,   // anonymous private mmap, implied by all the flags below
+        TLSFPoolHugePages   = 1 << 1,   // 2 MB aligned and MADV_HUGEPAGE ( transparent huge pages )
+        TLSFPoolHugetlb     = 1 << 2,   // MAP_HUGETLB from the reserved huge pages, else falls back to TLSFPoolHugePages
+        TLSFPoolPopulate    = 1 << 3,   // every page faulted in by createPool, not by the first allocation that touches it
+        TLSFPoolLocked      = 1 << 4,   // mlock, not granted when RLIMIT_MEMLOCK is too low
+    };
+
+    constexpr size_t TLSFHugePageSize = 2 * 1024 * 1024;
+
+    inline size_t tlsf_page_size() {
+#if defined(__linux__)
+        static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        return pageSize;
+#else
+        return 4096;
+#endif
+    }
+
+    // how purged pages go back to the system : DontNeed drops them at once ( RSS falls right away ),
+    // Free lets the kernel take them lazily under memory pressure ( Linux 4.5, else DontNeed )
+    enum class TLSFPurgeAdvice : uint8_t {
+        DontNeed,
+        Free,
+    };
+
+    // releases the whole pages of [begin, begin + size), their contents are lost. Linux only, false elsewhere
+    inline bool tlsf_purge_pages( void* begin, size_t size, TLSFPurgeAdvice advice ) {
+#if defined(__linux__)
+#if defined(MADV_FREE)
+        if(advice == TLSFPurgeAdvice::Free && madvise(begin, size, MADV_FREE) == 0) {
+            return true;
+        }
+#endif
+        return madvise(begin, size, MADV_DONTNEED) == 0;
+#else
+        (void)begin;
+        (void)size;
+        (void)advice;
+        return false;
+#endif
+    }
+
     class TLSFPool {
     private:
+        struct alignas(16) AlignType {
+            alignas(16) uint32_t data[4];
+        };
         void*       _memptr;
         size_t      _capacity;
+        bool        _retirable;     // pool came from a TLSFPoolProvider and can be handed back
+        uint32_t    _flags;         // TLSFPoolFlags granted by createPool, destroyPool frees accordingly
     public:
         TLSFPool() 
             : _memptr(nullptr)
             , _capacity(0)
+            , _retirable(false)
+            , _flags(TLSFPoolHeapMemory)
         {
         }
-        TLSFPool( void* ptr, size_t capacity )
+        TLSFPool( void* ptr, size_t capacity, bool retirable = false, uint32_t flags = TLSFPoolHeapMemory )
             : _memptr(ptr)
             , _capacity(capacity)
+            , _retirable(retirable)
+            , _flags(flags)
         {
         }
-        TLSFPool( TLSFPool& pool ) {
+        TLSFPool( const TLSFPool& pool ) {
             _memptr = pool._memptr;
             _capacity = pool._capacity;
+            _retirable = pool._retirable;
+            _flags = pool._flags;
         }
         TLSFPool( TLSFPool&& pool) noexcept {
             _memptr = pool._memptr;
             _capacity = pool._capacity;
+            _retirable = pool._retirable;
+            _flags = pool._flags;
             pool._capacity = 0;
             pool._memptr = nullptr;
         }
         TLSFPool& operator =(TLSFPool&& pool) noexcept {
             _memptr = pool._memptr;
             _capacity = pool._capacity;
+            _retirable = pool._retirable;
+            _flags = pool._flags;
             return *this;
         }
         inline bool check_next_contains(void* ptr) const {
             return ptr < (uint8_t*)_memptr + _capacity;
         }
-        inline bool contains( void* ptr ) const {
+        inline bool contains( const void* ptr ) const {
             return ptr>=_memptr && ptr< ((uint8_t*)_memptr + _capacity) ;
         }
         inline size_t capacity() const {
@@ -57,17 +183,176 @@ namespace ugi {
         inline void* endPtr() const {
             return (uint8_t*)_memptr + _capacity;
         }
-        static TLSFPool createPool( size_t capacity ) {
-            struct alignas(16) AlignType {
-                alignas(16) uint32_t data[4];
-            };
+        inline bool retirable() const {
+            return _retirable;
+        }
+        inline void setRetirable( bool retirable ) {
+            _retirable = retirable;
+        }
+        inline uint32_t flags() const {
+            return _flags;
+        }
+        // mapped pools round the capacity up to the page size ( 2 MB for huge pages )
+        static TLSFPool createPool( size_t capacity, uint32_t flags = TLSFPoolHeapMemory ) {
+#if defined(__linux__)
+            if(flags) {
+                return createMappedPool(capacity, flags);
+            }
+#endif
             capacity = (capacity + 15ULL) & ~(15ULL);
-            void* ptr = new AlignType[capacity>>4];
+            void* ptr = new (std::nothrow) AlignType[capacity>>4];
             if(!ptr) {
                 return TLSFPool(nullptr, 0);
             }
             return TLSFPool(ptr, capacity);
         }
+        // only for pools returned by createPool
+        static void destroyPool( TLSFPool& pool ) {
+#if defined(__linux__)
+            if(pool._flags & TLSFPoolMapped) {
+                munmap(pool._memptr, pool._capacity); // unlocks too
+                pool._memptr = nullptr;
+            }
+#endif
+            delete[] (AlignType*)pool._memptr;
+            pool._memptr = nullptr;
+            pool._capacity = 0;
+        }
+    private:
+#if defined(__linux__)
+        static inline size_t roundUp( size_t size, size_t alignment ) {
+            return (size + alignment - 1) & ~(alignment - 1);
+        }
+        // huge page requests fall back step by step : hugetlb -> transparent huge pages -> normal pages
+        static TLSFPool createMappedPool( size_t capacity, uint32_t flags ) {
+            const int protection = PROT_READ | PROT_WRITE;
+            const int mapping = MAP_PRIVATE | MAP_ANONYMOUS;
+            uint32_t granted = TLSFPoolMapped;
+            bool populated = false;
+            void* ptr = MAP_FAILED;
+            if(flags & TLSFPoolHugetlb) {
+                size_t hugeCapacity = roundUp(capacity, TLSFHugePageSize);
+                ptr = mmap(nullptr, hugeCapacity, protection, mapping | MAP_HUGETLB | ((flags & TLSFPoolPopulate) ? MAP_POPULATE : 0), -1, 0);
+                if(ptr != MAP_FAILED) {
+                    capacity = hugeCapacity;
+                    granted |= TLSFPoolHugetlb;
+                    populated = true;
+                } else {
+                    flags |= TLSFPoolHugePages;
+                }
+            }
+            if(ptr == MAP_FAILED && (flags & TLSFPoolHugePages)) {
+                // over-map by one huge page and cut the ends off, so the pool starts on a huge page
+                size_t hugeCapacity = roundUp(capacity, TLSFHugePageSize);
+                uint8_t* region = (uint8_t*)mmap(nullptr, hugeCapacity + TLSFHugePageSize, protection, mapping, -1, 0);
+                if(region != (uint8_t*)MAP_FAILED) {
+                    uint8_t* aligned = (uint8_t*)roundUp((uintptr_t)region, TLSFHugePageSize);
+                    size_t head = aligned - region;
+                    if(head) {
+                        munmap(region, head);
+                    }
+                    if(TLSFHugePageSize - head) {
+                        munmap(aligned + hugeCapacity, TLSFHugePageSize - head);
+                    }
+                    ptr = aligned;
+                    capacity = hugeCapacity;
+                    if(madvise(ptr, capacity, MADV_HUGEPAGE) == 0) {
+                        granted |= TLSFPoolHugePages;
+                    }
+                }
+            }
+            if(ptr == MAP_FAILED) {
+                capacity = roundUp(capacity, (size_t)sysconf(_SC_PAGESIZE));
+                ptr = mmap(nullptr, capacity, protection, mapping | ((flags & TLSFPoolPopulate) ? MAP_POPULATE : 0), -1, 0);
+                if(ptr == MAP_FAILED) {
+                    return TLSFPool();
+                }
+                populated = true;
+            }
+            if(flags & TLSFPoolPopulate) {
+                if(!populated) {
+                    populatePages(ptr, capacity);
+                }
+                granted |= TLSFPoolPopulate;
+            }
+            if((flags & TLSFPoolLocked) && mlock(ptr, capacity) == 0) {
+                granted |= TLSFPoolLocked;
+            }
+            return TLSFPool(ptr, capacity, false, granted);
+        }
+        // MADV_POPULATE_WRITE is Linux 5.14, older kernels get every page written once
+        static void populatePages( void* ptr, size_t capacity ) {
+            const int populateWrite = 23; // MADV_POPULATE_WRITE
+            if(madvise(ptr, capacity, populateWrite) == 0) {
+                return;
+            }
+            size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+            for( size_t offset = 0; offset < capacity; offset += pageSize ) {
+                ((volatile uint8_t*)ptr)[offset] = 0;
+            }
+        }
+#endif
+    };
+
+    // one physical block as seen by TLSFBasic::walkBlocks
+    struct TLSFBlockInfo {
+        const TLSFPool*     pool;
+        void*               ptr;        // user pointer of the block
+        size_t              offset;     // offset of the block header from the pool base
+        size_t              size;       // usable size, block header not included
+        bool                free;
+    };
+
+    // result of TLSFBasic::verifyStep / verifyPool / verifyFreeLists
+    struct TLSFVerifyResult {
+        const char*         error;          // first broken invariant, nullptr if everything checked held
+        const void*         block;          // header of the block or free list node it was found at
+        size_t              checked;        // blocks, free list nodes and bins looked at
+        bool                passCompleted;  // verifyStep : this call finished a pass over every pool and free list
+        inline bool ok() const {
+            return !error;
+        }
+    };
+
+    /* supplies pools to a growing TLSF heap and takes them back once they are
+       completely free, must outlive the heap it is attached to */
+    class TLSFPoolProvider {
+    public:
+        virtual ~TLSFPoolProvider() {}
+        // return a pool of at least `minimumCapacity` bytes, or an empty pool on failure
+        virtual TLSFPool acquirePool( size_t minimumCapacity ) = 0;
+        virtual void releasePool( TLSFPool& pool ) = 0;
+    };
+
+    /* geometric growth: every new pool is `growthFactor` times bigger than the
+       previous one, capped at `maxCapacity` ( the default TLSF only takes pools below 2 GB ),
+       `poolFlags` picks the backend of every pool ( TLSFPoolFlags ) */
+    class TLSFGeometricPoolProvider : public TLSFPoolProvider {
+    private:
+        size_t      _nextCapacity;
+        size_t      _growthFactor;
+        size_t      _maxCapacity;
+        uint32_t    _poolFlags;
+    public:
+        TLSFGeometricPoolProvider( size_t initialCapacity = 64 * 1024, size_t growthFactor = 2, size_t maxCapacity = 1ULL << 30, uint32_t poolFlags = TLSFPoolHeapMemory )
+            : _nextCapacity(initialCapacity)
+            , _growthFactor(growthFactor)
+            , _maxCapacity(maxCapacity)
+            , _poolFlags(poolFlags)
+        {}
+        virtual TLSFPool acquirePool( size_t minimumCapacity ) override {
+            if (minimumCapacity > _maxCapacity) {
+                return TLSFPool();
+            }
+            size_t capacity = _nextCapacity > minimumCapacity ? _nextCapacity : minimumCapacity;
+            if (_nextCapacity < _maxCapacity) {
+                _nextCapacity = _nextCapacity * _growthFactor < _maxCapacity ? _nextCapacity * _growthFactor : _maxCapacity;
+            }
+            return TLSFPool::createPool(capacity, _poolFlags);
+        }
+        virtual void releasePool( TLSFPool& pool ) override {
+            TLSFPool::destroyPool(pool);
+        }
     };
 
     /* simple vector/array implementation for TLSF*/
@@ -78,6 +363,17 @@ namespace ugi {
         T*          _data;
         size_t      _size;
         size_t      _capacity;
+    private:
+        void grow() {
+            size_t capacity = _capacity ? _capacity * 2 : 4;
+            auto data = new T[capacity];
+            for (size_t i = 0; i < _size; ++i) {
+                data[i] = std::move(_data[i]);
+            }
+            delete[]_data;
+            _data = data;
+            _capacity = capacity;
+        }
     public:
         TLSFVector( size_t size ) {
             _capacity = (size_t)ceil(log2(size));
@@ -87,20 +383,44 @@ namespace ugi {
         template< class ...ARGS >
         void emplace_back( ARGS&& ...args ) {
             if (_size == _capacity) {
-                auto data = new T[_capacity*2];
-                _capacity <<= 1;
-                for (size_t i = 0; i < _size; ++i) {
-                    data[i] = std::move(_data[i]);
-                }
-                free(_data);
-                _data = (T*)data;
+                grow();
+            }
+            _data[_size] = T(std::forward<ARGS>(args)...);
+            ++_size;
+        }
+        // keeps the order of the elements, O(n) moves
+        void insert( size_t index, T&& value ) {
+            assert(index <= _size);
+            if (_size == _capacity) {
+                grow();
+            }
+            for (size_t i = _size; i > index; --i) {
+                _data[i] = std::move(_data[i-1]);
             }
-            new(&_data[_size])T(std::forward<ARGS>(args)...);
+            _data[index] = std::move(value);
             ++_size;
         }
+        void erase( size_t index ) {
+            assert(index < _size);
+            for (size_t i = index + 1; i < _size; ++i) {
+                _data[i-1] = std::move(_data[i]);
+            }
+            --_size;
+        }
         size_t size() const {
             return _size;
         }
+        void swap( TLSFVector& other ) {
+            std::swap(_data, other._data);
+            std::swap(_size, other._size);
+            std::swap(_capacity, other._capacity);
+        }
+        T& operator[](size_t index) {
+            return _data[index];
+        }
+        const T& operator[](size_t index) const {
+            return _data[index];
+        }
         const T* begin() const {
             return _data;
         }
@@ -114,6 +434,62 @@ namespace ugi {
         }
     };
 
+    /* pools sorted by base address, so the owner of a pointer is found by a
+       branchless binary search instead of scanning every pool, PoolType is
+       TLSFPool or something derived from it that carries extra per-pool data */
+    template< class PoolType >
+    class TLSFBasicPoolRegistry {
+    private:
+        TLSFVector<PoolType>    _pools;
+    public:
+        TLSFBasicPoolRegistry()
+            : _pools(4)
+        {}
+        void add( const PoolType& pool ) {
+            size_t index = 0;
+            while (index < _pools.size() && _pools[index].ptr() < pool.ptr()) {
+                ++index;
+            }
+            _pools.insert(index, PoolType(pool));
+        }
+        bool remove( void* ptr ) {
+            const PoolType* pool = locate(ptr);
+            if (!pool || pool->ptr() != ptr) {
+                return false;
+            }
+            _pools.erase(pool - _pools.begin());
+            return true;
+        }
+        // returned pointer is invalidated by add/remove
+        inline const PoolType* locate( const void* ptr ) const {
+            size_t count = _pools.size();
+            if (!count) {
+                return nullptr;
+            }
+            const PoolType* base = _pools.begin();
+            while (count > 1) {
+                size_t half = count >> 1;
+                base = (base[half].ptr() <= ptr) ? base + half : base;
+                count -= half;
+            }
+            return base->contains(ptr) ? base : nullptr;
+        }
+        size_t size() const {
+            return _pools.size();
+        }
+        void swap( TLSFBasicPoolRegistry& other ) {
+            _pools.swap(other._pools);
+        }
+        const PoolType* begin() const {
+            return _pools.begin();
+        }
+        const PoolType* end() const {
+            return _pools.end();
+        }
+    };
+
+    typedef TLSFBasicPoolRegistry<TLSFPool> TLSFPoolRegistry;
+
     template< class T, size_t SIZE>
     class TLSFArray {
     private:
@@ -132,10 +508,17 @@ namespace ugi {
 
         static constexpr size_t TrueSize = 16;
         static constexpr size_t FullSize = 32;
+        static constexpr size_t SizeBits = sizeof(size_t) * 8 - 1;     // 64 位下 63 bits，块和 pool 可以超过 4GB
+        static constexpr size_t Alignment = 16;                         // ptr() 的对齐
+        static constexpr size_t MinimumFreeSize = sizeof(void*) * 2;    // 空闲块至少要放得下两个链表指针
+        static constexpr size_t PoolTailSize = 0;                       // pool 末尾不需要哨兵
+        static constexpr bool TracksPrevFree = false;                   // 前一块的 free 状态不存在本块里
+        static constexpr bool PositionIndependent = false;              // 链表存的是绝对地址
+        typedef AllocHeader* Link;                                      // 空闲链表表头的类型
 
         alignas(sizeof(size_t))     AllocHeader*            prevPhyAlloc;
         struct alignas(sizeof(size_t)) {
-            size_t                                          size:31;    // 这里是为了省内存
+            size_t                                          size:SizeBits;    // 和 free 共用一个字
             size_t                                          free:1;
             //size_t                                          flags:1;    // 本来可能会觉得除了free还有其它属性目前发现不需要其它属性了，只需要Free就够了
         };
@@ -149,6 +532,25 @@ namespace ugi {
             free = 1;
             prevPhyAlloc = prevPhysic;
         }
+        inline size_t blockSize() const {
+            return size;
+        }
+        inline void setBlockSize( size_t newSize ) {
+            size = newSize;
+        }
+        inline bool isFree() const {
+            return free;
+        }
+        inline void setFree( bool isFree ) {
+            free = isFree ? 1 : 0;
+        }
+        // 前一个物理块，第一个块是 nullptr
+        inline AllocHeader* prevPhysical() const {
+            return prevPhyAlloc;
+        }
+        inline void setPrevPhysical( AllocHeader* prev ) {
+            prevPhyAlloc = prev;
+        }
         inline void* ptr() {
             return ((uint8_t*)this) + TrueSize;
         }
@@ -161,4 +563,168 @@ namespace ugi {
     };
     static_assert( AllocHeader::TrueSize == sizeof(AllocHeader) - sizeof(void*)*2, "must be true" );
     static_assert( AllocHeader::FullSize == sizeof(AllocHeader), "must be true" );
+
+    /*
+    ** 紧凑的块头，每块只多占一个字（和 Conte 的 TLSF 一样）：
+    ** size 按 Alignment 对齐，低两位放本块的 free 和前一块的 prev-free 标记。
+    ** 前一个物理块只有在它空闲、需要合并的时候才用得到，所以它的地址只在它空闲的时候
+    ** 存在它自己的最后一个字里（footer，也就是本块头前面的那个字），分配出去以后这个字就是用户数据。
+    ** ptr() 只保证按字对齐，每个 pool 末尾留一个字做哨兵块头，最后一个块的下一块也总是可写的。
+    ** 用法 : TLSFBasic<5, 8, 31, CompactAllocHeader>
+    */
+    struct CompactAllocHeader {
+
+        static constexpr size_t TrueSize = sizeof(size_t);
+        static constexpr size_t FullSize = sizeof(size_t) * 3;
+        static constexpr size_t SizeBits = sizeof(size_t) * 8 - 1;
+        static constexpr size_t Alignment = sizeof(size_t);
+        static constexpr size_t MinimumFreeSize = sizeof(void*) * 3;    // 两个链表指针 + footer
+        static constexpr size_t PoolTailSize = TrueSize;                // 哨兵块头
+        static constexpr bool TracksPrevFree = true;                    // 前一块的 free 状态存在本块的标记里
+        static constexpr bool PositionIndependent = false;
+        typedef CompactAllocHeader* Link;
+        static constexpr size_t FreeBit = 1;
+        static constexpr size_t PrevFreeBit = 2;
+        static constexpr size_t FlagMask = FreeBit | PrevFreeBit;
+
+        alignas(sizeof(size_t))     size_t                  sizeAndFlags;
+        // 和 AllocHeader 一样，只有空闲的时候才有效
+        alignas(sizeof(size_t))     CompactAllocHeader*     prevFreeAlloc;
+        alignas(sizeof(size_t))     CompactAllocHeader*     nextFreeAlloc;
+        //
+        inline size_t blockSize() const {
+            return sizeAndFlags & ~FlagMask;
+        }
+        inline void setBlockSize( size_t newSize ) {
+            sizeAndFlags = newSize | (sizeAndFlags & FlagMask);
+        }
+        inline bool isFree() const {
+            return (sizeAndFlags & FreeBit) != 0;
+        }
+        inline void setFree( bool isFree ) {
+            sizeAndFlags = isFree ? (sizeAndFlags | FreeBit) : (sizeAndFlags & ~FreeBit);
+        }
+        // 只有前一块空闲的时候才知道它在哪，否则是 nullptr
+        inline CompactAllocHeader* prevPhysical() const {
+            return (sizeAndFlags & PrevFreeBit) ? ((CompactAllocHeader* const*)this)[-1] : nullptr;
+        }
+        // prev 的 free 状态要先设好，已分配的 prev 只清掉标记，不碰它的数据
+        inline void setPrevPhysical( CompactAllocHeader* prev ) {
+            if(prev && prev->isFree()) {
+                ((CompactAllocHeader**)this)[-1] = prev;
+                sizeAndFlags |= PrevFreeBit;
+            } else {
+                sizeAndFlags &= ~PrevFreeBit;
+            }
+        }
+        inline void* ptr() {
+            return ((uint8_t*)this) + TrueSize;
+        }
+        inline CompactAllocHeader* nextPhyAllocation() {
+            return (CompactAllocHeader*)(((uint8_t*)this) + TrueSize + blockSize());
+        }
+        static CompactAllocHeader* fromPtr( void* ptr ) {
+            return (CompactAllocHeader*)(((uint8_t*)ptr) - TrueSize);
+        }
+    };
+    static_assert( CompactAllocHeader::FullSize == sizeof(CompactAllocHeader), "must be true" );
+
+    /*
+    ** 存相对自己地址的偏移的指针，0 是空指针（块头和表头里的链表指针不会指向自己）。
+    ** 拷贝的时候按新的位置重新算偏移，所以一整块内存挪到别的地址以后，指向这块内存里面的指针还是对的。
+    ** 用在 RelativeAllocHeader 里，放在映射文件里的用户数据也可以用它
+    */
+    template< class T >
+    class TLSFRelativePtr {
+    private:
+        intptr_t    _offset;
+        inline void set( T* ptr ) {
+            _offset = ptr ? (intptr_t)((uintptr_t)ptr - (uintptr_t)this) : 0;
+        }
+    public:
+        TLSFRelativePtr()
+            : _offset(0)
+        {}
+        TLSFRelativePtr( T* ptr ) {
+            set(ptr);
+        }
+        TLSFRelativePtr( const TLSFRelativePtr& other ) {
+            set(other.get());
+        }
+        TLSFRelativePtr& operator =( const TLSFRelativePtr& other ) {
+            set(other.get());
+            return *this;
+        }
+        TLSFRelativePtr& operator =( T* ptr ) {
+            set(ptr);
+            return *this;
+        }
+        inline T* get() const {
+            return _offset ? (T*)((uintptr_t)this + (uintptr_t)_offset) : nullptr;
+        }
+        inline operator T*() const {
+            return get();
+        }
+        inline T* operator->() const {
+            return get();
+        }
+    };
+
+    /*
+    ** 和 AllocHeader 一样大、一样的布局，三个链表指针存的是 TLSFRelativePtr。
+    ** 堆对象（里面的空闲链表表头也是 TLSFRelativePtr）和它的 pool 放在同一块映射里的话，
+    ** 整个堆没有一个绝对地址，映射到别的地址（比如进程重启以后）可以直接接着用，见 TLSFBasic::reattach。
+    ** 每次访问链表多一次加法。用法 : TLSFBasic<5, 16, 31, RelativeAllocHeader>
+    */
+    struct RelativeAllocHeader {
+
+        static constexpr size_t TrueSize = 16;
+        static constexpr size_t FullSize = 32;
+        static constexpr size_t SizeBits = sizeof(size_t) * 8 - 1;
+        static constexpr size_t Alignment = 16;
+        static constexpr size_t MinimumFreeSize = sizeof(void*) * 2;
+        static constexpr size_t PoolTailSize = 0;
+        static constexpr bool TracksPrevFree = false;
+        static constexpr bool PositionIndependent = true;
+        typedef TLSFRelativePtr<RelativeAllocHeader> Link;
+
+        alignas(sizeof(size_t))     Link                    prevPhyAlloc;
+        struct alignas(sizeof(size_t)) {
+            size_t                                          size:SizeBits;
+            size_t                                          free:1;
+        };
+        // 只有空闲的时候才有效
+        alignas(sizeof(size_t))     Link                    prevFreeAlloc;
+        alignas(sizeof(size_t))     Link                    nextFreeAlloc;
+        //
+        inline size_t blockSize() const {
+            return size;
+        }
+        inline void setBlockSize( size_t newSize ) {
+            size = newSize;
+        }
+        inline bool isFree() const {
+            return free;
+        }
+        inline void setFree( bool isFree ) {
+            free = isFree ? 1 : 0;
+        }
+        // 前一个物理块，第一个块是 nullptr
+        inline RelativeAllocHeader* prevPhysical() const {
+            return prevPhyAlloc;
+        }
+        inline void setPrevPhysical( RelativeAllocHeader* prev ) {
+            prevPhyAlloc = prev;
+        }
+        inline void* ptr() {
+            return ((uint8_t*)this) + TrueSize;
+        }
+        inline RelativeAllocHeader* nextPhyAllocation() {
+            return (RelativeAllocHeader*)(((uint8_t*)this) + TrueSize + size);
+        }
+        static RelativeAllocHeader* fromPtr( void* ptr ) {
+            return (RelativeAllocHeader*)(((uint8_t*)ptr) - TrueSize);
+        }
+    };
+    static_assert( RelativeAllocHeader::FullSize == sizeof(RelativeAllocHeader), "must be true" );
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+﻿#pragma once
+
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "TLSFUtility.h"
+
+namespace ugi {
+
+    /*
+    ** Full consistency check of `heap` ( a TLSFBasic ), the physical block
+    ** chains of the pools spread over `threadCount` threads while the calling
+    ** thread checks the bitmaps and free lists. Every pool is checked even
+    ** after an error, the result is the error of the lowest pool ( the free
+    ** lists come last ). `checked` adds up all threads.
+    **
+    ** The heap must not change while this runs, lock the front-end around it.
+    ** For a bounded pause on a live heap use TLSFBasic::verifyStep instead.
+    ** The pool list and the threads come from the global heap, do not run
+    ** this on a heap that backs malloc.
+    */
+    template< class HeapType >
+    TLSFVerifyResult tlsf_verify_heap( const HeapType& heap, size_t threadCount = 1 ) {
+        std::vector<const TLSFPool*> pools;
+        heap.walkPools([&]( const TLSFPool& pool ) {
+            pools.push_back(&pool);
+        });
+        std::vector<TLSFVerifyResult> results(pools.size());
+        std::atomic<size_t> nextPool(0);
+        auto verifyPools = [&]() {
+            for( size_t index = nextPool++; index < pools.size(); index = nextPool++ ) {
+                results[index] = heap.verifyPool(*pools[index]);
+            }
+        };
+        threadCount = threadCount < pools.size() ? threadCount : pools.size();
+        std::vector<std::thread> threads;
+        for( size_t i = 0; i < threadCount; ++i ) {
+            threads.emplace_back(verifyPools);
+        }
+        TLSFVerifyResult freeLists = heap.verifyFreeLists();
+        if(threads.empty()) {
+            verifyPools();
+        }
+        for( auto& thread : threads ) {
+            thread.join();
+        }
+        TLSFVerifyResult result{};
+        for( const TLSFVerifyResult& poolResult : results ) {
+            if(result.ok() && !poolResult.ok()) {
+                result.error = poolResult.error;
+                result.block = poolResult.block;
+            }
+            result.checked += poolResult.checked;
+        }
+        if(result.ok() && !freeLists.ok()) {
+            result.error = freeLists.error;
+            result.block = freeLists.block;
+        }
+        result.checked += freeLists.checked;
+        result.passCompleted = true;
+        return result;
+    }
+
+}
@@ -231,4 +231,18 @@ tlsf_decl int tlsf_fls_sizet(size_t size)
 }
 #else
 #define tlsf_fls_sizet tlsf_fls
-#endif
\ No newline at end of file
+#endif
+
+/* 64-bit version of tlsf_ffs, for 64-bit bitmaps. Word must not be 0. */
+tlsf_decl int tlsf_ffs64(unsigned long long word)
+{
+	const unsigned int low = (unsigned int)(word & 0xffffffff);
+	return low ? tlsf_ffs(low) : 32 + tlsf_ffs((unsigned int)(word >> 32));
+}
+
+/* 64-bit version of tlsf_fls, for 64-bit bitmaps. */
+tlsf_decl int tlsf_fls64(unsigned long long word)
+{
+	const unsigned int high = (unsigned int)(word >> 32);
+	return high ? 32 + tlsf_fls(high) : tlsf_fls((unsigned int)(word & 0xffffffff));
+}
\ No newline at end of file
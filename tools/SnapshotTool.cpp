@@ -0,0 +1,255 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Offline reader for heap snapshots written by tlsf_write_snapshot.
+**
+**   tlsf_snapshot summary <snapshot>
+**       pools, used / free bytes, largest hole, fragmentation index and a
+**       power of two histogram of the free block sizes
+**   tlsf_snapshot diff <before> <after>
+**       the same numbers side by side, plus which blocks appeared, went away
+**       or stayed put in the pools both snapshots share
+**
+** Fragmentation index is 1 - largest free block / free bytes : 0 when all free
+** memory is one hole, close to 1 when it is scattered over many small holes.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "TLSFSnapshot.h"
+
+namespace {
+
+    constexpr size_t HistogramBuckets = 64;
+
+    struct Pool {
+        ugi::TLSFSnapshotPool                   record;
+        std::vector<ugi::TLSFSnapshotBlock>     blocks;
+    };
+
+    struct Snapshot {
+        uint32_t                                blockHeaderSize;
+        std::vector<Pool>                       pools;
+    };
+
+    struct Summary {
+        uint64_t        capacity;
+        uint64_t        usedBlocks;
+        uint64_t        usedBytes;
+        uint64_t        freeBlocks;
+        uint64_t        freeBytes;
+        uint64_t        largestFree;
+        uint64_t        histogram[HistogramBuckets];    // free blocks in [ 2^i, 2^(i+1) )
+        double fragmentation() const {
+            return freeBytes ? 1.0 - (double)largestFree / (double)freeBytes : 0.0;
+        }
+    };
+
+    bool loadSnapshot( const char* path, Snapshot& snapshot ) {
+        FILE* file = fopen(path, "rb");
+        if(!file) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return false;
+        }
+        ugi::TLSFSnapshotHeader header;
+        bool succeeded = fread(&header, sizeof(header), 1, file) == 1
+            && !memcmp(header.magic, ugi::TLSFSnapshotMagic, sizeof(header.magic))
+            && header.version == ugi::TLSFSnapshotVersion;
+        snapshot.blockHeaderSize = header.blockHeaderSize;
+        for( uint64_t i = 0; succeeded && i < header.poolCount; ++i ) {
+            Pool pool;
+            succeeded = fread(&pool.record, sizeof(pool.record), 1, file) == 1;
+            if(succeeded) {
+                pool.blocks.resize(pool.record.blockCount);
+                succeeded = fread(pool.blocks.data(), sizeof(ugi::TLSFSnapshotBlock), pool.blocks.size(), file) == pool.blocks.size();
+                snapshot.pools.push_back(std::move(pool));
+            }
+        }
+        fclose(file);
+        if(!succeeded) {
+            fprintf(stderr, "%s is not a complete TLSF snapshot ( version %u )\n", path, ugi::TLSFSnapshotVersion);
+        }
+        return succeeded;
+    }
+
+    int floorLog2( uint64_t value ) {
+        int log2 = 0;
+        while(value >>= 1) {
+            ++log2;
+        }
+        return log2;
+    }
+
+    Summary summarize( const Snapshot& snapshot ) {
+        Summary summary;
+        memset(&summary, 0, sizeof(summary));
+        for( const Pool& pool : snapshot.pools ) {
+            summary.capacity += pool.record.capacity;
+            for( const ugi::TLSFSnapshotBlock& block : pool.blocks ) {
+                if(block.isFree()) {
+                    ++summary.freeBlocks;
+                    summary.freeBytes += block.size;
+                    summary.largestFree = block.size > summary.largestFree ? block.size : summary.largestFree;
+                    ++summary.histogram[block.size ? floorLog2(block.size) : 0];
+                }
+                else {
+                    ++summary.usedBlocks;
+                    summary.usedBytes += block.size;
+                }
+            }
+        }
+        return summary;
+    }
+
+    void printBucket( int bucket ) {
+        char range[32];
+        snprintf(range, sizeof(range), "%llu ..", 1ULL << bucket);
+        printf("  %-22s", range);
+    }
+
+    int summaryCommand( const char* path ) {
+        Snapshot snapshot;
+        if(!loadSnapshot(path, snapshot)) {
+            return 1;
+        }
+        Summary summary = summarize(snapshot);
+        printf("pools          : %zu, %llu bytes\n", snapshot.pools.size(), (unsigned long long)summary.capacity);
+        printf("used           : %llu blocks, %llu bytes\n", (unsigned long long)summary.usedBlocks, (unsigned long long)summary.usedBytes);
+        printf("free           : %llu blocks, %llu bytes\n", (unsigned long long)summary.freeBlocks, (unsigned long long)summary.freeBytes);
+        printf("header bytes   : %llu\n", (unsigned long long)((summary.usedBlocks + summary.freeBlocks) * snapshot.blockHeaderSize));
+        printf("largest hole   : %llu\n", (unsigned long long)summary.largestFree);
+        printf("fragmentation  : %.3f\n", summary.fragmentation());
+        printf("free block sizes\n");
+        uint64_t mostBlocks = 1;
+        for( uint64_t count : summary.histogram ) {
+            mostBlocks = count > mostBlocks ? count : mostBlocks;
+        }
+        for( int bucket = 0; bucket < (int)HistogramBuckets; ++bucket ) {
+            uint64_t count = summary.histogram[bucket];
+            if(!count) {
+                continue;
+            }
+            printBucket(bucket);
+            printf(" %10llu  ", (unsigned long long)count);
+            for( uint64_t bar = 0; bar < (count * 40 + mostBlocks - 1) / mostBlocks; ++bar ) {
+                putchar('#');
+            }
+            putchar('\n');
+        }
+        return 0;
+    }
+
+    void printRow( const char* name, double before, double after, const char* format ) {
+        printf("%-15s", name);
+        printf(format, before);
+        printf(format, after);
+        printf(format, after - before);
+        putchar('\n');
+    }
+
+    int diffCommand( const char* beforePath, const char* afterPath ) {
+        Snapshot before;
+        Snapshot after;
+        if(!loadSnapshot(beforePath, before) || !loadSnapshot(afterPath, after)) {
+            return 1;
+        }
+        Summary beforeSummary = summarize(before);
+        Summary afterSummary = summarize(after);
+        printf("%-15s %16s %16s %16s\n", "", "before", "after", "delta");
+        printRow("pools", (double)before.pools.size(), (double)after.pools.size(), " %16.0f");
+        printRow("capacity", (double)beforeSummary.capacity, (double)afterSummary.capacity, " %16.0f");
+        printRow("used blocks", (double)beforeSummary.usedBlocks, (double)afterSummary.usedBlocks, " %16.0f");
+        printRow("used bytes", (double)beforeSummary.usedBytes, (double)afterSummary.usedBytes, " %16.0f");
+        printRow("free blocks", (double)beforeSummary.freeBlocks, (double)afterSummary.freeBlocks, " %16.0f");
+        printRow("free bytes", (double)beforeSummary.freeBytes, (double)afterSummary.freeBytes, " %16.0f");
+        printRow("largest hole", (double)beforeSummary.largestFree, (double)afterSummary.largestFree, " %16.0f");
+        printRow("fragmentation", beforeSummary.fragmentation(), afterSummary.fragmentation(), " %16.3f");
+
+        // pools are sorted by base in both files, blocks by offset inside a pool
+        uint64_t keptBlocks = 0;
+        uint64_t goneBlocks = 0;
+        uint64_t goneBytes = 0;
+        uint64_t newBlocks = 0;
+        uint64_t newBytes = 0;
+        size_t beforePools = 0;
+        size_t afterPools = 0;
+        size_t onlyBefore = 0;
+        size_t onlyAfter = 0;
+        while(beforePools < before.pools.size() || afterPools < after.pools.size()) {
+            if(afterPools == after.pools.size() || (beforePools < before.pools.size() && before.pools[beforePools].record.base < after.pools[afterPools].record.base)) {
+                ++onlyBefore;
+                ++beforePools;
+                continue;
+            }
+            if(beforePools == before.pools.size() || after.pools[afterPools].record.base < before.pools[beforePools].record.base) {
+                ++onlyAfter;
+                ++afterPools;
+                continue;
+            }
+            const std::vector<ugi::TLSFSnapshotBlock>& beforeBlocks = before.pools[beforePools++].blocks;
+            const std::vector<ugi::TLSFSnapshotBlock>& afterBlocks = after.pools[afterPools++].blocks;
+            size_t i = 0;
+            size_t j = 0;
+            while(i < beforeBlocks.size() || j < afterBlocks.size()) {
+                const ugi::TLSFSnapshotBlock* b = i < beforeBlocks.size() ? &beforeBlocks[i] : nullptr;
+                const ugi::TLSFSnapshotBlock* a = j < afterBlocks.size() ? &afterBlocks[j] : nullptr;
+                if(a && b && a->offset == b->offset && a->size == b->size) {
+                    keptBlocks += a->isFree() ? 0 : 1;
+                    ++i;
+                    ++j;
+                }
+                else if(b && (!a || b->blockOffset() <= a->blockOffset())) {
+                    if(!b->isFree()) {
+                        ++goneBlocks;
+                        goneBytes += b->size;
+                    }
+                    ++i;
+                }
+                else {
+                    if(!a->isFree()) {
+                        ++newBlocks;
+                        newBytes += a->size;
+                    }
+                    ++j;
+                }
+            }
+        }
+        printf("\npools only before : %zu, only after : %zu\n", onlyBefore, onlyAfter);
+        printf("in shared pools : %llu used blocks unchanged, %llu gone ( %llu bytes ), %llu new ( %llu bytes )\n",
+            (unsigned long long)keptBlocks, (unsigned long long)goneBlocks, (unsigned long long)goneBytes,
+            (unsigned long long)newBlocks, (unsigned long long)newBytes);
+
+        printf("\n%-24s %16s %16s %16s\n", "free block sizes", "before", "after", "delta");
+        for( int bucket = 0; bucket < (int)HistogramBuckets; ++bucket ) {
+            uint64_t beforeCount = beforeSummary.histogram[bucket];
+            uint64_t afterCount = afterSummary.histogram[bucket];
+            if(!beforeCount && !afterCount) {
+                continue;
+            }
+            printBucket(bucket);
+            printf(" %16llu %16llu %+16lld\n", (unsigned long long)beforeCount, (unsigned long long)afterCount, (long long)afterCount - (long long)beforeCount);
+        }
+        return 0;
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    if(argc == 3 && !strcmp(argv[1], "summary")) {
+        return summaryCommand(argv[2]);
+    }
+    if(argc == 4 && !strcmp(argv[1], "diff")) {
+        return diffCommand(argv[2], argv[3]);
+    }
+    fprintf(stderr, "usage : %s summary <snapshot>\n        %s diff <before> <after>\n", argv[0], argv[0]);
+    return 2;
+}
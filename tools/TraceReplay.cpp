@@ -0,0 +1,375 @@
+/***************************************************
+** Two Level Segregated Fit memory allocator
+** Written by bhlzlx@gmail.com ( lixin )
+**
+** Copyright (c) 2020, bhlzlx@gmail.com
+** All rights reserved.
+****************************************************/
+
+/*
+** Replays an allocation trace recorded through TracingAllocator::setTraceWriter.
+**
+**   tlsf_trace_replay <trace> [ backend ... ]     backends : tlsf compact slab malloc ( default all )
+**
+** The trace is first compiled into a list of operations on numbered slots, so
+** the timed replay does no address lookups. Events are replayed in file order
+** on one thread, which makes every run deterministic. A block that is handed
+** out again before the free of its previous owner was logged ( a race between
+** threads of the recording ) is matched first in first out. Frees of blocks
+** allocated before the recording started are skipped.
+**
+** Per backend : replay time, peak footprint ( bytes taken from the pool
+** provider ), peak bytes in use and the fragmentation index
+** ( 1 - largest free block / free bytes ) when the trace ends.
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "TLSF.hpp"
+#include "TLSFSlab.h"
+#include "TLSFTrace.h"
+#include "../MemoryAllocator.h"
+
+namespace {
+
+    enum class OpType : uint8_t {
+        Alloc,
+        AllocAligned,
+        Realloc,
+        Expand,
+        Free,
+    };
+
+    struct Op {
+        OpType          type;
+        uint32_t        slot;
+        uint64_t        size;
+        uint64_t        align;
+    };
+
+    struct Program {
+        std::vector<Op>     ops;
+        size_t              slotCount;
+        uint64_t            peakLiveBytes;      // requested bytes
+        uint64_t            skippedEvents;
+        double              seconds;            // recorded duration
+        uint32_t            threads;
+    };
+
+    bool loadTrace( const char* path, ugi::TLSFTraceHeader& header, std::vector<ugi::TLSFTraceEvent>& events ) {
+        FILE* file = fopen(path, "rb");
+        if(!file) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return false;
+        }
+        bool succeeded = fread(&header, sizeof(header), 1, file) == 1
+            && !memcmp(header.magic, ugi::TLSFTraceMagic, sizeof(header.magic))
+            && header.version == ugi::TLSFTraceVersion
+            && header.eventSize == sizeof(ugi::TLSFTraceEvent);
+        if(succeeded) {
+            events.resize(header.eventCount);
+            succeeded = fread(events.data(), sizeof(ugi::TLSFTraceEvent), events.size(), file) == events.size();
+        }
+        fclose(file);
+        if(!succeeded) {
+            fprintf(stderr, "%s is not a complete TLSF trace ( version %u )\n", path, ugi::TLSFTraceVersion);
+        }
+        return succeeded;
+    }
+
+    Program compile( const std::vector<ugi::TLSFTraceEvent>& events ) {
+        Program program;
+        program.peakLiveBytes = 0;
+        program.skippedEvents = 0;
+        program.seconds = 0.0;
+        program.threads = 0;
+        std::unordered_map<uint64_t, std::deque<uint32_t>> liveSlots;   // recorded address -> slots, oldest first
+        std::vector<uint32_t> freeSlots;
+        std::vector<uint64_t> slotSizes;
+        uint64_t liveBytes = 0;
+        auto newSlot = [&]() -> uint32_t {
+            if(!freeSlots.empty()) {
+                uint32_t slot = freeSlots.back();
+                freeSlots.pop_back();
+                return slot;
+            }
+            slotSizes.push_back(0);
+            return (uint32_t)slotSizes.size() - 1;
+        };
+        auto takeSlot = [&]( uint64_t ptr, uint32_t& slot ) -> bool {
+            auto iter = liveSlots.find(ptr);
+            if(iter == liveSlots.end()) {
+                return false;
+            }
+            slot = iter->second.front();
+            iter->second.pop_front();
+            if(iter->second.empty()) {
+                liveSlots.erase(iter);
+            }
+            return true;
+        };
+        auto setSize = [&]( uint32_t slot, uint64_t size ) {
+            liveBytes = liveBytes - slotSizes[slot] + size;
+            slotSizes[slot] = size;
+            program.peakLiveBytes = liveBytes > program.peakLiveBytes ? liveBytes : program.peakLiveBytes;
+        };
+        for( const ugi::TLSFTraceEvent& event : events ) {
+            program.threads = event.thread() + 1 > program.threads ? event.thread() + 1 : program.threads;
+            Op op;
+            op.size = event.size();
+            op.align = 0;
+            switch(event.type()) {
+            case ugi::TLSFTraceEventType::Alloc:
+            case ugi::TLSFTraceEventType::AllocAligned:
+                op.type = event.type() == ugi::TLSFTraceEventType::Alloc ? OpType::Alloc : OpType::AllocAligned;
+                op.align = event.aux;
+                op.slot = newSlot();
+                liveSlots[event.ptr].push_back(op.slot);
+                setSize(op.slot, op.size);
+                break;
+            case ugi::TLSFTraceEventType::Realloc:
+                if(!event.aux && !op.size) {
+                    ++program.skippedEvents;
+                    continue;
+                }
+                if(!event.aux) {
+                    op.type = OpType::Alloc;
+                    op.slot = newSlot();
+                }
+                else if(!takeSlot(event.aux, op.slot)) {
+                    ++program.skippedEvents;
+                    continue;
+                }
+                else {
+                    op.type = op.size ? OpType::Realloc : OpType::Free;
+                }
+                if(op.type == OpType::Free) {
+                    setSize(op.slot, 0);
+                    freeSlots.push_back(op.slot);
+                }
+                else {
+                    liveSlots[event.ptr].push_back(op.slot);
+                    setSize(op.slot, op.size);
+                }
+                break;
+            case ugi::TLSFTraceEventType::Expand: {
+                auto iter = liveSlots.find(event.ptr);
+                if(iter == liveSlots.end()) {
+                    ++program.skippedEvents;
+                    continue;
+                }
+                op.type = OpType::Expand;
+                op.slot = iter->second.front();
+                setSize(op.slot, op.size);
+                break;
+            }
+            case ugi::TLSFTraceEventType::Free:
+                if(!takeSlot(event.ptr, op.slot)) {
+                    ++program.skippedEvents;
+                    continue;
+                }
+                op.type = OpType::Free;
+                setSize(op.slot, 0);
+                freeSlots.push_back(op.slot);
+                break;
+            default:
+                ++program.skippedEvents;
+                continue;
+            }
+            program.ops.push_back(op);
+        }
+        program.slotCount = slotSizes.size();
+        return program;
+    }
+
+    // geometric growth, remembers the most bytes it had handed out at once
+    class FootprintPoolProvider : public ugi::TLSFGeometricPoolProvider {
+    private:
+        size_t      _bytes;
+        size_t      _peakBytes;
+    public:
+        FootprintPoolProvider()
+            : ugi::TLSFGeometricPoolProvider(1024 * 1024)
+            , _bytes(0)
+            , _peakBytes(0)
+        {}
+        virtual ugi::TLSFPool acquirePool( size_t minimumCapacity ) override {
+            ugi::TLSFPool pool = ugi::TLSFGeometricPoolProvider::acquirePool(minimumCapacity);
+            _bytes += pool.capacity();
+            _peakBytes = _bytes > _peakBytes ? _bytes : _peakBytes;
+            return pool;
+        }
+        virtual void releasePool( ugi::TLSFPool& pool ) override {
+            _bytes -= pool.capacity();
+            ugi::TLSFGeometricPoolProvider::releasePool(pool);
+        }
+        size_t peakBytes() const {
+            return _peakBytes;
+        }
+    };
+
+    struct MallocAllocator {
+        void* alloc( size_t size ) {
+            return std::malloc(size);
+        }
+        void* allocAligned( size_t size, size_t align ) {
+#if defined(_WIN32)
+            (void)align;
+            return std::malloc(size);   // nothing that free() takes back can be aligned here
+#else
+            void* ptr = nullptr;
+            return posix_memalign(&ptr, align < sizeof(void*) ? sizeof(void*) : align, size) == 0 ? ptr : nullptr;
+#endif
+        }
+        void* realloc( void* ptr, size_t size ) {
+            return std::realloc(ptr, size);
+        }
+        bool tryExpand( void*, size_t ) {
+            return false;
+        }
+        void free( void* ptr ) {
+            std::free(ptr);
+        }
+    };
+
+    struct ReplayResult {
+        double          seconds;
+        uint64_t        failedOps;
+    };
+
+    template< class Allocator >
+    ReplayResult replay( Allocator& allocator, const Program& program, std::vector<void*>& slots ) {
+        ReplayResult result;
+        result.failedOps = 0;
+        slots.assign(program.slotCount, nullptr);
+        auto start = std::chrono::steady_clock::now();
+        for( const Op& op : program.ops ) {
+            void*& ptr = slots[op.slot];
+            switch(op.type) {
+            case OpType::Alloc:
+                ptr = allocator.alloc(op.size);
+                result.failedOps += ptr ? 0 : 1;
+                break;
+            case OpType::AllocAligned:
+                ptr = allocator.allocAligned(op.size, op.align);
+                result.failedOps += ptr ? 0 : 1;
+                break;
+            case OpType::Realloc: {
+                void* newPtr = allocator.realloc(ptr, op.size);
+                if(newPtr) {
+                    ptr = newPtr;
+                }
+                else {
+                    ++result.failedOps;
+                }
+                break;
+            }
+            case OpType::Expand:
+                if(ptr) {
+                    allocator.tryExpand(ptr, op.size);
+                }
+                break;
+            case OpType::Free:
+                if(ptr) {
+                    allocator.free(ptr);
+                    ptr = nullptr;
+                }
+                break;
+            }
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    void printResult( const char* name, const Program& program, const ReplayResult& result, size_t footprint, size_t peakInUse, double fragmentation ) {
+        printf("%-10s %10.2f %10.1f %14zu %14zu %8.3f %8.3f %8llu\n", name, result.seconds * 1000.0, result.seconds * 1e9 / program.ops.size(),
+            footprint, peakInUse, footprint ? (double)program.peakLiveBytes / footprint : 0.0, fragmentation, (unsigned long long)result.failedOps);
+    }
+
+    template< class Allocator, class HeapType >
+    void replayTLSF( const char* name, const Program& program, Allocator& allocator, HeapType& heap, FootprintPoolProvider& provider ) {
+        heap.setPoolProvider(&provider, 0);
+        std::vector<void*> slots;
+        ReplayResult result = replay(allocator, program, slots);
+        auto stats = heap.getStats();
+        double fragmentation = stats.freeBytes ? 1.0 - (double)stats.largestFreeBlock / stats.freeBytes : 0.0;
+        printResult(name, program, result, provider.peakBytes(), stats.peakBytesInUse, fragmentation);
+        for( void* ptr : slots ) {
+            if(ptr) {
+                allocator.free(ptr);
+            }
+        }
+    }
+
+    void replayBackend( const std::string& backend, const Program& program ) {
+        if(backend == "tlsf") {
+            FootprintPoolProvider provider;
+            ugi::MemoryAllocator<ugi::TLSF> allocator;
+            replayTLSF("tlsf", program, allocator, allocator.allocator(), provider);
+        }
+        else if(backend == "compact") {
+            FootprintPoolProvider provider;
+            ugi::MemoryAllocator<ugi::TLSFCompact> allocator;
+            replayTLSF("compact", program, allocator, allocator.allocator(), provider);
+        }
+        else if(backend == "slab") {
+            FootprintPoolProvider provider;
+            ugi::MemoryAllocator<ugi::TLSFSlabAllocator<ugi::TLSF>> allocator;
+            replayTLSF("slab", program, allocator, allocator.allocator().heap(), provider);
+        }
+        else if(backend == "malloc") {
+            MallocAllocator allocator;
+            std::vector<void*> slots;
+            ReplayResult result = replay(allocator, program, slots);
+            printf("%-10s %10.2f %10.1f %14s %14s %8s %8s %8llu\n", "malloc", result.seconds * 1000.0, result.seconds * 1e9 / program.ops.size(),
+                "-", "-", "-", "-", (unsigned long long)result.failedOps);
+            for( void* ptr : slots ) {
+                std::free(ptr);
+            }
+        }
+        else {
+            fprintf(stderr, "unknown backend %s\n", backend.c_str());
+        }
+    }
+
+}
+
+int main( int argc, char** argv ) {
+    if(argc < 2) {
+        fprintf(stderr, "usage : %s <trace> [ tlsf | compact | slab | malloc ... ]\n", argv[0]);
+        return 2;
+    }
+    ugi::TLSFTraceHeader header;
+    std::vector<ugi::TLSFTraceEvent> events;
+    if(!loadTrace(argv[1], header, events)) {
+        return 1;
+    }
+    Program program = compile(events);
+    if(!events.empty() && header.ticksPerSecond) {
+        program.seconds = (double)(events.back().timestamp() - events.front().timestamp()) / header.ticksPerSecond;
+    }
+    printf("events         : %llu ( %llu dropped while recording, %llu skipped )\n", (unsigned long long)header.eventCount,
+        (unsigned long long)header.droppedEvents, (unsigned long long)program.skippedEvents);
+    printf("recorded       : %.3f s, %u threads\n", program.seconds, program.threads);
+    printf("peak live      : %llu requested bytes, %zu slots\n\n", (unsigned long long)program.peakLiveBytes, program.slotCount);
+    printf("%-10s %10s %10s %14s %14s %8s %8s %8s\n", "backend", "ms", "ns / op", "footprint", "peak in use", "util", "frag", "failed");
+    std::vector<std::string> backends;
+    for( int i = 2; i < argc; ++i ) {
+        backends.push_back(argv[i]);
+    }
+    if(backends.empty()) {
+        backends = { "tlsf", "compact", "slab", "malloc" };
+    }
+    for( const std::string& backend : backends ) {
+        replayBackend(backend, program);
+    }
+    return 0;
+}